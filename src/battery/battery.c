@@ -80,7 +80,11 @@ void default_battery()
     battery_low_cmd_sent = FALSE;
     battery_full_cmd_sent = FALSE;
     INIT_TIMER(battery_timer);
+    set_timer_anchored(&battery_timer, true);
+    set_timer_slack(&battery_timer, 1000);
     INIT_TIMER(battery_blink_timer);
+    set_timer_anchored(&battery_blink_timer, true);
+    set_timer_slack(&battery_blink_timer, 50);
     battery_warn = FALSE;
     battery_warn_red = FALSE;
     bat1_has_font = FALSE;
@@ -215,13 +215,13 @@ void button_reload_icon(Button *button)
 
     char *new_icon_path = get_icon_path(icon_theme_wrapper, button->backend->icon_name, button->frontend->iconw, TRUE);
     if (new_icon_path)
-        button->frontend->icon = load_image(new_icon_path, TRUE);
+        button->frontend->icon = load_image_at_size(new_icon_path, button->frontend->iconw, TRUE);
     free(new_icon_path);
     // On loading error, fallback to default
     if (!button->frontend->icon) {
         new_icon_path = get_icon_path(icon_theme_wrapper, DEFAULT_ICON, button->frontend->iconw, TRUE);
         if (new_icon_path)
-            button->frontend->icon = load_image(new_icon_path, TRUE);
+            button->frontend->icon = load_image_at_size(new_icon_path, button->frontend->iconw, TRUE);
         free(new_icon_path);
     }
     Imlib_Image original = button->frontend->icon;
@@ -456,21 +456,21 @@ void draw_button(void *obj, cairo_t *c)
         }
 
         imlib_context_set_image(image);
-        render_image(button->area.pix, button->frontend->iconx, button->frontend->icony);
+        draw_area_image(&button->area, c, button->frontend->iconx, button->frontend->icony);
     }
 
     // Render text
     if (button->backend->text) {
-        PangoContext *context = pango_cairo_create_context(c);
-        pango_cairo_context_set_resolution(context, 96 * panel->scale);
-        PangoLayout *layout = pango_layout_new(context);
-
-        pango_layout_set_font_description(layout, button->backend->font_desc);
-        pango_layout_set_width(layout, (button->frontend->textw + TINT2_PANGO_SLACK) * PANGO_SCALE);
-        pango_layout_set_alignment(layout, button->backend->centered ? PANGO_ALIGN_CENTER : PANGO_ALIGN_LEFT);
-        pango_layout_set_wrap(layout, PANGO_WRAP_WORD_CHAR);
-        pango_layout_set_ellipsize(layout, PANGO_ELLIPSIZE_NONE);
-        pango_layout_set_text(layout, button->backend->text, strlen(button->backend->text));
+        PangoLayout *layout = update_text_layout(&button->area.text_layouts[0],
+                                                 button->backend->font_desc,
+                                                 button->backend->text,
+                                                 FALSE,
+                                                 (button->frontend->textw + TINT2_PANGO_SLACK) * PANGO_SCALE,
+                                                 -1,
+                                                 PANGO_WRAP_WORD_CHAR,
+                                                 PANGO_ELLIPSIZE_NONE,
+                                                 button->backend->centered ? PANGO_ALIGN_CENTER : PANGO_ALIGN_LEFT,
+                                                 panel->scale);
 
         pango_cairo_update_layout(c, layout);
         draw_text(layout,
@@ -479,9 +479,6 @@ void draw_button(void *obj, cairo_t *c)
                   button->frontend->texty,
                   &button->backend->font_color,
                   panel_config.font_shadow ? layout : NULL);
-
-        g_object_unref(layout);
-        g_object_unref(context);
     }
 }
 
@@ -66,6 +66,7 @@ void default_clock()
     time2_format = NULL;
     time2_timezone = NULL;
     INIT_TIMER(clock_timer);
+    set_timer_slack(&clock_timer, 20);
     time_tooltip_format = NULL;
     time_tooltip_timezone = NULL;
     clock_lclick_command = NULL;
@@ -239,6 +239,15 @@ Button *get_or_create_last_button()
     return (Button *)g_list_last(panel_config.button_list)->data;
 }
 
+Metrics *get_or_create_last_metrics()
+{
+    if (!panel_config.metrics_list) {
+        fprintf(stderr, "tint2: Warning: metrics items should start with 'metrics = new'\n");
+        panel_config.metrics_list = g_list_append(panel_config.metrics_list, create_metrics());
+    }
+    return (Metrics *)g_list_last(panel_config.metrics_list)->data;
+}
+
 void add_entry(char *key, char *value)
 {
     char *value1 = 0, *value2 = 0, *value3 = 0;
@@ -696,6 +705,11 @@ void add_entry(char *key, char *value)
         free_and_null(execp->backend->command);
         if (strlen(value) > 0)
             execp->backend->command = strdup(value);
+    } else if (strcmp(key, "execp_socket") == 0) {
+        Execp *execp = get_or_create_last_execp();
+        free_and_null(execp->backend->socket_path);
+        if (strlen(value) > 0)
+            execp->backend->socket_path = expand_tilde(value);
     } else if (strcmp(key, "execp_interval") == 0) {
         Execp *execp = get_or_create_last_execp();
         execp->backend->interval = 0;
@@ -881,6 +895,85 @@ void add_entry(char *key, char *value)
             button->backend->dwheel_command = strdup(value);
     }
 
+    /* Metrics */
+    else if (strcmp(key, "metrics") == 0) {
+        panel_config.metrics_list = g_list_append(panel_config.metrics_list, create_metrics());
+    } else if (strcmp(key, "metrics_format") == 0) {
+        Metrics *metrics = get_or_create_last_metrics();
+        free_and_null(metrics->backend->format1);
+        if (strlen(value) > 0)
+            metrics->backend->format1 = strdup(value);
+    } else if (strcmp(key, "metrics_format2") == 0) {
+        Metrics *metrics = get_or_create_last_metrics();
+        free_and_null(metrics->backend->format2);
+        if (strlen(value) > 0)
+            metrics->backend->format2 = strdup(value);
+    } else if (strcmp(key, "metrics_interval") == 0) {
+        Metrics *metrics = get_or_create_last_metrics();
+        metrics->backend->interval = MAX(1, atoi(value));
+    } else if (strcmp(key, "metrics_net_interface") == 0) {
+        Metrics *metrics = get_or_create_last_metrics();
+        free_and_null(metrics->backend->net_interface);
+        if (strlen(value) > 0)
+            metrics->backend->net_interface = strdup(value);
+    } else if (strcmp(key, "metrics_thermal_zone") == 0) {
+        Metrics *metrics = get_or_create_last_metrics();
+        metrics->backend->thermal_zone = MAX(0, atoi(value));
+    } else if (strcmp(key, "metrics_font") == 0) {
+        Metrics *metrics = get_or_create_last_metrics();
+        pango_font_description_free(metrics->backend->font_desc);
+        metrics->backend->font_desc = pango_font_description_from_string(value);
+        metrics->backend->has_font = TRUE;
+    } else if (strcmp(key, "metrics_font_color") == 0) {
+        Metrics *metrics = get_or_create_last_metrics();
+        extract_values(value, &value1, &value2, &value3);
+        get_color(value1, metrics->backend->font_color.rgb);
+        if (value2)
+            metrics->backend->font_color.alpha = atoi(value2) / 100.0;
+        else
+            metrics->backend->font_color.alpha = 0.5;
+    } else if (strcmp(key, "metrics_padding") == 0) {
+        Metrics *metrics = get_or_create_last_metrics();
+        extract_values(value, &value1, &value2, &value3);
+        metrics->backend->paddingxlr = metrics->backend->paddingx = atoi(value1);
+        if (value2)
+            metrics->backend->paddingy = atoi(value2);
+        else
+            metrics->backend->paddingy = 0;
+        if (value3)
+            metrics->backend->paddingx = atoi(value3);
+    } else if (strcmp(key, "metrics_background_id") == 0) {
+        Metrics *metrics = get_or_create_last_metrics();
+        int id = atoi(value);
+        id = (id < backgrounds->len && id >= 0) ? id : 0;
+        metrics->backend->bg = &g_array_index(backgrounds, Background, id);
+    } else if (strcmp(key, "metrics_lclick_command") == 0) {
+        Metrics *metrics = get_or_create_last_metrics();
+        free_and_null(metrics->backend->lclick_command);
+        if (strlen(value) > 0)
+            metrics->backend->lclick_command = strdup(value);
+    } else if (strcmp(key, "metrics_mclick_command") == 0) {
+        Metrics *metrics = get_or_create_last_metrics();
+        free_and_null(metrics->backend->mclick_command);
+        if (strlen(value) > 0)
+            metrics->backend->mclick_command = strdup(value);
+    } else if (strcmp(key, "metrics_rclick_command") == 0) {
+        Metrics *metrics = get_or_create_last_metrics();
+        free_and_null(metrics->backend->rclick_command);
+        if (strlen(value) > 0)
+            metrics->backend->rclick_command = strdup(value);
+    } else if (strcmp(key, "metrics_uwheel_command") == 0) {
+        Metrics *metrics = get_or_create_last_metrics();
+        free_and_null(metrics->backend->uwheel_command);
+        if (strlen(value) > 0)
+            metrics->backend->uwheel_command = strdup(value);
+    } else if (strcmp(key, "metrics_dwheel_command") == 0) {
+        Metrics *metrics = get_or_create_last_metrics();
+        free_and_null(metrics->backend->dwheel_command);
+        if (strlen(value) > 0)
+            metrics->backend->dwheel_command = strdup(value);
+    }
+
     /* Clock */
     else if (strcmp(key, "time1_format") == 0) {
         if (!new_config_file) {
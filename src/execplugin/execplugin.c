@@ -11,18 +11,42 @@
 #include <errno.h>
 #include <time.h>
 #include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 
 #include "window.h"
 #include "server.h"
 #include "panel.h"
 #include "timer.h"
 #include "common.h"
+#include "reactor.h"
+#include "subprocess.h"
 
 #define MAX_TOOLTIP_LEN 4096
+// Minimum interval between two updates displayed in push mode
+#define EXECP_PUSH_INTERVAL_MS 16
+// Longer updates are discarded
+#define EXECP_PUSH_MAX_UPDATE_LEN (64 * 1024)
+// Maximum number of bytes read from a push client in one callback, so that a fast producer cannot starve the main loop
+#define EXECP_PUSH_MAX_READ_LEN (16 * 1024)
+
+typedef struct ExecpClient {
+    Execp *execp;
+    int fd;
+    char *buf;
+    ssize_t buf_length;
+    ssize_t buf_capacity;
+    // The FIFO cannot be reconnected, so an overlong update is skipped instead of dropping the client
+    gboolean is_fifo;
+    // Set while skipping the rest of an overlong update on the FIFO
+    gboolean discarding;
+} ExecpClient;
 
 bool debug_executors = false;
 
 void execp_timer_callback(void *arg);
+void free_execp_client(void *obj);
 char *execp_get_tooltip(void *obj);
 void execp_init_fonts();
 int execp_compute_desired_size(void *obj);
@@ -38,6 +62,7 @@ Execp *create_execp()
     execp->backend = (ExecpBackend *)calloc(1, sizeof(ExecpBackend));
     execp->backend->child_pipe_stdout = -1;
     execp->backend->child_pipe_stderr = -1;
+    execp->backend->push_listen_fd = -1;
     execp->backend->cmd_pids = g_tree_new(cmp_ptr);
     execp->backend->interval = 30;
     execp->backend->cache_icon = TRUE;
@@ -45,6 +70,7 @@ Execp *create_execp()
     execp->backend->font_color.alpha = 0.5;
     execp->backend->monitor = -1;
     INIT_TIMER(execp->backend->timer);
+    INIT_TIMER(execp->backend->push_timer);
     execp->backend->bg = &g_array_index(backgrounds, Background, 0);
     execp->backend->buf_stdout_capacity = 1024;
     execp->backend->buf_stdout = calloc(execp->backend->buf_stdout_capacity, 1);
@@ -98,21 +124,34 @@ void destroy_execp(void *obj)
     } else {
         // This is a backend element
         destroy_timer(&execp->backend->timer);
+        destroy_timer(&execp->backend->push_timer);
+        g_list_free_full(execp->backend->push_clients, free_execp_client);
+        execp->backend->push_clients = NULL;
+        free_and_null(execp->backend->push_pending);
+        if (execp->backend->push_listen_fd >= 0) {
+            reactor_remove_fd(execp->backend->push_listen_fd);
+            close(execp->backend->push_listen_fd);
+            execp->backend->push_listen_fd = -1;
+            unlink(execp->backend->socket_path);
+        }
 
         free_icon(execp->backend->icon);
         free_and_null(execp->backend->buf_stdout);
         free_and_null(execp->backend->buf_stderr);
         free_and_null(execp->backend->text);
         free_and_null(execp->backend->icon_path);
+        free_and_null(execp->backend->icon_loaded_path);
         if (execp->backend->child) {
             kill(-execp->backend->child, SIGHUP);
             execp->backend->child = 0;
         }
         if (execp->backend->child_pipe_stdout >= 0) {
+            reactor_remove_fd(execp->backend->child_pipe_stdout);
             close(execp->backend->child_pipe_stdout);
             execp->backend->child_pipe_stdout = -1;
         }
         if (execp->backend->child_pipe_stderr >= 0) {
+            reactor_remove_fd(execp->backend->child_pipe_stderr);
             close(execp->backend->child_pipe_stderr);
             execp->backend->child_pipe_stderr = -1;
         }
@@ -125,6 +164,7 @@ void destroy_execp(void *obj)
         pango_font_description_free(execp->backend->font_desc);
         execp->backend->font_desc = NULL;
         free_and_null(execp->backend->command);
+        free_and_null(execp->backend->socket_path);
         free_and_null(execp->backend->tooltip);
         free_and_null(execp->backend->lclick_command);
         free_and_null(execp->backend->mclick_command);
@@ -171,6 +211,9 @@ void init_execp()
         // Set missing config options
         if (!execp->backend->bg)
             execp->backend->bg = &g_array_index(backgrounds, Background, 0);
+
+        if (execp->backend->socket_path)
+            execp_listen(execp);
     }
 }
 
@@ -199,7 +242,8 @@ void init_execp_panel(void *p)
         snprintf(execp->area.name,
                  sizeof(execp->area.name),
                  "Execp %s",
-                 execp->backend->command ? execp->backend->command : "null");
+                 execp->backend->command ? execp->backend->command
+                                         : execp->backend->socket_path ? execp->backend->socket_path : "null");
         execp->area._draw_foreground = draw_execp;
         execp->area.size_mode = LAYOUT_FIXED;
         execp->area._resize = resize_execp;
@@ -217,7 +261,7 @@ void init_execp_panel(void *p)
 
         change_timer(&execp->backend->timer, true, 10, 0, execp_timer_callback, execp);
 
-        execp_update_post_read(execp);
+        execp_update_post_read(execp, FALSE);
     }
 }
 
@@ -273,51 +317,71 @@ void cleanup_execp()
 }
 
 // Called from backend functions.
+// Loads the icon named by the output, unless the same file is already loaded: the icon is keyed by the path, the
+// modification time and the size of the file (the target size is fixed by the config). If cache_icon is not set,
+// the icon is reloaded anyway.
+// Returns TRUE if the icon has changed.
 gboolean reload_icon(Execp *execp)
 {
-    char *icon_path = execp->backend->icon_path;
+    ExecpBackend *backend = execp->backend;
+    if (!backend->has_icon)
+        return FALSE;
 
-    if (execp->backend->has_icon && icon_path) {
-        if (execp->backend->icon) {
-            imlib_context_set_image(execp->backend->icon);
-            imlib_free_image();
-        }
-        execp->backend->icon = load_image(icon_path, execp->backend->cache_icon);
-        if (execp->backend->icon) {
-            imlib_context_set_image(execp->backend->icon);
-            int w = imlib_image_get_width();
-            int h = imlib_image_get_height();
-            if (w && h) {
-                if (execp->backend->icon_w) {
-                    if (!execp->backend->icon_h) {
-                        h = (int)(0.5 + h * execp->backend->icon_w / (float)(w));
-                        w = execp->backend->icon_w;
-                    } else {
-                        w = execp->backend->icon_w;
-                        h = execp->backend->icon_h;
-                    }
-                } else {
-                    if (execp->backend->icon_h) {
-                        w = (int)(0.5 + w * execp->backend->icon_h / (float)(h));
-                        h = execp->backend->icon_h;
-                    }
-                }
-                if (w < 1)
-                    w = 1;
-                if (h < 1)
-                    h = 1;
+    time_t mtime = 0;
+    off_t size = -1;
+    struct stat st;
+    if (backend->icon_path && stat(backend->icon_path, &st) == 0) {
+        mtime = st.st_mtime;
+        size = st.st_size;
+    }
+    if (g_strcmp0(backend->icon_path, backend->icon_loaded_path) == 0 && mtime == backend->icon_loaded_mtime &&
+        size == backend->icon_loaded_size && (backend->cache_icon || !backend->icon_path))
+        return FALSE;
+
+    gboolean had_icon = backend->icon != NULL;
+    free_icon(backend->icon);
+    backend->icon = NULL;
+    free_and_null(backend->icon_loaded_path);
+    backend->icon_loaded_mtime = mtime;
+    backend->icon_loaded_size = size;
+    if (!backend->icon_path)
+        return had_icon;
+    backend->icon_loaded_path = strdup(backend->icon_path);
+
+    backend->icon = load_image_at_size(backend->icon_path, MAX(backend->icon_w, backend->icon_h), backend->cache_icon);
+    if (!backend->icon)
+        return had_icon;
+    imlib_context_set_image(backend->icon);
+    int w = imlib_image_get_width();
+    int h = imlib_image_get_height();
+    if (w && h) {
+        if (backend->icon_w) {
+            if (!backend->icon_h) {
+                h = (int)(0.5 + h * backend->icon_w / (float)(w));
+                w = backend->icon_w;
+            } else {
+                w = backend->icon_w;
+                h = backend->icon_h;
             }
-            if (w != imlib_image_get_width() || h != imlib_image_get_height()) {
-                Imlib_Image icon_scaled =
-                    imlib_create_cropped_scaled_image(0, 0, imlib_image_get_width(), imlib_image_get_height(), w, h);
-                imlib_context_set_image(execp->backend->icon);
-                imlib_free_image();
-                execp->backend->icon = icon_scaled;
+        } else {
+            if (backend->icon_h) {
+                w = (int)(0.5 + w * backend->icon_h / (float)(h));
+                h = backend->icon_h;
             }
-            return TRUE;
         }
+        if (w < 1)
+            w = 1;
+        if (h < 1)
+            h = 1;
     }
-    return FALSE;
+    if (w != imlib_image_get_width() || h != imlib_image_get_height()) {
+        Imlib_Image icon_scaled =
+            imlib_create_cropped_scaled_image(0, 0, imlib_image_get_width(), imlib_image_get_height(), w, h);
+        imlib_context_set_image(backend->icon);
+        imlib_free_image();
+        backend->icon = icon_scaled;
+    }
+    return TRUE;
 }
 
 void execp_compute_icon_text_geometry(Execp *execp,
@@ -338,14 +402,10 @@ void execp_compute_icon_text_geometry(Execp *execp,
     *vert_padding = (panel_horizontal ? area->paddingy : area->paddingxlr) * panel->scale;
     *interior_padding = area->paddingx * panel->scale;
 
-    if (reload_icon(execp)) {
-        if (execp->backend->icon) {
-            imlib_context_set_image(execp->backend->icon);
-            *icon_w = imlib_image_get_width();
-            *icon_h = imlib_image_get_height();
-        } else {
-            *icon_w = *icon_h = 0;
-        }
+    if (execp->backend->has_icon && execp->backend->icon) {
+        imlib_context_set_image(execp->backend->icon);
+        *icon_w = imlib_image_get_width();
+        *icon_h = imlib_image_get_height();
     } else {
         *icon_w = *icon_h = 0;
     }
@@ -529,28 +589,30 @@ void draw_execp(void *obj, cairo_t *c)
     Execp *execp = (Execp *)obj;
     Panel *panel = (Panel *)execp->area.panel;
 
-    PangoContext *context = pango_cairo_create_context(c);
-    pango_cairo_context_set_resolution(context, 96 * panel->scale);
-    PangoLayout *layout = create_execp_text_layout(execp, context);
+    PangoLayout *layout = update_text_layout(&execp->area.text_layouts[0],
+                                             execp->backend->font_desc,
+                                             execp->backend->text,
+                                             execp->backend->has_markup,
+                                             (execp->frontend->textw + TINT2_PANGO_SLACK) * PANGO_SCALE,
+                                             (execp->frontend->texth + TINT2_PANGO_SLACK) * PANGO_SCALE,
+                                             PANGO_WRAP_WORD_CHAR,
+                                             PANGO_ELLIPSIZE_NONE,
+                                             execp->backend->centered ? PANGO_ALIGN_CENTER : PANGO_ALIGN_LEFT,
+                                             panel->scale);
     PangoLayout *shadow_layout = NULL;
 
     if (execp->backend->has_icon && execp->backend->icon) {
         imlib_context_set_image(execp->backend->icon);
         // Render icon
-        render_image(execp->area.pix, execp->frontend->iconx, execp->frontend->icony);
+        draw_area_image(&execp->area, c, execp->frontend->iconx, execp->frontend->icony);
     }
 
     // draw layout
-    if (!execp->backend->has_markup) {
-        pango_layout_set_text(layout, execp->backend->text, strlen(execp->backend->text));
-    } else {
-        pango_layout_set_markup(layout, execp->backend->text, strlen(execp->backend->text));
-        if (panel_config.font_shadow) {
-            shadow_layout = create_execp_text_layout(execp, context);
-            if (!layout_set_markup_strip_colors(shadow_layout, execp->backend->text)) {
-                g_object_unref(shadow_layout);
-                shadow_layout = NULL;
-            }
+    if (execp->backend->has_markup && panel_config.font_shadow) {
+        shadow_layout = create_execp_text_layout(execp, pango_layout_get_context(layout));
+        if (!layout_set_markup_strip_colors(shadow_layout, execp->backend->text)) {
+            g_object_unref(shadow_layout);
+            shadow_layout = NULL;
         }
     }
 
@@ -562,8 +624,8 @@ void draw_execp(void *obj, cairo_t *c)
               &execp->backend->font_color,
               shadow_layout);
 
-    g_object_unref(layout);
-    g_object_unref(context);
+    if (shadow_layout)
+        g_object_unref(shadow_layout);
 }
 
 void execp_dump_geometry(void *obj, int indent)
@@ -681,38 +743,26 @@ void execp_timer_callback(void *arg)
 
     fcntl(pipe_fd_stderr[0], F_SETFL, O_NONBLOCK | fcntl(pipe_fd_stderr[0], F_GETFL));
 
-    // Fork and run command, capturing stdout in pipe
-    pid_t child = fork();
+    if (debug_executors)
+        fprintf(stderr, "tint2: Executing: %s\n", execp->backend->command);
+    // Run command in its own process group, capturing stdout and stderr in pipes
+    SpawnOptions options = SPAWN_OPTIONS_DEFAULT;
+    options.stdout_fd = pipe_fd_stdout[1];
+    options.stderr_fd = pipe_fd_stderr[1];
+    pid_t child = spawn_shell_command(execp->backend->command, &options);
+    close(pipe_fd_stdout[1]);
+    close(pipe_fd_stderr[1]);
     if (child == -1) {
         // TODO maybe write this in tooltip, but if this happens we're screwed anyways
-        fprintf(stderr, "tint2: Fork failed.\n");
-        close(pipe_fd_stdout[1]);
         close(pipe_fd_stdout[0]);
-        close(pipe_fd_stderr[1]);
         close(pipe_fd_stderr[0]);
         return;
-    } else if (child == 0) {
-        if (debug_executors)
-            fprintf(stderr, "tint2: Executing: %s\n", execp->backend->command);
-        // We are in the child
-        close(pipe_fd_stdout[0]);
-        dup2(pipe_fd_stdout[1], 1); // 1 is stdout
-        close(pipe_fd_stdout[1]);
-        close(pipe_fd_stderr[0]);
-        dup2(pipe_fd_stderr[1], 2); // 2 is stderr
-        close(pipe_fd_stderr[1]);
-        close_all_fds();
-        setpgid(0, 0);
-        execl("/bin/sh", "/bin/sh", "-c", execp->backend->command, NULL);
-        // This should never happen!
-        fprintf(stderr, "execl() failed\nexecl() failed\n");
-        exit(0);
     }
-    close(pipe_fd_stdout[1]);
-    close(pipe_fd_stderr[1]);
     execp->backend->child = child;
     execp->backend->child_pipe_stdout = pipe_fd_stdout[0];
     execp->backend->child_pipe_stderr = pipe_fd_stderr[0];
+    reactor_add_fd(execp->backend->child_pipe_stdout, handle_execp_output, execp);
+    reactor_add_fd(execp->backend->child_pipe_stderr, handle_execp_output, execp);
     execp->backend->buf_stdout_length = 0;
     execp->backend->buf_stdout[execp->backend->buf_stdout_length] = '\0';
     execp->backend->buf_stderr_length = 0;
@@ -789,6 +839,67 @@ void rstrip(char *s)
     }
 }
 
+// Sets the text and the icon path from the output of the command. Modifies the output.
+// Returns TRUE if they have changed.
+gboolean parse_execp_output(Execp *execp, char *output)
+{
+    char *text = output;
+    char *icon_path = NULL;
+    if (execp->backend->has_icon) {
+        text = strchr(output, '\n');
+        if (text) {
+            *text = '\0';
+            text++;
+        } else {
+            text = output + strlen(output);
+        }
+        icon_path = expand_tilde(output);
+    }
+    size_t len = strlen(text);
+    if (len > 0 && text[len - 1] == '\n')
+        text[len - 1] = '\0';
+
+    gboolean changed = g_strcmp0(icon_path, execp->backend->icon_path) != 0;
+    free_and_null(execp->backend->icon_path);
+    execp->backend->icon_path = icon_path;
+    if (strcmp(text, execp->backend->text) != 0) {
+        free_and_null(execp->backend->text);
+        execp->backend->text = strdup(text);
+        changed = TRUE;
+    }
+    return changed;
+}
+
+// Returns TRUE if the instances must be updated after reading the output.
+gboolean execp_needs_update(Execp *execp, gboolean output_changed)
+{
+    // Even if the output is the same, the icon file may have been rewritten in place. When it has not, this is only a
+    // stat() of the file.
+    if (reload_icon(execp))
+        execp->backend->icon_changed = TRUE;
+    return output_changed || execp->backend->icon_changed;
+}
+
+// Sets the tooltip from the standard error of the command, unless the tooltip is set in the config.
+void parse_execp_tooltip(Execp *execp, char *output)
+{
+    if (execp->backend->has_user_tooltip)
+        return;
+    char *ansi_clear_screen = (char*)"\x1b[2J";
+    free_and_null(execp->backend->tooltip);
+    char *start = last_substring(output, ansi_clear_screen);
+    if (start)
+        start += strlen(ansi_clear_screen);
+    else
+        start = output;
+    if (*start) {
+        execp->backend->tooltip = strdup(start);
+        rstrip(execp->backend->tooltip);
+        if (strlen(execp->backend->tooltip) > MAX_TOOLTIP_LEN)
+            execp->backend->tooltip[MAX_TOOLTIP_LEN] = '\0';
+    }
+}
+
 gboolean read_execp(void *obj)
 {
     Execp *execp = (Execp *)obj;
@@ -812,8 +923,10 @@ gboolean read_execp(void *obj)
 
     if (command_finished) {
         execp->backend->child = 0;
+        reactor_remove_fd(execp->backend->child_pipe_stdout);
         close(execp->backend->child_pipe_stdout);
         execp->backend->child_pipe_stdout = -1;
+        reactor_remove_fd(execp->backend->child_pipe_stderr);
         close(execp->backend->child_pipe_stderr);
         execp->backend->child_pipe_stderr = -1;
         if (execp->backend->interval)
@@ -823,48 +936,18 @@ gboolean read_execp(void *obj)
     char *ansi_clear_screen = (char*)"\x1b[2J";
     if (!execp->backend->continuous && command_finished) {
         // Handle stdout
-        free_and_null(execp->backend->text);
-        free_and_null(execp->backend->icon_path);
-        if (!execp->backend->has_icon) {
-            execp->backend->text = strdup(execp->backend->buf_stdout);
-        } else {
-            char *text = strchr(execp->backend->buf_stdout, '\n');
-            if (text) {
-                *text = '\0';
-                text++;
-                execp->backend->text = strdup(text);
-            } else {
-                execp->backend->text = strdup("");
-            }
-            execp->backend->icon_path = strdup(execp->backend->buf_stdout);
-        }
-        int len = strlen(execp->backend->text);
-        if (len > 0 && execp->backend->text[len - 1] == '\n')
-            execp->backend->text[len - 1] = '\0';
+        gboolean changed = parse_execp_output(execp, execp->backend->buf_stdout);
         execp->backend->buf_stdout_length = 0;
         execp->backend->buf_stdout[execp->backend->buf_stdout_length] = '\0';
         // Handle stderr
-        if (!execp->backend->has_user_tooltip) {
-            free_and_null(execp->backend->tooltip);
-            char *start = last_substring(execp->backend->buf_stderr, ansi_clear_screen);
-            if (start)
-                start += strlen(ansi_clear_screen);
-            else
-                start = execp->backend->buf_stderr;
-            if (*start) {
-                execp->backend->tooltip = strdup(start);
-                rstrip(execp->backend->tooltip);
-                if (strlen(execp->backend->tooltip) > MAX_TOOLTIP_LEN)
-                    execp->backend->tooltip[MAX_TOOLTIP_LEN] = '\0';
-            }
-        }
+        parse_execp_tooltip(execp, execp->backend->buf_stderr);
         execp->backend->buf_stderr_length = 0;
         execp->backend->buf_stderr[execp->backend->buf_stderr_length] = '\0';
         //
         execp->backend->last_update_finish_time = time(NULL);
         execp->backend->last_update_duration =
             execp->backend->last_update_finish_time - execp->backend->last_update_start_time;
-        return TRUE;
+        return execp_needs_update(execp, changed);
     } else if (execp->backend->continuous > 0) {
         // Handle stderr
         if (!execp->backend->has_user_tooltip) {
@@ -899,24 +982,7 @@ gboolean read_execp(void *obj)
         if (num_lines >= execp->backend->continuous) {
             if (end)
                 *end = '\0';
-            free_and_null(execp->backend->text);
-            free_and_null(execp->backend->icon_path);
-            if (!execp->backend->has_icon) {
-                execp->backend->text = strdup(execp->backend->buf_stdout);
-            } else {
-                char *text = strchr(execp->backend->buf_stdout, '\n');
-                if (text) {
-                    *text = '\0';
-                    text++;
-                    execp->backend->text = strdup(text);
-                } else {
-                    execp->backend->text = strdup("");
-                }
-                execp->backend->icon_path = expand_tilde(execp->backend->buf_stdout);
-            }
-            size_t len = strlen(execp->backend->text);
-            if (len > 0 && execp->backend->text[len - 1] == '\n')
-                execp->backend->text[len - 1] = '\0';
+            gboolean changed = parse_execp_output(execp, execp->backend->buf_stdout);
 
             if (end) {
                 char *next = end + 1;
@@ -935,7 +1001,7 @@ gboolean read_execp(void *obj)
             execp->backend->last_update_finish_time = time(NULL);
             execp->backend->last_update_duration =
                 execp->backend->last_update_finish_time - execp->backend->last_update_start_time;
-            return TRUE;
+            return execp_needs_update(execp, changed);
         }
     }
     return FALSE;
@@ -977,7 +1043,20 @@ char *execp_get_tooltip(void *obj)
     char tmp_buf1[256];
     char tmp_buf2[256];
     char tmp_buf3[256];
-    if (execp->backend->child_pipe_stdout < 0) {
+    if (!execp->backend->command && execp->backend->socket_path) {
+        // Push mode
+        if (execp->backend->last_update_finish_time) {
+            snprintf(execp->backend->tooltip_text,
+                     sizeof(execp->backend->tooltip_text),
+                     "Last update received %s ago.",
+                     time_to_string((int)(now - execp->backend->last_update_finish_time), tmp_buf1, sizeof(tmp_buf1)));
+        } else {
+            snprintf(execp->backend->tooltip_text,
+                     sizeof(execp->backend->tooltip_text),
+                     "Never updated. Waiting for updates on %s.",
+                     execp->backend->socket_path);
+        }
+    } else if (execp->backend->child_pipe_stdout < 0) {
         // Not executing command
         if (execp->backend->last_update_finish_time) {
             // We updated at least once
@@ -1020,43 +1099,261 @@ char *execp_get_tooltip(void *obj)
     return strdup(execp->backend->tooltip_text);
 }
 
-void execp_update_post_read(Execp *execp)
+void execp_update_post_read(Execp *execp, gboolean icon_changed)
 {
-    int icon_h, icon_w;
-    if (reload_icon(execp)) {
-        if (execp->backend->icon) {
-            imlib_context_set_image(execp->backend->icon);
-            icon_w = imlib_image_get_width();
-            icon_h = imlib_image_get_height();
-        } else {
-            icon_w = icon_h = 0;
-        }
-    } else {
-        icon_w = icon_h = 0;
-    }
-
-    if ((icon_h == 0 || icon_w == 0) && execp->backend->text[0] == 0) {
+    if (!(execp->backend->has_icon && execp->backend->icon) && execp->backend->text[0] == 0) {
         // Easy to test with bash -c 'R=$(( RANDOM % 2 )); [ $R -eq 0 ] && echo HELLO $R'
         if (execp->area.on_screen)
             hide(&execp->area);
+        return;
+    }
+    if (!execp->area.on_screen) {
+        show(&execp->area);
+        return;
+    }
+    if (!icon_changed && !execp->area.resize_needed) {
+        // If the text still has the same size, there is no need to relayout the panel
+        int horiz_padding, vert_padding, interior_padding;
+        int icon_w, icon_h;
+        gboolean text_next_line;
+        int txt_height, txt_width;
+        int new_size;
+        gboolean resized;
+        execp_compute_icon_text_geometry(execp,
+                                         &horiz_padding,
+                                         &vert_padding,
+                                         &interior_padding,
+                                         &icon_w,
+                                         &icon_h,
+                                         &text_next_line,
+                                         &txt_height,
+                                         &txt_width,
+                                         &new_size,
+                                         &resized);
+        if (!resized && txt_width == execp->frontend->textw && txt_height == execp->frontend->texth) {
+            schedule_redraw(&execp->area);
+            return;
+        }
+    }
+    execp->area.resize_needed = TRUE;
+    schedule_panel_redraw();
+}
+
+void execp_update_instances(Execp *execp)
+{
+    gboolean icon_changed = execp->backend->icon_changed;
+    execp->backend->icon_changed = FALSE;
+    GList *l_instance;
+    for (l_instance = execp->backend->instances; l_instance; l_instance = l_instance->next) {
+        Execp *instance = (Execp *)l_instance->data;
+        execp_update_post_read(instance, icon_changed);
+    }
+}
+
+void handle_execp_output(int fd, void *arg)
+{
+    Execp *execp = (Execp *)arg;
+    if (read_execp(execp))
+        execp_update_instances(execp);
+}
+
+void execp_push_timer_callback(void *arg)
+{
+    Execp *execp = (Execp *)arg;
+    char *update = execp->backend->push_pending;
+    if (!update)
+        return;
+    execp->backend->push_pending = NULL;
+    execp->backend->push_last_update = get_time();
+
+    char *tooltip = NULL;
+    if (strncmp(update, "--\n", 3) == 0) {
+        update[0] = '\0';
+        tooltip = update + 3;
+    } else if ((tooltip = strstr(update, "\n--\n"))) {
+        tooltip[1] = '\0';
+        tooltip += 4;
+    }
+    gboolean changed = parse_execp_output(execp, update);
+    if (tooltip) {
+        parse_execp_tooltip(execp, tooltip);
+    } else if (!execp->backend->has_user_tooltip) {
+        free_and_null(execp->backend->tooltip);
+    }
+    free(update);
+
+    execp->backend->last_update_start_time = execp->backend->last_update_finish_time = time(NULL);
+    execp->backend->last_update_duration = 0;
+    if (execp_needs_update(execp, changed))
+        execp_update_instances(execp);
+}
+
+// Keeps the last complete update in the buffer of the client, dropping the older ones.
+void execp_receive_updates(ExecpClient *client)
+{
+    ExecpBackend *backend = client->execp->backend;
+    char *update = NULL;
+    char *update_end = NULL;
+    char *next = client->buf;
+    for (char *line = client->buf, *eol; (eol = strchr(line, '\n')); line = eol + 1) {
+        if (eol == line) {
+            // An empty line terminates the update
+            update = next;
+            update_end = line;
+            next = eol + 1;
+        }
+    }
+    if (update) {
+        gboolean timer_pending = backend->push_pending != NULL;
+        free(backend->push_pending);
+        backend->push_pending = g_strndup(update, (gsize)(update_end - update));
+        if (!timer_pending) {
+            double elapsed_ms = (get_time() - backend->push_last_update) * 1000;
+            int delay_ms = elapsed_ms >= EXECP_PUSH_INTERVAL_MS ? 0 : (int)(EXECP_PUSH_INTERVAL_MS - elapsed_ms);
+            change_timer(&backend->push_timer, true, delay_ms, 0, execp_push_timer_callback, client->execp);
+        }
+    }
+    client->buf_length -= next - client->buf;
+    memmove(client->buf, next, (size_t)client->buf_length + 1);
+}
+
+void free_execp_client(void *obj)
+{
+    ExecpClient *client = (ExecpClient *)obj;
+    reactor_remove_fd(client->fd);
+    close(client->fd);
+    free(client->buf);
+    free(client);
+}
+
+// Skips data up to and including the empty line that terminates the overlong update
+void execp_skip_discarded(ExecpClient *client)
+{
+    char *end = strstr(client->buf, "\n\n");
+    if (end) {
+        client->discarding = FALSE;
+        end += 2;
     } else {
-        if (!execp->area.on_screen)
-            show(&execp->area);
-        execp->area.resize_needed = TRUE;
-        schedule_panel_redraw();
+        // Keep the last character, the terminator may be split between two reads
+        end = client->buf + MAX(client->buf_length - 1, 0);
     }
+    client->buf_length -= end - client->buf;
+    memmove(client->buf, end, (size_t)client->buf_length + 1);
 }
 
-void handle_execp_events()
+void handle_execp_client_input(int fd, void *arg)
 {
-    for (GList *l = panel_config.execp_list; l; l = l->next) {
-        Execp *execp = (Execp *)l->data;
-        if (read_execp(execp)) {
-            GList *l_instance;
-            for (l_instance = execp->backend->instances; l_instance; l_instance = l_instance->next) {
-                Execp *instance = (Execp *)l_instance->data;
-                execp_update_post_read(instance);
+    ExecpClient *client = (ExecpClient *)arg;
+    gboolean drop = FALSE;
+    // The reactor polls level-triggered, so data left over after the limit is read on the next iteration
+    for (ssize_t total = 0; total < EXECP_PUSH_MAX_READ_LEN;) {
+        if (client->buf_capacity - client->buf_length < 1024) {
+            client->buf_capacity *= 2;
+            client->buf = (char *)realloc(client->buf, client->buf_capacity);
+        }
+        ssize_t count = read(fd,
+                             client->buf + client->buf_length,
+                             MIN(client->buf_capacity - client->buf_length - 1, EXECP_PUSH_MAX_READ_LEN - total));
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (count <= 0) {
+            // End of file or error
+            drop = TRUE;
+            break;
+        }
+        total += count;
+        client->buf_length += count;
+        client->buf[client->buf_length] = '\0';
+        if (client->discarding)
+            execp_skip_discarded(client);
+        if (!client->discarding)
+            execp_receive_updates(client);
+        if (client->buf_length > EXECP_PUSH_MAX_UPDATE_LEN) {
+            fprintf(stderr, "tint2: Execp: update on %s too long, %s\n", client->execp->backend->socket_path,
+                    client->is_fifo ? "discarding" : "closing connection");
+            if (!client->is_fifo) {
+                drop = TRUE;
+                break;
             }
+            client->discarding = TRUE;
+            execp_skip_discarded(client);
         }
     }
+    if (drop) {
+        ExecpBackend *backend = client->execp->backend;
+        backend->push_clients = g_list_remove(backend->push_clients, client);
+        free_execp_client(client);
+    }
+}
+
+void execp_add_client(Execp *execp, int fd)
+{
+    fcntl(fd, F_SETFL, O_NONBLOCK | fcntl(fd, F_GETFL));
+    ExecpClient *client = (ExecpClient *)calloc(1, sizeof(ExecpClient));
+    client->execp = execp;
+    client->fd = fd;
+    struct stat st;
+    client->is_fifo = fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+    client->buf_capacity = 1024;
+    client->buf = calloc(client->buf_capacity, 1);
+    execp->backend->push_clients = g_list_append(execp->backend->push_clients, client);
+    reactor_add_fd(fd, handle_execp_client_input, client);
+}
+
+void handle_execp_connection(int fd, void *arg)
+{
+    Execp *execp = (Execp *)arg;
+    while (1) {
+        int client_fd = accept(fd, NULL, NULL);
+        if (client_fd >= 0)
+            execp_add_client(execp, client_fd);
+        else if (errno != EINTR)
+            break;
+    }
+}
+
+void execp_listen(Execp *execp)
+{
+    const char *path = execp->backend->socket_path;
+    struct stat st;
+    gboolean exists = stat(path, &st) == 0;
+
+    if (exists && S_ISFIFO(st.st_mode)) {
+        // Opened for writing as well, so that the FIFO does not report end of file whenever no producer has it open
+        int fd = open(path, O_RDWR | O_NONBLOCK);
+        if (fd < 0) {
+            fprintf(stderr, "tint2: Execp: could not open %s: %s\n", path, strerror(errno));
+            return;
+        }
+        execp_add_client(execp, fd);
+        return;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "tint2: Execp: socket path too long: %s\n", path);
+        return;
+    }
+    memcpy(addr.sun_path, path, strlen(path));
+    // Remove the socket of a previous instance
+    if (exists && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        fprintf(stderr, "tint2: Execp: could not create socket: %s\n", strerror(errno));
+        return;
+    }
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+        fprintf(stderr, "tint2: Execp: could not listen on %s: %s\n", path, strerror(errno));
+        close(fd);
+        return;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK | fcntl(fd, F_GETFL));
+    execp->backend->push_listen_fd = fd;
+    reactor_add_fd(fd, handle_execp_connection, execp);
 }
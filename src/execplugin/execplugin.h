@@ -23,6 +23,8 @@ typedef struct ExecpBackend {
     char name[21];
     // Command to execute at a specified interval
     char *command;
+    // Path of a UNIX socket or FIFO on which external programs push updates
+    char *socket_path;
     // Interval in seconds
     int interval;
     int monitor;
@@ -68,6 +70,12 @@ typedef struct ExecpBackend {
     // Icon path extracted from the output buffer
     char *icon_path;
     Imlib_Image icon;
+    // The file the icon was loaded from, with its modification time and size, or NULL
+    char *icon_loaded_path;
+    time_t icon_loaded_mtime;
+    off_t icon_loaded_size;
+    // Set by execp_needs_update if the icon was reloaded, until the instances are updated
+    gboolean icon_changed;
     gchar tooltip_text[512];
 
     // The time the last command was started
@@ -77,6 +85,17 @@ typedef struct ExecpBackend {
     // The time it took to execute last command
     time_t last_update_duration;
 
+    // Push mode state:
+    // The listening socket, or -1
+    int push_listen_fd;
+    // Connected producers (ExecpClient*); the FIFO counts as one
+    GList *push_clients;
+    // The last update received and not displayed yet, or NULL. Newer updates replace it.
+    char *push_pending;
+    Timer push_timer;
+    // The time the last update was displayed, see get_time()
+    double push_last_update;
+
     // List of Execp which are frontends for this backend, one for each panel
     GList *instances;
     GTree *cmd_pids;
@@ -145,15 +164,25 @@ void execp_cmd_completed(Execp *obj, pid_t pid);
 
 // Called to check if new output from the command can be read.
 // No command might be running.
-// Returns 1 if the output has been updated and a redraw is needed.
+// Returns 1 if the output has changed and a redraw is needed. Output identical to the previous one is ignored.
 gboolean read_execp(void *obj);
 
 // Called for Execp front elements when the command output has changed.
-void execp_update_post_read(Execp *execp);
+// The element is only resized if icon_changed is set or if the size of the text has changed.
+void execp_update_post_read(Execp *execp, gboolean icon_changed);
 
 void execp_default_font_changed();
 
-void handle_execp_events();
+// Reads the output of the running command. Registered with the reactor for the pipes of the command.
+void handle_execp_output(int fd, void *arg);
+
+// Push mode: instead of (or in addition to) running a command, the executor listens on socket_path.
+// If the path is an existing FIFO, it is read; otherwise a UNIX stream socket is created there, to which any number
+// of producers can connect.
+// The producers write updates terminated by an empty line. The lines of an update are parsed as the output of the
+// command; a line containing only "--" separates them from the tooltip, which is parsed as the standard error.
+// Only the last update received is kept, and updates are displayed at most once per EXECP_PUSH_INTERVAL_MS.
+void execp_listen(Execp *execp);
 
 void execp_force_update(Execp *execp);
 
@@ -16,13 +16,16 @@
 #include "drag_and_drop.h"
 #include "fps_distribution.h"
 #include "panel.h"
+#include "reactor.h"
 #include "server.h"
 #include "signals.h"
+#include "shm_image.h"
 #include "test.h"
 #include "tooltip.h"
 #include "tracing.h"
 #include "uevent.h"
 #include "version.h"
+#include "window_registry.h"
 
 void print_usage()
 {
@@ -56,6 +59,9 @@ void handle_cli_arguments(int argc, char **argv)
         } else if (strcmp(argv[i], "--test-verbose") == 0) {
             run_all_tests(true);
             exit(0);
+        } else if (strcmp(argv[i], "--benchmark") == 0) {
+            run_all_benchmarks(true);
+            exit(0);
         } else if (strcmp(argv[i], "--dump-image-data") == 0) {
             dump_image_data(argv[i+1], argv[i+2]);
             exit(0);
@@ -105,10 +111,12 @@ void handle_env_vars()
     debug_frames = getenv("DEBUG_FRAMES") != NULL;
     debug_dnd = getenv("DEBUG_DND") != NULL;
     debug_thumbnails = getenv("DEBUG_THUMBNAILS") != NULL;
+    debug_icon_cache = getenv("DEBUG_ICON_CACHE") != NULL;
     debug_timers = getenv("DEBUG_TIMERS") != NULL;
     debug_executors = getenv("DEBUG_EXECUTORS") != NULL;
     debug_blink = getenv("DEBUG_BLINK") != NULL;
     thumb_use_shm = getenv("TINT2_THUMBNAIL_SHM") != NULL;
+    client_side_rendering = getenv("TINT2_CLIENT_SIDE_RENDERING") != NULL;
     if (debug_fps) {
         init_fps_distribution();
         char *s = getenv("TRACING_FPS_THRESHOLD");
@@ -169,6 +177,7 @@ void create_default_elements()
     default_tooltip();
     default_execp();
     default_button();
+    default_metrics();
     default_panel();
 }
 
@@ -218,6 +227,8 @@ void init_X11_pre_config()
     server.root_win = RootWindow(server.display, server.screen);
     server.desktop = get_current_desktop();
     server.has_shm = XShmQueryExtension(server.display);
+    if (server.has_shm)
+        server.shm_completion_event_type = XShmGetEventBase(server.display) + ShmCompletion;
 
     // Needed since the config file uses '.' as decimal separator
     setlocale(LC_ALL, "");
@@ -244,6 +255,7 @@ void init(int argc, char **argv)
     handle_cli_arguments(argc, argv);
     create_default_elements();
     init_signals();
+    init_reactor();
 
     init_X11_pre_config();
     if (!config_read()) {
@@ -268,6 +280,7 @@ void cleanup()
     }
 #endif // HAVE_SN
 
+    cleanup_metrics();
     cleanup_button();
     cleanup_execp();
     cleanup_systray();
@@ -280,6 +293,7 @@ void cleanup()
     cleanup_separator();
     cleanup_taskbar();
     cleanup_panel();
+    cleanup_window_registry();
     cleanup_config();
 
     if (default_icon) {
@@ -292,8 +306,12 @@ void cleanup()
     xsettings_client_destroy(xsettings_client);
     xsettings_client = NULL;
 
+    cleanup_text_size_cache();
+    cleanup_image_cache();
+    cleanup_shm_image();
     cleanup_server();
     cleanup_timers();
+    cleanup_reactor();
 
     if (server.display)
         XCloseDisplay(server.display);
@@ -25,9 +25,12 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <sys/stat.h>
+
 #include "apps-common.h"
 #include "common.h"
 #include "cache.h"
+#include "timer.h"
 
 gboolean debug_icons = FALSE;
 
@@ -43,6 +46,38 @@ typedef struct IconThemeDir {
     int threshold;
 } IconThemeDir;
 
+// An icon file found while indexing: base/theme/dir/name+extension (or base/name+extension for unthemed icons).
+// The positions give the search order of the file system probing done by the spec:
+// directory (in index.theme order), then base directory, then extension.
+typedef struct IconIndexEntry {
+    IconThemeDir *dir; // NULL for unthemed icons
+    const char *base;
+    const char *extension;
+    int dir_pos;
+    int base_pos;
+    int extension_pos;
+} IconIndexEntry;
+
+// A directory scanned when building an index, with its modification time when scanned.
+typedef struct IconIndexStamp {
+    char *path;
+    time_t mtime;
+} IconIndexStamp;
+
+struct IconIndex {
+    // Maps icon names to GSList of IconIndexEntry*
+    GHashTable *entries;
+    // List of IconIndexStamp*; the index is rebuilt if any of them changes
+    GSList *stamps;
+    double last_validated;
+};
+
+// Minimum interval between two checks of the directory modification times, in seconds
+#define ICON_INDEX_VALIDATION_INTERVAL 1.0
+
+// Incremented every time an index is (re)built, to invalidate the negative caches
+static guint icon_index_generation = 0;
+
 int parse_theme_line(char *line, char **key, char **value)
 {
     return parse_dektop_line(line, key, value);
@@ -316,6 +351,8 @@ void free_icon_theme(IconTheme *theme)
     }
     g_slist_free(theme->list_directories);
     theme->list_directories = NULL;
+    free_icon_index(theme->_index);
+    theme->_index = NULL;
 }
 
 void free_themes(IconThemeWrapper *wrapper)
@@ -336,6 +373,8 @@ void free_themes(IconThemeWrapper *wrapper)
     }
     g_slist_free(wrapper->themes_fallback);
     g_slist_free_full(wrapper->_queued, free);
+    if (wrapper->_missing)
+        g_hash_table_destroy(wrapper->_missing);
     free_cache(&wrapper->_cache);
     free(wrapper);
 }
@@ -468,7 +507,7 @@ void load_fallbacks(IconThemeWrapper *wrapper)
 
 gchar *get_icon_cache_path()
 {
-    return g_build_filename(g_get_user_cache_dir(), "tint2", "icon.cache", NULL);
+    return g_build_filename(g_get_user_cache_dir(), "tint2", "icon-cache.bin", NULL);
 }
 
 void load_icon_cache(IconThemeWrapper *wrapper)
@@ -542,14 +581,6 @@ int directory_size_distance(IconThemeDir *dir, int size)
     }
 }
 
-gint compare_theme_directories(gconstpointer a, gconstpointer b, gpointer size_query)
-{
-    int size = GPOINTER_TO_INT(size_query);
-    const IconThemeDir *da = (const IconThemeDir *)a;
-    const IconThemeDir *db = (const IconThemeDir *)b;
-    return abs(da->size - size) - abs(db->size - size);
-}
-
 Bool is_full_path(const char *s)
 {
     if (!s)
@@ -573,6 +604,214 @@ char *icon_path_from_full_path(const char *s)
     return NULL;
 }
 
+static void free_icon_index_entries(gpointer data)
+{
+    g_slist_free_full((GSList *)data, free);
+}
+
+static IconIndex *create_icon_index()
+{
+    IconIndex *index = calloc(1, sizeof(IconIndex));
+    index->entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free_icon_index_entries);
+    index->last_validated = get_time();
+    icon_index_generation++;
+    return index;
+}
+
+void free_icon_index(IconIndex *index)
+{
+    if (!index)
+        return;
+    g_hash_table_destroy(index->entries);
+    for (GSList *l = index->stamps; l; l = l->next) {
+        IconIndexStamp *stamp = (IconIndexStamp *)l->data;
+        free(stamp->path);
+        free(stamp);
+    }
+    g_slist_free(index->stamps);
+    free(index);
+}
+
+static void add_icon_index_stamp(IconIndex *index, const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return;
+    IconIndexStamp *stamp = calloc(1, sizeof(IconIndexStamp));
+    stamp->path = strdup(path);
+    stamp->mtime = st.st_mtime;
+    index->stamps = g_slist_prepend(index->stamps, stamp);
+}
+
+static void add_icon_index_entry(IconIndex *index, const char *name, size_t name_len, IconIndexEntry *model)
+{
+    IconIndexEntry *entry = calloc(1, sizeof(IconIndexEntry));
+    *entry = *model;
+    gchar *key = g_strndup(name, name_len);
+    GSList *entries = g_hash_table_lookup(index->entries, key);
+    if (entries) {
+        // Appending keeps the list head, which the table owns
+        g_slist_append(entries, entry);
+        g_free(key);
+    } else {
+        g_hash_table_insert(index->entries, key, g_slist_append(NULL, entry));
+    }
+}
+
+// Adds the files of a directory to the index, under every icon name they can be found with.
+// If the directory does not exist, its parent is watched instead, in case it gets created.
+static void index_icon_directory(IconIndex *index, const char *path, IconIndexEntry *model)
+{
+    GDir *d = g_dir_open(path, 0, NULL);
+    if (!d) {
+        gchar *parent = g_path_get_dirname(path);
+        add_icon_index_stamp(index, parent);
+        g_free(parent);
+        return;
+    }
+    add_icon_index_stamp(index, path);
+
+    const gchar *file_name;
+    while ((file_name = g_dir_read_name(d))) {
+        size_t len = strlen(file_name);
+        model->extension_pos = 0;
+        for (const GSList *ext = get_icon_extensions(); ext; ext = g_slist_next(ext), model->extension_pos++) {
+            const char *extension = (const char *)ext->data;
+            size_t ext_len = strlen(extension);
+            if (ext_len >= len || (ext_len > 0 && strcmp(file_name + len - ext_len, extension) != 0))
+                continue;
+            model->extension = extension;
+            add_icon_index_entry(index, file_name, len - ext_len, model);
+        }
+    }
+    g_dir_close(d);
+}
+
+static IconIndex *build_theme_index(IconTheme *theme)
+{
+    IconIndex *index = create_icon_index();
+    IconIndexEntry model;
+    model.base_pos = 0;
+    for (const GSList *base = get_icon_locations(); base; base = g_slist_next(base), model.base_pos++) {
+        model.base = (const char *)base->data;
+        gchar *theme_path = g_build_filename(model.base, theme->name, NULL);
+        if (!g_file_test(theme_path, G_FILE_TEST_IS_DIR)) {
+            // Watch for the theme being installed here
+            add_icon_index_stamp(index, model.base);
+            g_free(theme_path);
+            continue;
+        }
+        add_icon_index_stamp(index, theme_path);
+        model.dir_pos = 0;
+        for (GSList *dir = theme->list_directories; dir; dir = g_slist_next(dir), model.dir_pos++) {
+            model.dir = (IconThemeDir *)dir->data;
+            gchar *path = g_build_filename(theme_path, model.dir->name, NULL);
+            index_icon_directory(index, path, &model);
+            g_free(path);
+        }
+        g_free(theme_path);
+    }
+    if (debug_icons)
+        fprintf(stderr, "tint2: Indexed theme %s: %u icon names\n", theme->name, g_hash_table_size(index->entries));
+    return index;
+}
+
+static IconIndex *build_unthemed_index()
+{
+    IconIndex *index = create_icon_index();
+    IconIndexEntry model;
+    model.dir = NULL;
+    model.dir_pos = 0;
+    model.base_pos = 0;
+    for (const GSList *base = get_icon_locations(); base; base = g_slist_next(base), model.base_pos++) {
+        model.base = (const char *)base->data;
+        index_icon_directory(index, model.base, &model);
+    }
+    return index;
+}
+
+// Returns FALSE if one of the indexed directories has changed since the index was built.
+static gboolean icon_index_valid(IconIndex *index)
+{
+    double now = get_time();
+    if (now - index->last_validated < ICON_INDEX_VALIDATION_INTERVAL)
+        return TRUE;
+    index->last_validated = now;
+    for (GSList *l = index->stamps; l; l = l->next) {
+        IconIndexStamp *stamp = (IconIndexStamp *)l->data;
+        struct stat st;
+        if (stat(stamp->path, &st) != 0 || st.st_mtime != stamp->mtime) {
+            if (debug_icons)
+                fprintf(stderr, "tint2: Icon directory changed: %s\n", stamp->path);
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static IconIndex *get_theme_index(IconTheme *theme)
+{
+    if (theme->_index && !icon_index_valid(theme->_index)) {
+        free_icon_index(theme->_index);
+        theme->_index = NULL;
+    }
+    if (!theme->_index)
+        theme->_index = build_theme_index(theme);
+    return theme->_index;
+}
+
+static IconIndex *unthemed_index = NULL;
+
+static IconIndex *get_unthemed_index()
+{
+    if (unthemed_index && !icon_index_valid(unthemed_index)) {
+        free_icon_index(unthemed_index);
+        unthemed_index = NULL;
+    }
+    if (!unthemed_index)
+        unthemed_index = build_unthemed_index();
+    return unthemed_index;
+}
+
+// Orders the entries as the file system probing would find them: closest directory size first
+static gint compare_icon_index_entries(gconstpointer a, gconstpointer b, gpointer size_query)
+{
+    int size = GPOINTER_TO_INT(size_query);
+    const IconIndexEntry *ea = (const IconIndexEntry *)a;
+    const IconIndexEntry *eb = (const IconIndexEntry *)b;
+    if (ea->dir && eb->dir && abs(ea->dir->size - size) != abs(eb->dir->size - size))
+        return abs(ea->dir->size - size) - abs(eb->dir->size - size);
+    if (ea->dir_pos != eb->dir_pos)
+        return ea->dir_pos - eb->dir_pos;
+    if (ea->base_pos != eb->base_pos)
+        return ea->base_pos - eb->base_pos;
+    return ea->extension_pos - eb->extension_pos;
+}
+
+// Returns the entries for an icon name, in search order. Free the result with g_slist_free.
+static GSList *lookup_icon_index(IconIndex *index, const char *icon_name, int size)
+{
+    GSList *entries = g_hash_table_lookup(index->entries, icon_name);
+    return g_slist_sort_with_data(g_slist_copy(entries), compare_icon_index_entries, GINT_TO_POINTER(size));
+}
+
+// Returns the path of the file of an index entry. Note: needs to be released with free().
+static char *icon_index_entry_path(const IconIndexEntry *entry, const char *theme_name, const char *icon_name)
+{
+    size_t size = strlen(entry->base) + strlen(icon_name) + strlen(entry->extension) + 100;
+    if (entry->dir)
+        size += strlen(theme_name) + strlen(entry->dir->name);
+    char *path = calloc(size, 1);
+    if (entry->dir) {
+        // filename = directory/$(themename)/subdirectory/iconname.extension
+        snprintf(path, size, "%s/%s/%s/%s%s", entry->base, theme_name, entry->dir->name, icon_name, entry->extension);
+    } else {
+        // filename = directory/iconname.extension
+        snprintf(path, size, "%s/%s%s", entry->base, icon_name, entry->extension);
+    }
+    return path;
+}
+
 char *get_icon_path_helper(GSList *themes, const char *icon_name, int size)
 {
     if (!icon_name)
@@ -582,9 +821,6 @@ char *get_icon_path_helper(GSList *themes, const char *icon_name, int size)
     if (result)
         return result;
 
-    const GSList *basenames = get_icon_locations();
-    const GSList *extensions = get_icon_extensions();
-
     GSList *theme;
 
     // Best size match
@@ -594,128 +830,64 @@ char *get_icon_path_helper(GSList *themes, const char *icon_name, int size)
 
     // These 3 variables are used for keeping the closest size match
     int minimal_size = INT_MAX;
-    char *best_file_name = NULL;
+    IconIndexEntry *best_entry = NULL;
     GSList *best_file_theme = NULL;
 
     // These 3 variables are used for keeping the next larger match
     int next_larger_size = -1;
-    char *next_larger = NULL;
+    IconIndexEntry *next_larger = NULL;
     GSList *next_larger_theme = NULL;
 
-    size_t file_name_size = 4096;
-    char *file_name = calloc(file_name_size, 1);
-
     for (theme = themes; theme; theme = g_slist_next(theme)) {
         if (debug_icons)
             fprintf(stderr, "tint2: Searching theme: %s\n", ((IconTheme *)theme->data)->name);
-        ((IconTheme *)theme->data)->list_directories =
-            g_slist_sort_with_data(((IconTheme *)theme->data)->list_directories,
-                                   compare_theme_directories,
-                                   GINT_TO_POINTER(size));
-        GSList *dir;
-        for (dir = ((IconTheme *)theme->data)->list_directories; dir; dir = g_slist_next(dir)) {
+        GSList *entries = lookup_icon_index(get_theme_index((IconTheme *)theme->data), icon_name, size);
+        for (GSList *l = entries; l; l = g_slist_next(l)) {
+            IconIndexEntry *entry = (IconIndexEntry *)l->data;
+            if (debug_icons)
+                fprintf(stderr,
+                        "tint2: Found potential match: %s/%s/%s/%s%s\n",
+                        entry->base,
+                        ((IconTheme *)theme->data)->name,
+                        entry->dir->name,
+                        icon_name,
+                        entry->extension);
             // Closest match
-            gboolean possible = directory_size_distance((IconThemeDir *)dir->data, size) < minimal_size &&
-                                (!best_file_theme ? TRUE : theme == best_file_theme);
+            if (directory_size_distance(entry->dir, size) < minimal_size &&
+                (!best_file_theme ? 1 : theme == best_file_theme)) {
+                best_entry = entry;
+                minimal_size = directory_size_distance(entry->dir, size);
+                best_file_theme = theme;
+            }
             // Next larger match
-            possible = possible || (((IconThemeDir *)dir->data)->size >= size &&
-                                    (next_larger_size == -1 || ((IconThemeDir *)dir->data)->size < next_larger_size) &&
-                                    (!next_larger_theme ? 1 : theme == next_larger_theme));
-            if (!possible)
-                continue;
-            if (debug_icons)
-                fprintf(stderr, "tint2: Searching directory: %s\n", ((IconThemeDir *)dir->data)->name);
-            const GSList *base;
-            for (base = basenames; base; base = g_slist_next(base)) {
-                for (const GSList *ext = extensions; ext; ext = g_slist_next(ext)) {
-                    char *base_name = (char *)base->data;
-                    char *theme_name = ((IconTheme *)theme->data)->name;
-                    char *dir_name = ((IconThemeDir *)dir->data)->name;
-                    char *extension = (char *)ext->data;
-                    if (strlen(base_name) + strlen(theme_name) + strlen(dir_name) + strlen(icon_name) +
-                            strlen(extension) + 100 >
-                        file_name_size) {
-                        file_name_size = strlen(base_name) + strlen(theme_name) + strlen(dir_name) + strlen(icon_name) +
-                                         strlen(extension) + 100;
-                        file_name = realloc(file_name, file_name_size);
-                    }
-                    file_name[0] = 0;
-                    // filename = directory/$(themename)/subdirectory/iconname.extension
-                    snprintf(file_name, (size_t)file_name_size, "%s/%s/%s/%s%s", base_name, theme_name, dir_name, icon_name, extension);
-                    if (debug_icons)
-                        fprintf(stderr, "tint2: Checking %s\n", file_name);
-                    if (g_file_test(file_name, G_FILE_TEST_EXISTS)) {
-                        if (debug_icons)
-                            fprintf(stderr, "tint2: Found potential match: %s\n", file_name);
-                        // Closest match
-                        if (directory_size_distance((IconThemeDir *)dir->data, size) < minimal_size &&
-                            (!best_file_theme ? 1 : theme == best_file_theme)) {
-                            if (best_file_name) {
-                                free(best_file_name);
-                                best_file_name = NULL;
-                            }
-                            best_file_name = strdup(file_name);
-                            minimal_size = directory_size_distance((IconThemeDir *)dir->data, size);
-                            best_file_theme = theme;
-                            if (debug_icons)
-                                fprintf(stderr, "tint2: best_file_name = %s; minimal_size = %d\n", best_file_name, minimal_size);
-                        }
-                        // Next larger match
-                        if (((IconThemeDir *)dir->data)->size >= size &&
-                            (next_larger_size == -1 || ((IconThemeDir *)dir->data)->size < next_larger_size) &&
-                            (!next_larger_theme ? 1 : theme == next_larger_theme)) {
-                            if (next_larger) {
-                                free(next_larger);
-                                next_larger = NULL;
-                            }
-                            next_larger = strdup(file_name);
-                            next_larger_size = ((IconThemeDir *)dir->data)->size;
-                            next_larger_theme = theme;
-                            if (debug_icons)
-                                fprintf(stderr, "tint2: next_larger = %s; next_larger_size = %d\n", next_larger, next_larger_size);
-                        }
-                    }
-                }
+            if (entry->dir->size >= size && (next_larger_size == -1 || entry->dir->size < next_larger_size) &&
+                (!next_larger_theme ? 1 : theme == next_larger_theme)) {
+                next_larger = entry;
+                next_larger_size = entry->dir->size;
+                next_larger_theme = theme;
             }
         }
+        g_slist_free(entries);
     }
-    free(file_name);
-    file_name = NULL;
     if (next_larger) {
-        free(best_file_name);
-        return next_larger;
-    }
-    if (best_file_name) {
-        return best_file_name;
+        best_entry = next_larger;
+        best_file_theme = next_larger_theme;
     }
+    if (best_entry)
+        return icon_index_entry_path(best_entry, ((IconTheme *)best_file_theme->data)->name, icon_name);
 
     // Look in unthemed icons
-    {
+    if (debug_icons)
+        fprintf(stderr, "tint2: Searching unthemed icons\n");
+    GSList *entries = lookup_icon_index(get_unthemed_index(), icon_name, size);
+    if (entries) {
+        result = icon_index_entry_path((IconIndexEntry *)entries->data, NULL, icon_name);
         if (debug_icons)
-            fprintf(stderr, "tint2: Searching unthemed icons\n");
-        for (const GSList *base = basenames; base; base = g_slist_next(base)) {
-            for (const GSList *ext = extensions; ext; ext = g_slist_next(ext)) {
-                char *base_name = (char *)base->data;
-                char *extension = (char *)ext->data;
-                size_t file_name_size2 = strlen(base_name) + strlen(icon_name) + strlen(extension) + 100;
-                file_name = calloc(file_name_size2, 1);
-                // filename = directory/iconname.extension
-                snprintf(file_name, file_name_size2, "%s/%s%s", base_name, icon_name, extension);
-                if (debug_icons)
-                    fprintf(stderr, "tint2: Checking %s\n", file_name);
-                if (g_file_test(file_name, G_FILE_TEST_EXISTS)) {
-                    if (debug_icons)
-                        fprintf(stderr, "tint2: Found %s\n", file_name);
-                    return file_name;
-                } else {
-                    free(file_name);
-                    file_name = NULL;
-                }
-            }
-        }
+            fprintf(stderr, "tint2: Found %s\n", result);
     }
+    g_slist_free(entries);
 
-    return NULL;
+    return result;
 }
 
 char *get_icon_path_from_cache(IconThemeWrapper *wrapper, const char *icon_name, int size)
@@ -738,9 +910,6 @@ char *get_icon_path_from_cache(IconThemeWrapper *wrapper, const char *icon_name,
         return NULL;
     }
 
-    if (!g_file_test(value, G_FILE_TEST_EXISTS))
-        return NULL;
-
     // fprintf(stderr, "tint2: Icon path found in cache: theme = %s, icon = %s, size = %d, path = %s\n",
     // wrapper->icon_theme_name, icon_name, size, value);
 
@@ -766,6 +935,43 @@ void add_icon_path_to_cache(IconThemeWrapper *wrapper, const char *icon_name, in
     g_free(key);
 }
 
+#define ICON_MISSING_IN_THEMES 1
+#define ICON_MISSING_IN_FALLBACKS 2
+
+// Drops the negative cache if one of the indexes it was computed from has changed
+static void validate_missing_icons(IconThemeWrapper *wrapper)
+{
+    for (GSList *l = wrapper->themes; l; l = l->next)
+        get_theme_index((IconTheme *)l->data);
+    for (GSList *l = wrapper->themes_fallback; l; l = l->next)
+        get_theme_index((IconTheme *)l->data);
+    get_unthemed_index();
+    if (!wrapper->_missing || wrapper->_missing_generation != icon_index_generation) {
+        if (wrapper->_missing)
+            g_hash_table_destroy(wrapper->_missing);
+        wrapper->_missing = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        wrapper->_missing_generation = icon_index_generation;
+    }
+}
+
+static gboolean is_icon_known_missing(IconThemeWrapper *wrapper, const char *icon_name, gboolean use_fallbacks)
+{
+    if (!wrapper->_missing)
+        return FALSE;
+    validate_missing_icons(wrapper);
+    int missing = GPOINTER_TO_INT(g_hash_table_lookup(wrapper->_missing, icon_name));
+    return missing >= (use_fallbacks ? ICON_MISSING_IN_FALLBACKS : ICON_MISSING_IN_THEMES);
+}
+
+static void set_icon_missing(IconThemeWrapper *wrapper, const char *icon_name, int missing)
+{
+    // Full paths are not indexed
+    if (strchr(icon_name, '/'))
+        return;
+    validate_missing_icons(wrapper);
+    g_hash_table_replace(wrapper->_missing, g_strdup(icon_name), GINT_TO_POINTER(missing));
+}
+
 char *get_icon_path(IconThemeWrapper *wrapper, const char *icon_name, int size, gboolean use_fallbacks)
 {
     if (debug_icons)
@@ -784,6 +990,12 @@ char *get_icon_path(IconThemeWrapper *wrapper, const char *icon_name, int size,
     if (!icon_name || strlen(icon_name) == 0)
         goto notfound;
 
+    if (is_icon_known_missing(wrapper, icon_name, use_fallbacks)) {
+        if (debug_icons)
+            fprintf(stderr, "tint2: Icon known to be missing: %s\n", icon_name);
+        goto notfound;
+    }
+
     char *path = get_icon_path_from_cache(wrapper, icon_name, size);
     if (path) {
         if (debug_icons)
@@ -803,8 +1015,10 @@ char *get_icon_path(IconThemeWrapper *wrapper, const char *icon_name, int size,
         return path;
     }
 
-    if (!use_fallbacks)
+    if (!use_fallbacks) {
+        set_icon_missing(wrapper, icon_name, ICON_MISSING_IN_THEMES);
         goto notfound;
+    }
     fprintf(stderr, YELLOW "tint2: Icon not found in default theme: %s" RESET "\n", icon_name);
     load_fallbacks(wrapper);
 
@@ -813,6 +1027,7 @@ char *get_icon_path(IconThemeWrapper *wrapper, const char *icon_name, int size,
         add_icon_path_to_cache(wrapper, icon_name, size, path);
         return path;
     }
+    set_icon_missing(wrapper, icon_name, ICON_MISSING_IN_FALLBACKS);
 
 notfound:
     fprintf(stderr, RED "tint2: Could not find icon '%s', using default." RESET "\n", icon_name);
@@ -24,13 +24,22 @@ typedef struct IconThemeWrapper {
     // List of icon theme names that have been queued for loading.
     // Used to avoid loading the same theme twice, and to avoid cycles.
     GSList *_queued;
+    // Negative cache: icon names not found in the themes (or the fallbacks too).
+    // Cleared when the icon indexes are rebuilt.
+    GHashTable *_missing;
+    guint _missing_generation;
 } IconThemeWrapper;
 
+// Maps icon names to the files found in the directories of a theme, see get_icon_path().
+typedef struct IconIndex IconIndex;
+
 typedef struct IconTheme {
     char *name;
     char *description;
     GSList *list_inherits;    // each item is a char* (theme name)
     GSList *list_directories; // each item is an IconThemeDir*
+    // Built on the first lookup, rebuilt when one of the indexed directories changes.
+    IconIndex *_index;
 } IconTheme;
 
 // Parses a line of the form "key = value". Modifies the line.
@@ -46,6 +55,7 @@ void save_icon_cache(IconThemeWrapper *wrapper);
 
 void free_themes(IconThemeWrapper *wrapper);
 void free_icon_theme(IconTheme *theme);
+void free_icon_index(IconIndex *index);
 
 #define DEFAULT_ICON "application-x-executable"
 
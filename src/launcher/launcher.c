@@ -382,7 +382,7 @@ void draw_launcher_icon(void *obj, cairo_t *c)
         image = launcherIcon->image;
     }
     imlib_context_set_image(image);
-    render_image(launcherIcon->area.pix, 0, 0);
+    draw_area_image(&launcherIcon->area, c, 0, 0);
 }
 
 void launcher_icon_dump_geometry(void *obj, int indent)
@@ -560,13 +560,13 @@ void launcher_reload_icon_image(Launcher *launcher, LauncherIcon *launcherIcon)
 
     char *new_icon_path = get_icon_path(icon_theme_wrapper, launcherIcon->icon_name, launcherIcon->icon_size, TRUE);
     if (new_icon_path)
-        launcherIcon->image = load_image(new_icon_path, TRUE);
+        launcherIcon->image = load_image_at_size(new_icon_path, launcherIcon->icon_size, TRUE);
     // On loading error, fallback to default
     if (!launcherIcon->image) {
         free(new_icon_path);
         new_icon_path = get_icon_path(icon_theme_wrapper, DEFAULT_ICON, launcherIcon->icon_size, TRUE);
         if (new_icon_path)
-            launcherIcon->image = load_image(new_icon_path, TRUE);
+            launcherIcon->image = load_image_at_size(new_icon_path, launcherIcon->icon_size, TRUE);
     }
     Imlib_Image original = launcherIcon->image;
     launcherIcon->image = scale_icon(launcherIcon->image, launcherIcon->icon_size);
@@ -49,7 +49,9 @@
 #include "launcher.h"
 #include "mouse_actions.h"
 #include "panel.h"
+#include "reactor.h"
 #include "server.h"
+#include "shm_image.h"
 #include "signals.h"
 #include "systraybar.h"
 #include "task.h"
@@ -60,6 +62,7 @@
 #include "uevent.h"
 #include "version.h"
 #include "window.h"
+#include "window_registry.h"
 #include "xsettings-client.h"
 
 // Global process state variables
@@ -76,8 +79,17 @@ static double ts_render_finished;
 static double ts_flush_finished;
 
 static gboolean first_render;
-
-void handle_event_property_notify(XEvent *e)
+// Event batching statistics, reset on every frame (DEBUG_FPS)
+static int x_events;
+static int x_batch_size_max;
+static int x_coalesced_motion;
+static int x_coalesced_expose;
+static int x_coalesced_property;
+// Text layout statistics, printed once per second (DEBUG_FPS)
+static double ts_layout_stats;
+static int layout_stats_rebuilds;
+
+void handle_event_property_notify(XEvent *e, WindowTarget target)
 {
     gboolean debug = FALSE;
 
@@ -86,13 +98,11 @@ void handle_event_property_notify(XEvent *e)
 
     if (xsettings_client)
         xsettings_client_process_event(xsettings_client, e);
-    for (int i = 0; i < num_panels; i++) {
-        Panel *p = &panels[i];
-        if (win == p->main_win) {
-            if (at == server.atom._NET_WM_DESKTOP && get_window_desktop(p->main_win) != ALL_DESKTOPS)
-                replace_panel_all_desktops(p);
-            return;
-        }
+    if (target.role == WINDOW_PANEL) {
+        Panel *p = (Panel *)target.object;
+        if (at == server.atom._NET_WM_DESKTOP && get_window_desktop(p->main_win) != ALL_DESKTOPS)
+            replace_panel_all_desktops(p);
+        return;
     }
     if (win == server.root_win) {
         if (!server.got_root_win) {
@@ -222,13 +232,12 @@ void handle_event_property_notify(XEvent *e)
             schedule_panel_redraw();
         }
     } else {
-        TrayWindow *traywin = systray_find_icon(win);
-        if (traywin) {
-            systray_property_notify(traywin, e);
+        if (target.role == WINDOW_TRAY_ICON || target.role == WINDOW_TRAY_PARENT) {
+            systray_property_notify((TrayWindow *)target.object, e);
             return;
         }
 
-        Task *task = get_task(win);
+        Task *task = target.role == WINDOW_TASK ? g_ptr_array_index((GPtrArray *)target.object, 0) : NULL;
         if (debug) {
             char *atom_name = XGetAtomName(server.display, at);
             fprintf(stderr,
@@ -324,17 +333,17 @@ void handle_event_property_notify(XEvent *e)
     }
 }
 
-void handle_event_expose(XEvent *e)
+void handle_event_expose(XEvent *e, WindowTarget target)
 {
-    Panel *panel;
-    panel = get_panel(e->xany.window);
-    if (!panel)
+    if (target.role != WINDOW_PANEL)
         return;
+    Panel *panel = (Panel *)target.object;
     // TODO : one panel_refresh per panel ?
+    damage_whole_panel(panel);
     schedule_panel_redraw();
 }
 
-void handle_event_configure_notify(XEvent *e)
+void handle_event_configure_notify(XEvent *e, WindowTarget target)
 {
     Window win = e->xconfigure.window;
 
@@ -344,32 +353,11 @@ void handle_event_configure_notify(XEvent *e)
         return;
     }
 
-    TrayWindow *traywin = systray_find_icon(win);
-    if (traywin) {
-        systray_reconfigure_event(traywin, e);
+    if (target.role == WINDOW_TRAY_ICON || target.role == WINDOW_TRAY_PARENT) {
+        systray_reconfigure_event((TrayWindow *)target.object, e);
         return;
     }
 
-    // 'win' move in another monitor
-    if (num_panels > 1 || hide_task_diff_monitor) {
-        Task *task = get_task(win);
-        if (task) {
-            Panel *p = task->area.panel;
-            int monitor = get_window_monitor(win);
-            if ((hide_task_diff_monitor && p->monitor != monitor && task->area.on_screen) ||
-                (hide_task_diff_monitor && p->monitor == monitor && !task->area.on_screen) ||
-                (p->monitor != monitor && num_panels > 1)) {
-                remove_task(task);
-                task = add_task(win);
-                if (win == get_active_window()) {
-                    set_task_state(task, TASK_ACTIVE);
-                    active_task = task;
-                }
-                schedule_panel_redraw();
-            }
-        }
-    }
-
     if (server.viewports) {
         Task *task = get_task(win);
         if (task) {
@@ -380,12 +368,13 @@ void handle_event_configure_notify(XEvent *e)
         }
     }
 
-    sort_taskbar_for_win(win);
+    // Resorts the tasks and moves them to the panel of their monitor, at most once per frame
+    taskbar_handle_configure_notify(&e->xconfigure);
 }
 
-gboolean handle_x_event_autohide(XEvent *e)
+gboolean handle_x_event_autohide(XEvent *e, WindowTarget target)
 {
-    Panel *panel = get_panel(e->xany.window);
+    Panel *panel = target.role == WINDOW_PANEL ? (Panel *)target.object : NULL;
     if (panel && panel_autohide) {
         if (e->type == EnterNotify)
             autohide_trigger_show(panel, e->xany.send_event);
@@ -408,6 +397,24 @@ gboolean handle_x_event_autohide(XEvent *e)
     return FALSE;
 }
 
+// Returns the window an event is about, which can differ from the window it was reported to
+static Window get_event_window(XEvent *e)
+{
+    switch (e->type) {
+    case ConfigureNotify:
+        return e->xconfigure.window;
+    case ConfigureRequest:
+        return e->xconfigurerequest.window;
+    case ReparentNotify:
+        return e->xreparent.window;
+    case DestroyNotify:
+        return e->xdestroywindow.window;
+    default:
+        // Also the drawable of XDamageNotifyEvent
+        return e->xany.window;
+    }
+}
+
 void handle_x_event(XEvent *e)
 {
 #if HAVE_SN
@@ -415,10 +422,11 @@ void handle_x_event(XEvent *e)
         sn_display_process_event(server.sn_display, e);
 #endif // HAVE_SN
 
-    if (handle_x_event_autohide(e))
+    WindowTarget target = lookup_window(get_event_window(e));
+    if (handle_x_event_autohide(e, target))
         return;
 
-    Panel *panel = get_panel(e->xany.window);
+    Panel *panel = target.role == WINDOW_PANEL ? (Panel *)target.object : NULL;
     switch (e->type) {
     case ButtonPress: {
         tooltip_hide(0);
@@ -460,30 +468,26 @@ void handle_x_event(XEvent *e)
     }
 
     case Expose:
-        handle_event_expose(e);
+        handle_event_expose(e, target);
         break;
 
     case PropertyNotify:
-        handle_event_property_notify(e);
+        handle_event_property_notify(e, target);
         break;
 
     case ConfigureNotify:
-        handle_event_configure_notify(e);
+        handle_event_configure_notify(e, target);
         break;
 
-    case ConfigureRequest: {
-        TrayWindow *traywin = systray_find_icon(e->xany.window);
-        if (traywin)
-            systray_reconfigure_event(traywin, e);
+    case ConfigureRequest:
+        if (target.role == WINDOW_TRAY_ICON || target.role == WINDOW_TRAY_PARENT)
+            systray_reconfigure_event((TrayWindow *)target.object, e);
         break;
-    }
 
-    case ResizeRequest: {
-        TrayWindow *traywin = systray_find_icon(e->xany.window);
-        if (traywin)
-            systray_resize_request_event(traywin, e);
+    case ResizeRequest:
+        if (target.role == WINDOW_TRAY_ICON || target.role == WINDOW_TRAY_PARENT)
+            systray_resize_request_event((TrayWindow *)target.object, e);
         break;
-    }
 
     case ReparentNotify: {
         if (!systray_enabled)
@@ -491,8 +495,8 @@ void handle_x_event(XEvent *e)
         Panel *systray_panel = (Panel *)systray.area.panel;
         if (e->xany.window == systray_panel->main_win) // don't care
             break;
-        TrayWindow *traywin = systray_find_icon(e->xreparent.window);
-        if (traywin) {
+        if (target.role == WINDOW_TRAY_ICON) {
+            TrayWindow *traywin = (TrayWindow *)target.object;
             if (traywin->win == e->xreparent.window) {
                 if (traywin->parent == e->xreparent.parent) {
                     embed_icon(traywin);
@@ -514,14 +518,8 @@ void handle_x_event(XEvent *e)
             emit_self_restart("compositor shutdown");
             break;
         }
-        if (e->xany.window == g_tooltip.window || !systray_enabled)
-            break;
-        for (GSList *it = systray.list_icons; it; it = g_slist_next(it)) {
-            if (((TrayWindow *)it->data)->win == e->xany.window) {
-                systray_destroy_event((TrayWindow *)it->data);
-                break;
-            }
-        }
+        if (target.role == WINDOW_TRAY_ICON && systray_enabled)
+            systray_destroy_event((TrayWindow *)target.object);
         break;
 
     case ClientMessage: {
@@ -566,52 +564,100 @@ void handle_x_event(XEvent *e)
 
     default:
         if (e->type == server.xdamage_event_type) {
-            XDamageNotifyEvent *de = (XDamageNotifyEvent *)e;
-            TrayWindow *traywin = systray_find_icon(de->drawable);
-            if (traywin)
-                systray_render_icon(traywin);
+            if (target.role == WINDOW_TRAY_ICON || target.role == WINDOW_TRAY_PARENT)
+                systray_render_icon((TrayWindow *)target.object);
+        } else if (server.shm_completion_event_type && e->type == server.shm_completion_event_type) {
+            shm_image_handle_completion((XShmCompletionEvent *)e);
         }
     }
 }
 
+static Bool is_same_property_notify(Display *display, XEvent *e, XPointer arg)
+{
+    XEvent *ref = (XEvent *)arg;
+    return e->type == PropertyNotify && e->xproperty.window == ref->xproperty.window &&
+           e->xproperty.atom == ref->xproperty.atom;
+}
+
+// Removes from the queue the events made redundant by e. Returns the number of events dropped.
+int coalesce_x_event(XEvent *e)
+{
+    int count = 0;
+    XEvent next;
+    switch (e->type) {
+    case MotionNotify:
+        // Keep only the last of a run of consecutive motion events
+        while (XEventsQueued(server.display, QueuedAlready) > 0) {
+            XPeekEvent(server.display, &next);
+            if (next.type != MotionNotify || next.xmotion.window != e->xmotion.window ||
+                next.xmotion.state != e->xmotion.state)
+                break;
+            XNextEvent(server.display, e);
+            count++;
+        }
+        x_coalesced_motion += count;
+        break;
+    case Expose:
+        // A single expose triggers a redraw of the whole panel
+        while (XCheckTypedWindowEvent(server.display, e->xexpose.window, Expose, &next))
+            count++;
+        x_coalesced_expose += count;
+        break;
+    case PropertyNotify:
+        // The handlers read the current value of the property, so one notification is enough
+        while (XCheckIfEvent(server.display, &next, is_same_property_notify, (XPointer)e))
+            count++;
+        x_coalesced_property += count;
+        break;
+    }
+    return count;
+}
+
+// Upper bound on the events handled in one batch, so that a flood of events does not starve timers and other inputs
+#define MAX_X_EVENTS_PER_BATCH 256
+
 void handle_x_events()
 {
-    if (XPending(server.display) > 0) {
+    // Drain the queue before returning to the main loop, so that a burst of events
+    // results in a single panel refresh. The main loop comes back here if events are left.
+    int x_batch_size = 0;
+    while (x_batch_size < MAX_X_EVENTS_PER_BATCH && XPending(server.display) > 0) {
         XEvent e;
         XNextEvent(server.display, &e);
-        if (debug_fps)
+        if (debug_fps && ts_event_read == 0)
             ts_event_read = get_time();
 
+        coalesce_x_event(&e);
         handle_x_event(&e);
+        x_batch_size++;
     }
+    x_events += x_batch_size;
+    if (x_batch_size > x_batch_size_max)
+        x_batch_size_max = x_batch_size;
 }
 
-void prepare_fd_set(fd_set *set, int *max_fd)
+static void handle_x11_input(int fd, void *arg)
 {
-    FD_ZERO(set);
-    FD_SET(server.x11_fd, set);
-    *max_fd = server.x11_fd;
-    if (sigchild_pipe_valid) {
-        FD_SET(sigchild_pipe[0], set);
-        *max_fd = MAX(*max_fd, sigchild_pipe[0]);
-    }
-    for (GList *l = panel_config.execp_list; l; l = l->next) {
-        Execp *execp = (Execp *)l->data;
-        int fd = execp->backend->child_pipe_stdout;
-        if (fd > 0) {
-            FD_SET(fd, set);
-            *max_fd = MAX(*max_fd, fd);
-        }
-        fd = execp->backend->child_pipe_stderr;
-        if (fd > 0) {
-            FD_SET(fd, set);
-            *max_fd = MAX(*max_fd, fd);
-        }
-    }
-    if (uevent_fd > 0) {
-        FD_SET(uevent_fd, set);
-        *max_fd = MAX(*max_fd, uevent_fd);
-    }
+    handle_x_events();
+}
+
+static void handle_sigchld_input(int fd, void *arg)
+{
+    handle_sigchld_events();
+}
+
+static void handle_uevent_input(int fd, void *arg)
+{
+    uevent_handler();
+}
+
+void run_tint2_event_loop();
+
+static void handle_wakeup()
+{
+#ifdef HAVE_TRACING
+    start_tracing((void *)run_tint2_event_loop);
+#endif
 }
 
 void handle_panel_refresh()
@@ -626,13 +672,7 @@ void handle_panel_refresh()
             shrink_panel(panel);
 
         if (!panel->is_hidden || panel->area.resize_needed) {
-            if (panel->temp_pmap)
-                XFreePixmap(server.display, panel->temp_pmap);
-            panel->temp_pmap = XCreatePixmap(server.display,
-                                             server.root_win,
-                                             panel->area.width,
-                                             panel->area.height,
-                                             server.depth);
+            update_panel_back_buffer(panel);
             render_panel(panel);
         }
 
@@ -670,17 +710,10 @@ void handle_panel_refresh()
                       0,
                       0);
             XSetWindowBackgroundPixmap(server.display, panel->main_win, panel->hidden_pixmap);
+            // The window has to be repainted entirely once unhidden
+            damage_whole_panel(panel);
         } else {
-            XCopyArea(server.display,
-                      panel->temp_pmap,
-                      panel->main_win,
-                      server.gc,
-                      0,
-                      0,
-                      panel->area.width,
-                      panel->area.height,
-                      0,
-                      0);
+            present_panel(panel);
             if (panel == (Panel *)systray.area.panel) {
                 if (refresh_systray && panel && !panel->is_hidden) {
                     refresh_systray = FALSE;
@@ -692,6 +725,8 @@ void handle_panel_refresh()
     }
     if (first_render) {
         first_render = FALSE;
+        // The icons carried over a restart that are still unused are no longer needed
+        task_icon_cache_keep_unused(FALSE);
         if (panel_shrink)
             schedule_panel_redraw();
     }
@@ -723,6 +758,23 @@ void handle_panel_refresh()
                 proc_ratio * 100,
                 render_ratio * 100,
                 flush_ratio * 100);
+        fprintf(stderr,
+                BLUE "frame %d: events %d (max batch %d), coalesced %d motion, %d expose, %d property" RESET "\n",
+                frame,
+                x_events,
+                x_batch_size_max,
+                x_coalesced_motion,
+                x_coalesced_expose,
+                x_coalesced_property);
+        if (ts_flush_finished - ts_layout_stats >= 1.0) {
+            if (ts_layout_stats > 0)
+                fprintf(stderr,
+                        BLUE "frame %d: text layout rebuilds: %.1f/s" RESET "\n",
+                        frame,
+                        (text_layout_rebuilds - layout_stats_rebuilds) / (ts_flush_finished - ts_layout_stats));
+            ts_layout_stats = ts_flush_finished;
+            layout_stats_rebuilds = text_layout_rebuilds;
+        }
 #ifdef HAVE_TRACING
         stop_tracing();
         if (fps <= tracing_fps_threshold) {
@@ -737,6 +789,8 @@ void handle_panel_refresh()
             save_panel_screenshot(&panels[i], path);
         }
     }
+    x_events = x_batch_size_max = 0;
+    x_coalesced_motion = x_coalesced_expose = x_coalesced_property = 0;
     frame++;
 }
 
@@ -748,25 +802,25 @@ void run_tint2_event_loop()
     ts_flush_finished = 0;
     first_render = TRUE;
 
+    reactor_set_wakeup_hook(handle_wakeup);
+    reactor_add_fd(server.x11_fd, handle_x11_input, NULL);
+    if (sigchild_pipe_valid)
+        reactor_add_fd(sigchild_pipe[0], handle_sigchld_input, NULL);
+    if (uevent_fd >= 0)
+        reactor_add_fd(uevent_fd, handle_uevent_input, NULL);
+
     while (!get_signal_pending()) {
         if (panel_refresh)
             handle_panel_refresh();
 
-        fd_set fds;
-        int max_fd;
-        prepare_fd_set(&fds, &max_fd);
-
-        // Wait for an event and handle it
+        // Wait for an event and handle it.
+        // Xlib may have queued events already, while reading replies, without leaving input on the connection.
         ts_event_read = 0;
-        if (XPending(server.display) > 0 || select(max_fd + 1, &fds, 0, 0, get_duration_to_next_timer_expiration()) >= 0) {
-#ifdef HAVE_TRACING
-            start_tracing((void*)run_tint2_event_loop);
-#endif
-            uevent_handler();
-            handle_sigchld_events();
-            handle_execp_events();
+        gboolean x_pending = XPending(server.display) > 0;
+        struct timeval no_wait = {0, 0};
+        reactor_wait(x_pending ? &no_wait : get_duration_to_next_timer_expiration());
+        if (x_pending)
             handle_x_events();
-        }
 
         handle_expired_timers();
     }
@@ -787,6 +841,9 @@ void tint2(int argc, char **argv, gboolean *restart)
     run_tint2_event_loop();
 
     if (get_signal_pending()) {
+        // Keep all the window icons for the restarted instance, not just the 32 most recent ones
+        if (get_signal_pending() == SIGUSR1)
+            task_icon_cache_keep_unused(TRUE);
         cleanup();
         if (get_signal_pending() == SIGUSR1) {
             fprintf(stderr, YELLOW "tint2: %s %d: restarting tint2..." RESET "\n", __FILE__, __LINE__);
@@ -825,5 +882,7 @@ int main(int argc, char **argv)
         restart = FALSE;
         tint2(argc, argv, &restart);
     } while(restart);
+    // Kept across restarts (see task_icon_cache_keep_unused), so that the window icons do not have to be processed again
+    cleanup_task_icon_cache();
     return 0;
 }
@@ -0,0 +1,747 @@
+#include "metrics.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <cairo.h>
+#include <pango/pangocairo.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include "panel.h"
+#include "timer.h"
+#include "common.h"
+#include "test.h"
+
+#define METRICS_READ_SIZE 16384
+
+// The contents of the last file read. The first line of /proc/stat is all we need, so it is read partially.
+static char metrics_read_buf[METRICS_READ_SIZE];
+
+char *metrics_get_tooltip(void *obj);
+void metrics_init_fonts();
+int metrics_compute_desired_size(void *obj);
+void metrics_dump_geometry(void *obj, int indent);
+void metrics_timer_callback(void *arg);
+
+void default_metrics()
+{
+}
+
+Metrics *create_metrics()
+{
+    Metrics *metrics = (Metrics *)calloc(1, sizeof(Metrics));
+    metrics->backend = (MetricsBackend *)calloc(1, sizeof(MetricsBackend));
+    metrics->backend->interval = 1;
+    metrics->backend->font_color.alpha = 0.5;
+    for (int i = 0; i < METRICS_NUM_SOURCES; i++)
+        metrics->backend->fds[i] = -1;
+    INIT_TIMER(metrics->backend->timer);
+    set_timer_anchored(&metrics->backend->timer, true);
+    set_timer_slack(&metrics->backend->timer, 100);
+    return metrics;
+}
+
+gpointer create_metrics_frontend(gconstpointer arg, gpointer data)
+{
+    Metrics *metrics_backend = (Metrics *)arg;
+
+    Metrics *metrics_frontend = (Metrics *)calloc(1, sizeof(Metrics));
+    metrics_frontend->backend = metrics_backend->backend;
+    metrics_backend->backend->instances = g_list_append(metrics_backend->backend->instances, metrics_frontend);
+    metrics_frontend->frontend = (MetricsFrontend *)calloc(1, sizeof(MetricsFrontend));
+    return metrics_frontend;
+}
+
+void destroy_metrics(void *obj)
+{
+    Metrics *metrics = (Metrics *)obj;
+    if (metrics->frontend) {
+        // This is a frontend element
+        metrics->backend->instances = g_list_remove_all(metrics->backend->instances, metrics);
+        free_and_null(metrics->frontend);
+        remove_area(&metrics->area);
+        free_area(&metrics->area);
+        free_and_null(metrics);
+    } else {
+        // This is a backend element
+        destroy_timer(&metrics->backend->timer);
+        close_metrics_sources(metrics->backend);
+
+        metrics->backend->bg = NULL;
+        pango_font_description_free(metrics->backend->font_desc);
+        metrics->backend->font_desc = NULL;
+        free_and_null(metrics->backend->format1);
+        free_and_null(metrics->backend->format2);
+        free_and_null(metrics->backend->net_interface);
+        free_and_null(metrics->backend->lclick_command);
+        free_and_null(metrics->backend->mclick_command);
+        free_and_null(metrics->backend->rclick_command);
+        free_and_null(metrics->backend->dwheel_command);
+        free_and_null(metrics->backend->uwheel_command);
+
+        if (metrics->backend->instances) {
+            fprintf(stderr, "tint2: Error: Attempt to destroy backend while there are still frontend instances!\n");
+            exit(EXIT_FAILURE);
+        }
+        free(metrics->backend);
+        free(metrics);
+    }
+}
+
+static guint metrics_format_sources(const char *format)
+{
+    guint sources = 0;
+    for (const char *c = format; c && *c; c++) {
+        if (*c != '%' || !c[1])
+            continue;
+        c++;
+        switch (*c) {
+        case 'c':
+            sources |= 1 << METRICS_CPU;
+            break;
+        case 'm':
+        case 'M':
+        case 's':
+            sources |= 1 << METRICS_MEMORY;
+            break;
+        case 'l':
+            sources |= 1 << METRICS_LOAD;
+            break;
+        case 'd':
+        case 'u':
+            sources |= 1 << METRICS_NET;
+            break;
+        case 't':
+            sources |= 1 << METRICS_TEMPERATURE;
+            break;
+        }
+    }
+    return sources;
+}
+
+void init_metrics()
+{
+    GList *to_remove = panel_config.metrics_list;
+    for (int k = 0; k < strlen(panel_items_order) && to_remove; k++) {
+        if (panel_items_order[k] == 'M') {
+            to_remove = to_remove->next;
+        }
+    }
+
+    if (to_remove) {
+        if (to_remove == panel_config.metrics_list) {
+            g_list_free_full(to_remove, destroy_metrics);
+            panel_config.metrics_list = NULL;
+        } else {
+            // Cut panel_config.metrics_list
+            if (to_remove->prev)
+                to_remove->prev->next = NULL;
+            to_remove->prev = NULL;
+            // Remove all elements of to_remove and to_remove itself
+            g_list_free_full(to_remove, destroy_metrics);
+        }
+    }
+
+    metrics_init_fonts();
+    for (GList *l = panel_config.metrics_list; l; l = l->next) {
+        Metrics *metrics = l->data;
+
+        // Set missing config options
+        if (!metrics->backend->bg)
+            metrics->backend->bg = &g_array_index(backgrounds, Background, 0);
+        if (!metrics->backend->format1 && !metrics->backend->format2)
+            metrics->backend->format1 = strdup("CPU %c%% MEM %m%%");
+
+        open_metrics_sources(metrics->backend);
+        metrics_timer_callback(metrics);
+        change_timer(&metrics->backend->timer,
+                     true,
+                     metrics->backend->interval * 1000,
+                     metrics->backend->interval * 1000,
+                     metrics_timer_callback,
+                     metrics);
+    }
+}
+
+void init_metrics_panel(void *p)
+{
+    Panel *panel = (Panel *)p;
+
+    // Make sure this is only done once if there are multiple items
+    if (panel->metrics_list && ((Metrics *)panel->metrics_list->data)->frontend)
+        return;
+
+    // panel->metrics_list is now a copy of the pointer panel_config.metrics_list
+    // We make it a deep copy
+    panel->metrics_list = g_list_copy_deep(panel_config.metrics_list, create_metrics_frontend, NULL);
+
+    for (GList *l = panel->metrics_list; l; l = l->next) {
+        Metrics *metrics = l->data;
+        metrics->area.bg = metrics->backend->bg;
+        metrics->area.paddingx = metrics->backend->paddingx;
+        metrics->area.paddingy = metrics->backend->paddingy;
+        metrics->area.paddingxlr = metrics->backend->paddingxlr;
+        metrics->area.parent = panel;
+        metrics->area.panel = panel;
+        metrics->area._dump_geometry = metrics_dump_geometry;
+        metrics->area._compute_desired_size = metrics_compute_desired_size;
+        snprintf(metrics->area.name, sizeof(metrics->area.name), "Metrics");
+        metrics->area._draw_foreground = draw_metrics;
+        metrics->area.size_mode = LAYOUT_FIXED;
+        metrics->area._resize = resize_metrics;
+        metrics->area._get_tooltip_text = metrics_get_tooltip;
+        metrics->area._is_under_mouse = full_width_area_is_under_mouse;
+        metrics->area.has_mouse_press_effect =
+            panel_config.mouse_effects &&
+            (metrics->area.has_mouse_over_effect = metrics->backend->lclick_command ||
+                                                   metrics->backend->mclick_command ||
+                                                   metrics->backend->rclick_command ||
+                                                   metrics->backend->uwheel_command ||
+                                                   metrics->backend->dwheel_command);
+
+        metrics->area.resize_needed = TRUE;
+        metrics->area.on_screen = TRUE;
+        instantiate_area_gradients(&metrics->area);
+    }
+}
+
+void metrics_init_fonts()
+{
+    for (GList *l = panel_config.metrics_list; l; l = l->next) {
+        Metrics *metrics = l->data;
+        if (!metrics->backend->font_desc)
+            metrics->backend->font_desc = pango_font_description_from_string(get_default_font());
+    }
+}
+
+void metrics_default_font_changed()
+{
+    gboolean needs_update = FALSE;
+    for (GList *l = panel_config.metrics_list; l; l = l->next) {
+        Metrics *metrics = l->data;
+
+        if (!metrics->backend->has_font) {
+            pango_font_description_free(metrics->backend->font_desc);
+            metrics->backend->font_desc = NULL;
+            needs_update = TRUE;
+        }
+    }
+    if (!needs_update)
+        return;
+
+    metrics_init_fonts();
+    for (int i = 0; i < num_panels; i++) {
+        for (GList *l = panels[i].metrics_list; l; l = l->next) {
+            Metrics *metrics = l->data;
+
+            if (!metrics->backend->has_font) {
+                metrics->area.resize_needed = TRUE;
+                schedule_redraw(&metrics->area);
+            }
+        }
+    }
+    schedule_panel_redraw();
+}
+
+void cleanup_metrics()
+{
+    // Cleanup frontends
+    for (int i = 0; i < num_panels; i++) {
+        g_list_free_full(panels[i].metrics_list, destroy_metrics);
+        panels[i].metrics_list = NULL;
+    }
+
+    // Cleanup backends
+    g_list_free_full(panel_config.metrics_list, destroy_metrics);
+    panel_config.metrics_list = NULL;
+}
+
+void open_metrics_sources(MetricsBackend *backend)
+{
+    close_metrics_sources(backend);
+    backend->sources = metrics_format_sources(backend->format1) | metrics_format_sources(backend->format2);
+    for (int i = 0; i < METRICS_NUM_SOURCES; i++) {
+        if (!(backend->sources & (1 << i)))
+            continue;
+        char path[256];
+        switch (i) {
+        case METRICS_CPU:
+            snprintf(path, sizeof(path), "/proc/stat");
+            break;
+        case METRICS_MEMORY:
+            snprintf(path, sizeof(path), "/proc/meminfo");
+            break;
+        case METRICS_LOAD:
+            snprintf(path, sizeof(path), "/proc/loadavg");
+            break;
+        case METRICS_NET:
+            snprintf(path, sizeof(path), "/proc/net/dev");
+            break;
+        case METRICS_TEMPERATURE:
+            snprintf(path, sizeof(path), "/sys/class/thermal/thermal_zone%d/temp", backend->thermal_zone);
+            break;
+        }
+        backend->fds[i] = open(path, O_RDONLY);
+        if (backend->fds[i] < 0)
+            fprintf(stderr, "tint2: Metrics: could not open %s: %s\n", path, strerror(errno));
+    }
+    backend->last_sample_time = 0;
+    backend->last_cpu_busy = backend->last_cpu_total = 0;
+    backend->last_net_rx = backend->last_net_tx = 0;
+}
+
+void close_metrics_sources(MetricsBackend *backend)
+{
+    for (int i = 0; i < METRICS_NUM_SOURCES; i++) {
+        if (backend->fds[i] >= 0)
+            close(backend->fds[i]);
+        backend->fds[i] = -1;
+    }
+}
+
+// Reads the file from the start into metrics_read_buf. Returns the contents, or NULL.
+static const char *read_metrics_source(int fd, size_t size)
+{
+    if (fd < 0)
+        return NULL;
+    ssize_t len;
+    do {
+        len = pread(fd, metrics_read_buf, MIN(size, sizeof(metrics_read_buf)) - 1, 0);
+    } while (len < 0 && errno == EINTR);
+    if (len < 0)
+        return NULL;
+    metrics_read_buf[len] = '\0';
+    return metrics_read_buf;
+}
+
+// Parses the first line of /proc/stat, the time spent by all CPUs in each state.
+static gboolean parse_proc_stat(const char *s, unsigned long long *busy, unsigned long long *total)
+{
+    if (strncmp(s, "cpu ", 4) != 0)
+        return FALSE;
+    s += 4;
+    // user nice system idle iowait irq softirq steal; the guest time is included in user and nice
+    unsigned long long fields[8] = {0};
+    for (int i = 0; i < 8; i++) {
+        char *end;
+        fields[i] = strtoull(s, &end, 10);
+        if (end == s)
+            break;
+        s = end;
+    }
+    *total = 0;
+    for (int i = 0; i < 8; i++)
+        *total += fields[i];
+    *busy = *total - fields[3] - fields[4];
+    return *total > 0;
+}
+
+// Returns the value of a field of /proc/meminfo in bytes, or -1.
+static double meminfo_field(const char *s, const char *name)
+{
+    size_t name_len = strlen(name);
+    for (const char *line = s; line && *line; line = strchr(line, '\n'), line = line ? line + 1 : NULL) {
+        if (strncmp(line, name, name_len) == 0 && line[name_len] == ':')
+            return strtoull(line + name_len + 1, NULL, 10) * 1024.0;
+    }
+    return -1;
+}
+
+static gboolean parse_meminfo(const char *s, MetricsValues *values)
+{
+    values->mem_total = meminfo_field(s, "MemTotal");
+    double available = meminfo_field(s, "MemAvailable");
+    if (available < 0) {
+        // Before Linux 3.14
+        available = meminfo_field(s, "MemFree") + meminfo_field(s, "Buffers") + meminfo_field(s, "Cached");
+    }
+    values->mem_used = values->mem_total - available;
+    values->swap_total = MAX(0, meminfo_field(s, "SwapTotal"));
+    values->swap_used = values->swap_total - MAX(0, meminfo_field(s, "SwapFree"));
+    return values->mem_total > 0;
+}
+
+// Sums the bytes received and sent by the interface, or by all interfaces except the loopback if it is NULL.
+static gboolean parse_net_dev(const char *s, const char *interface, unsigned long long *rx, unsigned long long *tx)
+{
+    *rx = *tx = 0;
+    gboolean found = FALSE;
+    for (const char *line = s; line && *line; line = strchr(line, '\n'), line = line ? line + 1 : NULL) {
+        const char *colon = strchr(line, ':');
+        const char *eol = strchr(line, '\n');
+        // The header lines have no colon
+        if (!colon || (eol && colon > eol))
+            continue;
+        const char *name = line;
+        while (*name == ' ')
+            name++;
+        size_t name_len = (size_t)(colon - name);
+        if (interface ? strlen(interface) != name_len || strncmp(name, interface, name_len) != 0
+                      : name_len == 2 && strncmp(name, "lo", 2) == 0)
+            continue;
+        // Receive: bytes packets errs drop fifo frame compressed multicast; then the same for transmit
+        const char *p = colon + 1;
+        char *end;
+        for (int i = 0; i < 9; i++) {
+            unsigned long long value = strtoull(p, &end, 10);
+            if (i == 0)
+                *rx += value;
+            else if (i == 8)
+                *tx += value;
+            p = end;
+        }
+        found = TRUE;
+    }
+    return found;
+}
+
+void sample_metrics(MetricsBackend *backend)
+{
+    MetricsValues *values = &backend->values;
+    double now = get_time();
+    double elapsed = backend->last_sample_time > 0 ? now - backend->last_sample_time : 0;
+    values->available = 0;
+
+    const char *s;
+    if ((s = read_metrics_source(backend->fds[METRICS_CPU], 512))) {
+        unsigned long long busy, total;
+        if (parse_proc_stat(s, &busy, &total)) {
+            // The first sample gives the average since boot
+            if (total > backend->last_cpu_total)
+                values->cpu_usage =
+                    100.0 * (busy - backend->last_cpu_busy) / (double)(total - backend->last_cpu_total);
+            backend->last_cpu_busy = busy;
+            backend->last_cpu_total = total;
+            values->available |= 1 << METRICS_CPU;
+        }
+    }
+    if ((s = read_metrics_source(backend->fds[METRICS_MEMORY], METRICS_READ_SIZE))) {
+        if (parse_meminfo(s, values))
+            values->available |= 1 << METRICS_MEMORY;
+    }
+    if ((s = read_metrics_source(backend->fds[METRICS_LOAD], 128))) {
+        if (sscanf(s, "%lf %lf %lf", &values->load[0], &values->load[1], &values->load[2]) == 3)
+            values->available |= 1 << METRICS_LOAD;
+    }
+    if ((s = read_metrics_source(backend->fds[METRICS_NET], METRICS_READ_SIZE))) {
+        unsigned long long rx, tx;
+        if (parse_net_dev(s, backend->net_interface, &rx, &tx)) {
+            // Counters can go back when interfaces disappear
+            values->net_rx_rate = elapsed > 0 && rx >= backend->last_net_rx ? (rx - backend->last_net_rx) / elapsed : 0;
+            values->net_tx_rate = elapsed > 0 && tx >= backend->last_net_tx ? (tx - backend->last_net_tx) / elapsed : 0;
+            backend->last_net_rx = rx;
+            backend->last_net_tx = tx;
+            values->available |= 1 << METRICS_NET;
+        }
+    }
+    if ((s = read_metrics_source(backend->fds[METRICS_TEMPERATURE], 32))) {
+        char *end;
+        long millidegrees = strtol(s, &end, 10);
+        if (end != s) {
+            values->temperature = millidegrees / 1000.0;
+            values->available |= 1 << METRICS_TEMPERATURE;
+        }
+    }
+    backend->last_sample_time = now;
+}
+
+// Formats a size in bytes with a binary unit suffix, using at most 3 digits.
+static void format_size(char *buf, size_t size, double bytes)
+{
+    const char *units = "BKMGTP";
+    int unit = 0;
+    while (bytes >= 1000 && units[unit + 1]) {
+        bytes /= 1024;
+        unit++;
+    }
+    snprintf(buf, size, unit > 0 && bytes < 9.95 ? "%.1f%c" : "%.0f%c", bytes, units[unit]);
+}
+
+void metrics_update_text(char *dest, const char *format, const MetricsBackend *backend)
+{
+    const MetricsValues *values = &backend->values;
+    size_t length = 0;
+    dest[0] = '\0';
+    if (!format)
+        return;
+
+    for (const char *c = format; *c && length < METRICS_BUF_SIZE - 1; c++) {
+        char buf[64];
+        if (*c != '%') {
+            buf[0] = *c;
+            buf[1] = '\0';
+        } else {
+            c++;
+            MetricsSource source;
+            switch (*c) {
+            case 'c':
+                source = METRICS_CPU;
+                snprintf(buf, sizeof(buf), "%.0f", values->cpu_usage);
+                break;
+            case 'm':
+                source = METRICS_MEMORY;
+                snprintf(buf, sizeof(buf), "%.0f", 100.0 * values->mem_used / values->mem_total);
+                break;
+            case 'M':
+                source = METRICS_MEMORY;
+                format_size(buf, sizeof(buf), values->mem_used);
+                break;
+            case 's':
+                source = METRICS_MEMORY;
+                snprintf(buf, sizeof(buf), "%.0f", values->swap_total > 0 ? 100.0 * values->swap_used / values->swap_total : 0);
+                break;
+            case 'l':
+                source = METRICS_LOAD;
+                snprintf(buf, sizeof(buf), "%.2f", values->load[0]);
+                break;
+            case 't':
+                source = METRICS_TEMPERATURE;
+                snprintf(buf, sizeof(buf), "%.0f", values->temperature);
+                break;
+            case 'd':
+                source = METRICS_NET;
+                format_size(buf, sizeof(buf), values->net_rx_rate);
+                break;
+            case 'u':
+                source = METRICS_NET;
+                format_size(buf, sizeof(buf), values->net_tx_rate);
+                break;
+            case '\0':
+                c--;
+                // fallthrough
+            case '%':
+                source = METRICS_NUM_SOURCES;
+                snprintf(buf, sizeof(buf), "%%");
+                break;
+            default:
+                fprintf(stderr, "tint2: Metrics: unrecognised format specifier '%%%c'.\n", *c);
+                source = METRICS_NUM_SOURCES;
+                buf[0] = *c;
+                buf[1] = '\0';
+            }
+            if (source != METRICS_NUM_SOURCES && !(values->available & (1 << source)))
+                snprintf(buf, sizeof(buf), "?");
+        }
+        length += strlcat(dest + length, buf, METRICS_BUF_SIZE - length);
+        length = MIN(length, METRICS_BUF_SIZE - 1);
+    }
+}
+
+void metrics_timer_callback(void *arg)
+{
+    Metrics *metrics = (Metrics *)arg;
+    MetricsBackend *backend = metrics->backend;
+
+    sample_metrics(backend);
+
+    char text1[METRICS_BUF_SIZE], text2[METRICS_BUF_SIZE];
+    metrics_update_text(text1, backend->format1, backend);
+    metrics_update_text(text2, backend->format2, backend);
+    if (strcmp(text1, backend->text1) == 0 && strcmp(text2, backend->text2) == 0)
+        return;
+    strcpy(backend->text1, text1);
+    strcpy(backend->text2, text2);
+
+    for (GList *l = backend->instances; l; l = l->next) {
+        Metrics *instance = (Metrics *)l->data;
+        instance->area.resize_needed = TRUE;
+        schedule_redraw(&instance->area);
+    }
+    schedule_panel_redraw();
+}
+
+int metrics_compute_desired_size(void *obj)
+{
+    Metrics *metrics = (Metrics *)obj;
+    return text_area_compute_desired_size(&metrics->area,
+                                          metrics->backend->text1,
+                                          metrics->backend->format2 ? metrics->backend->text2 : NULL,
+                                          metrics->backend->font_desc,
+                                          metrics->backend->font_desc);
+}
+
+gboolean resize_metrics(void *obj)
+{
+    Metrics *metrics = (Metrics *)obj;
+    return resize_text_area(&metrics->area,
+                            metrics->backend->text1,
+                            metrics->backend->format2 ? metrics->backend->text2 : NULL,
+                            metrics->backend->font_desc,
+                            metrics->backend->font_desc,
+                            &metrics->frontend->text1_posy,
+                            &metrics->frontend->text2_posy);
+}
+
+void draw_metrics(void *obj, cairo_t *c)
+{
+    Metrics *metrics = (Metrics *)obj;
+    Panel *panel = (Panel *)metrics->area.panel;
+    draw_text_area(&metrics->area,
+                   c,
+                   metrics->backend->text1,
+                   metrics->backend->format2 ? metrics->backend->text2 : NULL,
+                   metrics->backend->font_desc,
+                   metrics->backend->font_desc,
+                   metrics->frontend->text1_posy,
+                   metrics->frontend->text2_posy,
+                   &metrics->backend->font_color,
+                   panel->scale);
+}
+
+void metrics_dump_geometry(void *obj, int indent)
+{
+    Metrics *metrics = (Metrics *)obj;
+    fprintf(stderr,
+            "tint2: %*sText 1: y = %d, text = %s\n",
+            indent,
+            "",
+            metrics->frontend->text1_posy,
+            metrics->backend->text1);
+    fprintf(stderr,
+            "tint2: %*sText 2: y = %d, text = %s\n",
+            indent,
+            "",
+            metrics->frontend->text2_posy,
+            metrics->backend->text2);
+}
+
+char *metrics_get_tooltip(void *obj)
+{
+    Metrics *metrics = (Metrics *)obj;
+    const MetricsValues *values = &metrics->backend->values;
+    GString *tooltip = g_string_new("");
+    char buf1[64], buf2[64];
+
+    if (values->available & (1 << METRICS_CPU))
+        g_string_append_printf(tooltip, "CPU: %.0f%%\n", values->cpu_usage);
+    if (values->available & (1 << METRICS_MEMORY)) {
+        format_size(buf1, sizeof(buf1), values->mem_used);
+        format_size(buf2, sizeof(buf2), values->mem_total);
+        g_string_append_printf(tooltip,
+                               "Memory: %s of %s (%.0f%%)\n",
+                               buf1,
+                               buf2,
+                               100.0 * values->mem_used / values->mem_total);
+        if (values->swap_total > 0) {
+            format_size(buf1, sizeof(buf1), values->swap_used);
+            format_size(buf2, sizeof(buf2), values->swap_total);
+            g_string_append_printf(tooltip,
+                                   "Swap: %s of %s (%.0f%%)\n",
+                                   buf1,
+                                   buf2,
+                                   100.0 * values->swap_used / values->swap_total);
+        }
+    }
+    if (values->available & (1 << METRICS_LOAD))
+        g_string_append_printf(tooltip, "Load: %.2f %.2f %.2f\n", values->load[0], values->load[1], values->load[2]);
+    if (values->available & (1 << METRICS_TEMPERATURE))
+        g_string_append_printf(tooltip, "Temperature: %.0f°C\n", values->temperature);
+    if (values->available & (1 << METRICS_NET)) {
+        format_size(buf1, sizeof(buf1), values->net_rx_rate);
+        format_size(buf2, sizeof(buf2), values->net_tx_rate);
+        g_string_append_printf(tooltip,
+                               "Network (%s): %s/s down, %s/s up\n",
+                               metrics->backend->net_interface ? metrics->backend->net_interface : "all",
+                               buf1,
+                               buf2);
+    }
+
+    if (tooltip->len == 0) {
+        g_string_free(tooltip, TRUE);
+        return NULL;
+    }
+    // Remove the last newline
+    g_string_truncate(tooltip, tooltip->len - 1);
+    char *result = strdup(tooltip->str);
+    g_string_free(tooltip, TRUE);
+    return result;
+}
+
+void metrics_action(void *obj, int button, int x, int y, Time time)
+{
+    Metrics *metrics = (Metrics *)obj;
+    char *command = NULL;
+    switch (button) {
+    case 1:
+        command = metrics->backend->lclick_command;
+        break;
+    case 2:
+        command = metrics->backend->mclick_command;
+        break;
+    case 3:
+        command = metrics->backend->rclick_command;
+        break;
+    case 4:
+        command = metrics->backend->uwheel_command;
+        break;
+    case 5:
+        command = metrics->backend->dwheel_command;
+        break;
+    }
+    tint_exec(command, NULL, NULL, time, obj, x, y, FALSE, TRUE);
+}
+
+TEST(parse_proc_stat)
+{
+    unsigned long long busy, total;
+    ASSERT(parse_proc_stat("cpu  100 20 30 800 50 0 0 0 10 0\ncpu0 50 10 15 400 25 0 0 0 5 0\n", &busy, &total));
+    ASSERT_EQUAL(total, 1000);
+    ASSERT_EQUAL(busy, 150);
+    ASSERT(!parse_proc_stat("intr 1 2 3\n", &busy, &total));
+}
+
+TEST(parse_meminfo)
+{
+    MetricsValues values;
+    ASSERT(parse_meminfo("MemTotal:        1000 kB\n"
+                         "MemFree:          100 kB\n"
+                         "MemAvailable:     400 kB\n"
+                         "SwapTotal:        200 kB\n"
+                         "SwapFree:          50 kB\n",
+                         &values));
+    ASSERT_EQUAL((int)values.mem_total, 1000 * 1024);
+    ASSERT_EQUAL((int)values.mem_used, 600 * 1024);
+    ASSERT_EQUAL((int)values.swap_used, 150 * 1024);
+}
+
+TEST(parse_net_dev)
+{
+    const char *net_dev =
+        "Inter-|   Receive                                                |  Transmit\n"
+        " face |bytes    packets errs drop fifo frame compressed multicast|bytes    packets errs drop fifo colls carrier compressed\n"
+        "    lo:     500       5    0    0    0     0          0         0      500       5    0    0    0     0       0          0\n"
+        "  eth0:    1000      10    0    0    0     0          0         0     2000      20    0    0    0     0       0          0\n"
+        "wlan0: 300 3 0 0 0 0 0 0 400 4 0 0 0 0 0 0\n";
+    unsigned long long rx, tx;
+    ASSERT(parse_net_dev(net_dev, NULL, &rx, &tx));
+    ASSERT_EQUAL(rx, 1300);
+    ASSERT_EQUAL(tx, 2400);
+    ASSERT(parse_net_dev(net_dev, "eth0", &rx, &tx));
+    ASSERT_EQUAL(rx, 1000);
+    ASSERT_EQUAL(tx, 2000);
+    ASSERT(!parse_net_dev(net_dev, "eth1", &rx, &tx));
+}
+
+BENCHMARK(metrics_sample)
+{
+    MetricsBackend backend;
+    memset(&backend, 0, sizeof(backend));
+    for (int i = 0; i < METRICS_NUM_SOURCES; i++)
+        backend.fds[i] = -1;
+    backend.format1 = (char *)"%c %m %M %s %l %t %d %u";
+    open_metrics_sources(&backend);
+
+    const int count = 1000;
+    char text[METRICS_BUF_SIZE];
+    double start = get_time();
+    for (int i = 0; i < count; i++) {
+        sample_metrics(&backend);
+        metrics_update_text(text, backend.format1, &backend);
+    }
+    double elapsed = get_time() - start;
+    close_metrics_sources(&backend);
+    ASSERT(strlen(text) > 0);
+    printf("metrics sample: %.1f us (%s)\n", elapsed * 1.0e6 / count, text);
+}
@@ -0,0 +1,165 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <sys/types.h>
+#include <pango/pangocairo.h>
+
+#include "area.h"
+#include "common.h"
+#include "timer.h"
+
+// Architecture:
+// Panel panel_config contains an array of Metrics, each storing all config options and all the state variables.
+// Only these sample the system.
+//
+// Tint2 maintains an array of Panels, one for each monitor. Each stores an array of Metrics which was initially copied
+// from panel_config. Each works as a frontend to the corresponding Metrics in panel_config as backend, using the
+// backend's config and state variables.
+//
+// The backend keeps the files under /proc and /sys open and reads them with pread() at each sample, so that a sample
+// costs a few system calls and no process. Only the files needed by the formats are opened.
+
+#define METRICS_BUF_SIZE 256
+
+typedef enum MetricsSource {
+    METRICS_CPU = 0,
+    METRICS_MEMORY,
+    METRICS_LOAD,
+    METRICS_NET,
+    METRICS_TEMPERATURE,
+    METRICS_NUM_SOURCES
+} MetricsSource;
+
+typedef struct MetricsValues {
+    // Bit mask of the sources (1 << MetricsSource) sampled successfully
+    guint available;
+    // Percentage of the time the CPUs were busy since the previous sample
+    double cpu_usage;
+    // Sizes in bytes
+    double mem_total;
+    double mem_used;
+    double swap_total;
+    double swap_used;
+    double load[3];
+    // In degrees Celsius
+    double temperature;
+    // In bytes per second, since the previous sample
+    double net_rx_rate;
+    double net_tx_rate;
+} MetricsValues;
+
+typedef struct MetricsBackend {
+    // Config:
+    char *format1;
+    char *format2;
+    // Interval in seconds
+    int interval;
+    // Network interface to measure, or NULL for all of them except the loopback
+    char *net_interface;
+    int thermal_zone;
+    gboolean has_font;
+    PangoFontDescription *font_desc;
+    Color font_color;
+    char *lclick_command;
+    char *mclick_command;
+    char *rclick_command;
+    char *uwheel_command;
+    char *dwheel_command;
+    // paddingxlr = horizontal padding left/right
+    // paddingx = horizontal padding between childs
+    int paddingxlr, paddingx, paddingy;
+    Background *bg;
+
+    // Backend state:
+    Timer timer;
+    // Bit mask of the sources used by the formats
+    guint sources;
+    // Open descriptors of the sources, or -1
+    int fds[METRICS_NUM_SOURCES];
+    MetricsValues values;
+    // Counters of the previous sample, used to compute the rates
+    double last_sample_time;
+    unsigned long long last_cpu_busy;
+    unsigned long long last_cpu_total;
+    unsigned long long last_net_rx;
+    unsigned long long last_net_tx;
+    char text1[METRICS_BUF_SIZE];
+    char text2[METRICS_BUF_SIZE];
+
+    // List of Metrics which are frontends for this backend, one for each panel
+    GList *instances;
+} MetricsBackend;
+
+typedef struct MetricsFrontend {
+    // Frontend state:
+    int text1_posy;
+    int text2_posy;
+} MetricsFrontend;
+
+typedef struct Metrics {
+    Area area;
+    // All elements have the backend pointer set. However only backend elements have ownership.
+    MetricsBackend *backend;
+    // Set only for frontend Metrics items.
+    MetricsFrontend *frontend;
+} Metrics;
+
+// Called before the config is read and panel_config/panels are created.
+// Afterwards, the config parsing code creates the array of Metrics in panel_config and populates the configuration
+// fields in the backend.
+void default_metrics();
+
+// Creates a new Metrics item with only the backend field set. The state is NOT initialized. The config is initialized
+// to the default values.
+Metrics *create_metrics();
+
+void destroy_metrics(void *obj);
+
+// Called after the config is read and panel_config is populated, but before panels are created.
+// Initializes the state of the backend items and takes the first sample.
+// panel_config.panel_items is used to determine which backend items are enabled. The others are destroyed and
+// removed from panel_config.metrics_list.
+void init_metrics();
+
+// Called after each on-screen panel is created, with a pointer to the panel.
+// Initializes the state of the frontend items. Also adds a pointer to it in backend->instances.
+void init_metrics_panel(void *panel);
+
+// Called just before the panels are destroyed.
+// Releases all frontends and then all the backends.
+void cleanup_metrics();
+
+// Called on draw, obj = pointer to the front-end Metrics item.
+void draw_metrics(void *obj, cairo_t *c);
+
+// Called on resize, obj = pointer to the front-end Metrics item.
+// Returns 1 if the new size is different than the previous size.
+gboolean resize_metrics(void *obj);
+
+// Called on mouse click event.
+void metrics_action(void *obj, int button, int x, int y, Time time);
+
+void metrics_default_font_changed();
+
+// Opens the sources used by the formats of the backend.
+void open_metrics_sources(MetricsBackend *backend);
+void close_metrics_sources(MetricsBackend *backend);
+
+// Reads the open sources and updates backend->values.
+void sample_metrics(MetricsBackend *backend);
+
+// Formats the values of the backend into dest (of size METRICS_BUF_SIZE).
+// Format specification:
+// %c : CPU usage, in percent
+// %m : Memory used, in percent
+// %M : Memory used, e.g. 1.5G
+// %s : Swap used, in percent
+// %l : Load average over the last minute
+// %t : Temperature, in degrees Celsius
+// %d : Download rate, e.g. 1.2M (per second)
+// %u : Upload rate
+// %% : A percent sign
+// Values that could not be read are shown as '?'.
+void metrics_update_text(char *dest, const char *format, const MetricsBackend *backend);
+
+#endif // METRICS_H
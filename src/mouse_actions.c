@@ -69,6 +69,16 @@ gboolean tint2_handles_click(Panel *panel, XButtonEvent *e)
         return TRUE;
     if (click_button(panel, e->x, e->y))
         return TRUE;
+    Metrics *metrics = click_metrics(panel, e->x, e->y);
+    if (metrics) {
+        MetricsBackend *backend = metrics->backend;
+        if ((e->button == 1 && backend->lclick_command) || (e->button == 2 && backend->mclick_command) ||
+            (e->button == 3 && backend->rclick_command) || (e->button == 4 && backend->uwheel_command) ||
+            (e->button == 5 && backend->dwheel_command))
+            return TRUE;
+        else
+            return FALSE;
+    }
     return FALSE;
 }
 
@@ -231,6 +241,15 @@ void handle_mouse_release_event(XEvent *e)
         return;
     }
 
+    Metrics *metrics = click_metrics(panel, e->xbutton.x, e->xbutton.y);
+    if (metrics) {
+        metrics_action(metrics, e->xbutton.button, e->xbutton.x - metrics->area.posx, e->xbutton.y - metrics->area.posy, e->xbutton.time);
+        if (panel_layer == BOTTOM_LAYER)
+            XLowerWindow(server.display, panel->main_win);
+        task_drag = 0;
+        return;
+    }
+
     if (e->xbutton.button == 1 && click_launcher(panel, e->xbutton.x, e->xbutton.y)) {
         LauncherIcon *icon = click_launcher_icon(panel, e->xbutton.x, e->xbutton.y);
         if (icon) {
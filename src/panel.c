@@ -35,6 +35,8 @@
 #include "task.h"
 #include "panel.h"
 #include "tooltip.h"
+#include "shm_image.h"
+#include "window_registry.h"
 
 void panel_clear_background(void *obj);
 
@@ -57,9 +59,11 @@ gboolean panel_refresh;
 gboolean task_dragged;
 char *panel_window_name = NULL;
 gboolean debug_geometry;
+gboolean client_side_rendering;
 gboolean debug_gradients;
 gboolean startup_notifications;
 gboolean debug_thumbnails;
+gboolean debug_icon_cache;
 gboolean debug_blink;
 gboolean panel_autohide;
 int panel_autohide_show_timeout;
@@ -144,11 +148,20 @@ void cleanup_panel()
         if (p->temp_pmap)
             XFreePixmap(server.display, p->temp_pmap);
         p->temp_pmap = 0;
+        p->temp_pmap_width = p->temp_pmap_height = 0;
+        if (p->back_surface)
+            cairo_surface_destroy(p->back_surface);
+        p->back_surface = NULL;
+        if (p->damage)
+            cairo_region_destroy(p->damage);
+        p->damage = NULL;
         if (p->hidden_pixmap)
             XFreePixmap(server.display, p->hidden_pixmap);
         p->hidden_pixmap = 0;
-        if (p->main_win)
+        if (p->main_win) {
+            unregister_window(p->main_win, p);
             XDestroyWindow(server.display, p->main_win);
+        }
         p->main_win = 0;
         destroy_timer(&p->autohide_timer);
         cleanup_freespace(p);
@@ -202,6 +215,7 @@ void init_panel()
     init_separator();
     init_execp();
     init_button();
+    init_metrics();
 
     // number of panels (one monitor or 'all' monitors)
     if (panel_config.monitor >= 0)
@@ -274,6 +288,8 @@ void init_panel()
             }
             if (panel_items_order[k] == 'P')
                 init_button_panel(p);
+            if (panel_items_order[k] == 'M')
+                init_metrics_panel(p);
         }
         set_panel_items_order(p);
 
@@ -292,6 +308,7 @@ void init_panel()
                                     server.visual,
                                     mask,
                                     &att);
+        register_window(p->main_win, WINDOW_PANEL, p);
 
         long event_mask = ExposureMask | ButtonPressMask | ButtonReleaseMask | ButtonMotionMask | PropertyChangeMask;
         if (p->mouse_effects || p->g_task.tooltip_enabled || p->clock.area._get_tooltip_text ||
@@ -704,6 +721,7 @@ void set_panel_items_order(Panel *p)
     int i_separator = 0;
     int i_freespace = 0;
     int i_button = 0;
+    int i_metrics = 0;
     for (int k = 0; k < strlen(panel_items_order); k++) {
         if (panel_items_order[k] == 'L') {
             p->area.children = g_list_append(p->area.children, &p->launcher);
@@ -747,6 +765,12 @@ void set_panel_items_order(Panel *p)
             if (item)
                 p->area.children = g_list_append(p->area.children, (Area *)item->data);
         }
+        if (panel_items_order[k] == 'M') {
+            GList *item = g_list_nth(p->metrics_list, i_metrics);
+            i_metrics++;
+            if (item)
+                p->area.children = g_list_append(p->area.children, (Area *)item->data);
+        }
     }
     initialize_positions(&p->area, 0);
 }
@@ -1016,12 +1040,7 @@ void set_panel_background(Panel *p)
 
 Panel *get_panel(Window win)
 {
-    for (int i = 0; i < num_panels; i++) {
-        if (panels[i].main_win == win) {
-            return &panels[i];
-        }
-    }
-    return 0;
+    return (Panel *)lookup_window_object(win, WINDOW_PANEL);
 }
 
 Taskbar *click_taskbar(Panel *panel, int x, int y)
@@ -1112,6 +1131,16 @@ Button *click_button(Panel *panel, int x, int y)
     return NULL;
 }
 
+Metrics *click_metrics(Panel *panel, int x, int y)
+{
+    for (GList *l = panel->metrics_list; l; l = l->next) {
+        Metrics *metrics = (Metrics *)l->data;
+        if (area_is_under_mouse(metrics, x, y))
+            return metrics;
+    }
+    return NULL;
+}
+
 void stop_autohide_timer(Panel *p)
 {
     stop_timer(&p->autohide_timer);
@@ -1192,13 +1221,107 @@ void shrink_panel(Panel *panel)
     }
 }
 
+void update_panel_back_buffer(Panel *panel)
+{
+    if (panel->temp_pmap && panel->temp_pmap_width == panel->area.width &&
+        panel->temp_pmap_height == panel->area.height)
+        return;
+    if (panel->temp_pmap)
+        XFreePixmap(server.display, panel->temp_pmap);
+    panel->temp_pmap =
+        XCreatePixmap(server.display, server.root_win, panel->area.width, panel->area.height, server.depth);
+    panel->temp_pmap_width = panel->area.width;
+    panel->temp_pmap_height = panel->area.height;
+    if (client_side_rendering) {
+        if (panel->back_surface)
+            cairo_surface_destroy(panel->back_surface);
+        panel->back_surface = create_client_side_surface(panel->area.width, panel->area.height);
+    }
+    // The contents are undefined, the whole window has to be copied again
+    damage_whole_panel(panel);
+}
+
+void damage_panel(Panel *panel, int x, int y, int width, int height)
+{
+    if (width <= 0 || height <= 0)
+        return;
+    if (!panel->damage)
+        panel->damage = cairo_region_create();
+    cairo_rectangle_int_t r = {x, y, width, height};
+    cairo_region_union_rectangle(panel->damage, &r);
+}
+
+void damage_whole_panel(Panel *panel)
+{
+    damage_panel(panel, 0, 0, panel->area.width, panel->area.height);
+}
+
+gboolean panel_damaged(Panel *panel, int x, int y, int width, int height)
+{
+    if (!panel->damage)
+        return FALSE;
+    cairo_rectangle_int_t r = {x, y, width, height};
+    return cairo_region_contains_rectangle(panel->damage, &r) != CAIRO_REGION_OVERLAP_OUT;
+}
+
+void clip_gc_to_damage(Panel *panel, GC gc)
+{
+    int n = panel->damage ? cairo_region_num_rectangles(panel->damage) : 0;
+    XRectangle rects[n > 0 ? n : 1];
+    for (int i = 0; i < n; i++) {
+        cairo_rectangle_int_t r;
+        cairo_region_get_rectangle(panel->damage, i, &r);
+        rects[i].x = r.x;
+        rects[i].y = r.y;
+        rects[i].width = r.width;
+        rects[i].height = r.height;
+    }
+    XSetClipRectangles(server.display, gc, 0, 0, rects, n, Unsorted);
+}
+
+void clip_cairo_to_damage(Panel *panel, cairo_t *c)
+{
+    int n = panel->damage ? cairo_region_num_rectangles(panel->damage) : 0;
+    for (int i = 0; i < n; i++) {
+        cairo_rectangle_int_t r;
+        cairo_region_get_rectangle(panel->damage, i, &r);
+        cairo_rectangle(c, r.x, r.y, r.width, r.height);
+    }
+    cairo_clip(c);
+}
+
+void present_panel(Panel *panel)
+{
+    if (!panel->damage)
+        return;
+    if (!cairo_region_is_empty(panel->damage)) {
+        clip_gc_to_damage(panel, server.gc);
+        XCopyArea(server.display,
+                  panel->temp_pmap,
+                  panel->main_win,
+                  server.gc,
+                  0,
+                  0,
+                  panel->area.width,
+                  panel->area.height,
+                  0,
+                  0);
+        XSetClipMask(server.display, server.gc, None);
+    }
+    cairo_region_destroy(panel->damage);
+    panel->damage = NULL;
+}
+
 void render_panel(Panel *panel)
 {
     relayout(&panel->area);
     if (debug_geometry)
         area_dump_geometry(&panel->area, 0);
     update_dependent_gradients(&panel->area);
+    collect_damage(&panel->area);
     draw_tree(&panel->area);
+    if (client_side_rendering && panel->damage)
+        put_surface_to_drawable(panel->back_surface, panel->temp_pmap, server.gc, panel->damage);
 }
 
 const char *get_default_font()
@@ -1230,6 +1353,7 @@ void default_font_changed()
     clock_default_font_changed();
     execp_default_font_changed();
     button_default_font_changed();
+    metrics_default_font_changed();
     taskbar_default_font_changed();
     taskbarname_default_font_changed();
     tooltip_default_font_changed();
@@ -1291,8 +1415,7 @@ void save_screenshot(const char *path)
     if (panel->area.width > server.monitors[0].width)
         panel->area.width = server.monitors[0].width;
 
-    panel->temp_pmap =
-        XCreatePixmap(server.display, server.root_win, panel->area.width, panel->area.height, server.depth);
+    update_panel_back_buffer(panel);
     render_panel(panel);
 
     XSync(server.display, False);
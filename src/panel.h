@@ -24,6 +24,7 @@
 #include "execplugin.h"
 #include "separator.h"
 #include "button.h"
+#include "metrics.h"
 
 #ifdef ENABLE_BATTERY
 #include "battery.h"
@@ -96,16 +97,26 @@ extern gboolean debug_fps;
 extern double tracing_fps_threshold;
 extern gboolean debug_frames;
 extern gboolean debug_thumbnails;
+extern gboolean debug_icon_cache;
 extern double ui_scale_dpi_ref;
 extern double ui_scale_monitor_size_ref;
 extern gboolean thumb_use_shm;
+// If set, the Area tree is composed client-side into an image surface, uploaded to the back buffer once per frame
+extern gboolean client_side_rendering;
 extern gboolean debug_blink;
 
 typedef struct Panel {
     Area area;
 
     Window main_win;
+    // Back buffer, on which the Area tree is composed before being copied to the window.
+    // Kept across frames, reallocated only when the panel size changes.
     Pixmap temp_pmap;
+    int temp_pmap_width, temp_pmap_height;
+    // Region of temp_pmap that changed since it was last copied to the window (NULL if empty)
+    cairo_region_t *damage;
+    // With client_side_rendering: image surface on which the Area tree is composed, then uploaded to temp_pmap
+    cairo_surface_t *back_surface;
 
     // position relative to root window
     int posx, posy;
@@ -145,6 +156,7 @@ typedef struct Panel {
     GList *separator_list;
     GList *execp_list;
     GList *button_list;
+    GList *metrics_list;
 
     // Autohide
     gboolean is_hidden;
@@ -170,6 +182,23 @@ void init_panel();
 void init_panel_size_and_position(Panel *panel);
 gboolean resize_panel(void *obj);
 void render_panel(Panel *panel);
+
+// Reallocates the back buffer if the panel size has changed.
+void update_panel_back_buffer(Panel *panel);
+
+// Marks a rectangle (relative to the panel window) as changed, to be copied to the window on the next present.
+void damage_panel(Panel *panel, int x, int y, int width, int height);
+void damage_whole_panel(Panel *panel);
+
+// Returns non-zero if the rectangle intersects the panel damage.
+gboolean panel_damaged(Panel *panel, int x, int y, int width, int height);
+
+// Restricts drawing to the panel damage.
+void clip_gc_to_damage(Panel *panel, GC gc);
+void clip_cairo_to_damage(Panel *panel, cairo_t *c);
+
+// Copies the damaged region of the back buffer to the panel window.
+void present_panel(Panel *panel);
 void shrink_panel(Panel *panel);
 void _schedule_panel_redraw(const char *file, const char *function, const int line);
 #define schedule_panel_redraw() _schedule_panel_redraw(__FILE__, __func__, __LINE__)
@@ -200,6 +229,7 @@ Battery *click_battery(Panel *panel, int x, int y);
 Area *click_area(Panel *panel, int x, int y);
 Execp *click_execp(Panel *panel, int x, int y);
 Button *click_button(Panel *panel, int x, int y);
+Metrics *click_metrics(Panel *panel, int x, int y);
 
 void autohide_show(void *p);
 void autohide_hide(void *p);
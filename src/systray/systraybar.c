@@ -35,6 +35,7 @@
 #include "server.h"
 #include "panel.h"
 #include "window.h"
+#include "window_registry.h"
 
 GSList *icons;
 
@@ -115,6 +116,11 @@ void init_systray()
 
     systray_composited = !server.disable_transparency && server.visual32 && server.colormap32;
     fprintf(stderr, "tint2: Systray composited rendering %s\n", systray_composited ? "on" : "off");
+    if (systray_composited && client_side_rendering) {
+        // The composited icons are rendered out of band on the systray pixmap
+        fprintf(stderr, "tint2: client-side rendering is not supported with the composited systray, disabling it\n");
+        client_side_rendering = FALSE;
+    }
 
     if (!systray_composited) {
         fprintf(stderr, "tint2: systray_asb forced to 100 0 0\n");
@@ -725,6 +731,8 @@ gboolean add_icon(Window win)
     TrayWindow *traywin = g_new0(TrayWindow, 1);
     traywin->parent = parent;
     traywin->win = win;
+    register_window(traywin->win, WINDOW_TRAY_ICON, traywin);
+    register_window(traywin->parent, WINDOW_TRAY_PARENT, traywin);
     traywin->depth = attr.depth;
     // Reparenting is done at the first paint event when the window is positioned correctly over its empty background,
     // to prevent graphical corruptions in icons with fake transparency
@@ -928,6 +936,8 @@ void remove_icon(TrayWindow *traywin)
 
     // remove from our list
     systray.list_icons = g_slist_remove(systray.list_icons, traywin);
+    unregister_window(traywin->win, traywin);
+    unregister_window(traywin->parent, traywin);
     fprintf(stderr, YELLOW "tint2: remove_icon: %lu (%s)" RESET "\n", traywin->win, traywin->name);
 
     XSelectInput(server.display, traywin->win, NoEventMask);
@@ -1502,10 +1512,8 @@ gboolean systray_on_monitor(int i_monitor, int n_panels)
 
 TrayWindow *systray_find_icon(Window win)
 {
-    for (GSList *l = systray.list_icons; l; l = l->next) {
-        TrayWindow *traywin = (TrayWindow *)l->data;
-        if (traywin->win == win || traywin->parent == win)
-            return traywin;
-    }
+    WindowTarget target = lookup_window(win);
+    if (target.role == WINDOW_TRAY_ICON || target.role == WINDOW_TRAY_PARENT)
+        return (TrayWindow *)target.object;
     return NULL;
 }
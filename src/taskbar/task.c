@@ -34,6 +34,8 @@
 #include "timer.h"
 #include "tooltip.h"
 #include "window.h"
+#include "window_prefetch.h"
+#include "window_registry.h"
 
 Timer urgent_timer;
 GSList *urgent_list;
@@ -42,6 +44,7 @@ void task_dump_geometry(void *obj, int indent);
 int task_compute_desired_size(void *obj);
 void task_refresh_thumbnail(Task *task);
 void task_get_content_color(void *obj, Color *color);
+void task_remove_icon(Task *task);
 
 char *task_get_tooltip(void *obj)
 {
@@ -96,9 +99,7 @@ Task *add_task(Window win)
     // allocate only one title and one icon
     // even with task_on_all_desktop and with task_on_all_panel
     task_template.title = NULL;
-    for (int k = 0; k < TASK_STATE_COUNT; ++k) {
-        task_template.icon[k] = NULL;
-    }
+    task_template.icon = NULL;
     task_update_title(&task_template);
     task_update_icon(&task_template);
     snprintf(task_template.area.name,
@@ -109,18 +110,9 @@ Task *add_task(Window win)
 
     // get application name
     // use res_class property of WM_CLASS as res_name is easily overridable by user
-    XClassHint *classhint = XAllocClassHint();
-    if (classhint && XGetClassHint(server.display, win, classhint))
-        task_template.application = strdup(classhint->res_class);
-    else
+    task_template.application = get_window_class(win);
+    if (!task_template.application)
         task_template.application = strdup("Untitled");
-    if (classhint) {
-        if (classhint->res_name)
-            XFree(classhint->res_name);
-        if (classhint->res_class)
-            XFree(classhint->res_class);
-        XFree(classhint);
-    }
 
     GPtrArray *task_buttons = g_ptr_array_new();
     for (int j = 0; j < panels[monitor].num_desktops; j++) {
@@ -155,11 +147,7 @@ Task *add_task(Window win)
         task_instance->icon_color = task_template.icon_color;
         task_instance->icon_color_hover = task_template.icon_color_hover;
         task_instance->icon_color_press = task_template.icon_color_press;
-        for (int k = 0; k < TASK_STATE_COUNT; ++k) {
-            task_instance->icon[k] = task_template.icon[k];
-            task_instance->icon_hover[k] = task_template.icon_hover[k];
-            task_instance->icon_press[k] = task_template.icon_press[k];
-        }
+        task_instance->icon = task_template.icon;
         task_instance->icon_width = task_template.icon_width;
         task_instance->icon_height = task_template.icon_height;
 
@@ -169,6 +157,7 @@ Task *add_task(Window win)
     Window *key = calloc(1, sizeof(Window));
     *key = task_template.win;
     g_hash_table_insert(win_to_task, key, task_buttons);
+    register_window(task_template.win, WINDOW_TASK, task_buttons);
 
     set_task_state((Task *)g_ptr_array_index(task_buttons, 0), task_template.current_state);
 
@@ -189,27 +178,74 @@ Task *add_task(Window win)
     return (Task *)g_ptr_array_index(task_buttons, 0);
 }
 
-void task_remove_icon(Task *task)
+typedef struct TaskIconVariant {
+    int alpha;
+    int saturation;
+    int brightness;
+    int mouse_alpha;
+    int mouse_saturation;
+    int mouse_brightness;
+    Imlib_Image image;
+} TaskIconVariant;
+
+static void free_task_icon_variant(gpointer data)
 {
-    if (!task)
-        return;
-    for (int k = 0; k < TASK_STATE_COUNT; ++k) {
-        if (task->icon[k]) {
-            imlib_context_set_image(task->icon[k]);
-            imlib_free_image();
-            task->icon[k] = 0;
-        }
-        if (task->icon_hover[k]) {
-            imlib_context_set_image(task->icon_hover[k]);
-            imlib_free_image();
-            task->icon_hover[k] = 0;
-        }
-        if (task->icon_press[k]) {
-            imlib_context_set_image(task->icon_press[k]);
-            imlib_free_image();
-            task->icon_press[k] = 0;
+    TaskIconVariant *variant = (TaskIconVariant *)data;
+    if (variant->image) {
+        imlib_context_set_image(variant->image);
+        imlib_free_image();
+    }
+    free(variant);
+}
+
+
+// Returns the icon adjusted for the current task state and mouse state, creating it if needed.
+static Imlib_Image get_task_icon_variant(Task *task)
+{
+    Panel *panel = (Panel *)task->area.panel;
+    TaskState state = task->current_state;
+    int alpha = panel->g_task.alpha[state];
+    int saturation = panel->g_task.saturation[state];
+    int brightness = panel->g_task.brightness[state];
+    int mouse_alpha = 100;
+    int mouse_saturation = 0;
+    int mouse_brightness = 0;
+    if (panel_config.mouse_effects) {
+        if (task->area.mouse_state == MOUSE_OVER) {
+            mouse_alpha = panel_config.mouse_over_alpha;
+            mouse_saturation = panel_config.mouse_over_saturation;
+            mouse_brightness = panel_config.mouse_over_brightness;
+        } else if (task->area.mouse_state == MOUSE_DOWN) {
+            mouse_alpha = panel_config.mouse_pressed_alpha;
+            mouse_saturation = panel_config.mouse_pressed_saturation;
+            mouse_brightness = panel_config.mouse_pressed_brightness;
         }
     }
+
+    for (GSList *l = task->icon->variants; l; l = l->next) {
+        TaskIconVariant *variant = (TaskIconVariant *)l->data;
+        if (variant->alpha == alpha && variant->saturation == saturation && variant->brightness == brightness &&
+            variant->mouse_alpha == mouse_alpha && variant->mouse_saturation == mouse_saturation &&
+            variant->mouse_brightness == mouse_brightness)
+            return variant->image;
+    }
+
+    TaskIconVariant *variant = (TaskIconVariant *)calloc(1, sizeof(TaskIconVariant));
+    variant->alpha = alpha;
+    variant->saturation = saturation;
+    variant->brightness = brightness;
+    variant->mouse_alpha = mouse_alpha;
+    variant->mouse_saturation = mouse_saturation;
+    variant->mouse_brightness = mouse_brightness;
+    variant->image = adjust_icon_twice(task->icon->original,
+                                       alpha,
+                                       saturation,
+                                       brightness,
+                                       mouse_alpha,
+                                       mouse_saturation,
+                                       mouse_brightness);
+    task->icon->variants = g_slist_prepend(task->icon->variants, variant);
+    return variant->image;
 }
 
 void remove_task(Task *task)
@@ -248,6 +284,7 @@ void remove_task(Task *task)
         remove_area((Area *)task2);
         free(task2);
     }
+    unregister_window(win, task_buttons);
     g_hash_table_remove(win_to_task, &win);
     if (hide_taskbar_if_empty)
         update_all_taskbars_visibility();
@@ -260,11 +297,11 @@ gboolean task_update_title(Task *task)
     if (!panel->g_task.has_text && !panel->g_task.tooltip_enabled && taskbar_sort_method != TASKBAR_SORT_TITLE)
         return FALSE;
 
-    char *name = server_get_property(task->win, server.atom._NET_WM_VISIBLE_NAME, server.atom.UTF8_STRING, 0);
+    char *name = get_window_property(task->win, server.atom._NET_WM_VISIBLE_NAME, server.atom.UTF8_STRING, 0);
     if (!name || !strlen(name)) {
-        name = server_get_property(task->win, server.atom._NET_WM_NAME, server.atom.UTF8_STRING, 0);
+        name = get_window_property(task->win, server.atom._NET_WM_NAME, server.atom.UTF8_STRING, 0);
         if (!name || !strlen(name)) {
-            name = server_get_property(task->win, server.atom.WM_NAME, XA_STRING, 0);
+            name = get_window_property(task->win, server.atom.WM_NAME, XA_STRING, 0);
         }
     }
 
@@ -299,34 +336,176 @@ gboolean task_update_title(Task *task)
     return TRUE;
 }
 
-Imlib_Image task_get_icon(Window win, int icon_size)
+// Maximum number of cached icons kept when no window uses them
+#define TASK_ICON_CACHE_UNUSED_MAX 32
+
+// TaskIcon * (cached) -> the same TaskIcon *
+static GHashTable *task_icon_cache = NULL;
+// Cached icons with a zero refcount, most recently used first
+static GQueue unused_task_icons = G_QUEUE_INIT;
+// Set during a restart, so that the icons released by the cleanup are all available to the new instance
+static gboolean task_icon_cache_keep_all = FALSE;
+static unsigned long task_icon_cache_hits = 0;
+static unsigned long task_icon_cache_misses = 0;
+
+static guint task_icon_hash(gconstpointer data)
+{
+    const TaskIcon *icon = (const TaskIcon *)data;
+    return (guint)(icon->hash ^ (icon->hash >> 32));
+}
+
+static gboolean task_icon_equal(gconstpointer a, gconstpointer b)
+{
+    const TaskIcon *ia = (const TaskIcon *)a;
+    const TaskIcon *ib = (const TaskIcon *)b;
+    return ia->hash == ib->hash && ia->source_width == ib->source_width && ia->source_height == ib->source_height &&
+           ia->icon_size == ib->icon_size;
+}
+
+static void free_task_icon(gpointer data)
+{
+    TaskIcon *icon = (TaskIcon *)data;
+    g_slist_free_full(icon->variants, free_task_icon_variant);
+    if (icon->original) {
+        imlib_context_set_image(icon->original);
+        imlib_free_image();
+    }
+    free(icon);
+}
+
+static void ref_task_icon(TaskIcon *icon)
+{
+    if (icon->unused_link) {
+        g_queue_delete_link(&unused_task_icons, icon->unused_link);
+        icon->unused_link = NULL;
+    }
+    icon->refcount++;
+}
+
+static void trim_task_icon_cache();
+
+static void unref_task_icon(TaskIcon *icon)
+{
+    if (--icon->refcount > 0)
+        return;
+    if (!icon->cached) {
+        free_task_icon(icon);
+        return;
+    }
+    g_queue_push_head(&unused_task_icons, icon);
+    icon->unused_link = unused_task_icons.head;
+    trim_task_icon_cache();
+}
+
+static void trim_task_icon_cache()
+{
+    if (task_icon_cache_keep_all)
+        return;
+    while (g_queue_get_length(&unused_task_icons) > TASK_ICON_CACHE_UNUSED_MAX) {
+        TaskIcon *oldest = (TaskIcon *)g_queue_pop_tail(&unused_task_icons);
+        g_hash_table_remove(task_icon_cache, oldest);
+    }
+}
+
+void task_icon_cache_keep_unused(gboolean keep)
+{
+    task_icon_cache_keep_all = keep;
+    trim_task_icon_cache();
+}
+
+void task_remove_icon(Task *task)
+{
+    if (!task || !task->icon)
+        return;
+    unref_task_icon(task->icon);
+    task->icon = NULL;
+}
+
+void cleanup_task_icon_cache()
+{
+    g_queue_clear(&unused_task_icons);
+    if (task_icon_cache) {
+        g_hash_table_destroy(task_icon_cache);
+        task_icon_cache = NULL;
+    }
+}
+
+// FNV-1a over the 32 bit pixels
+static guint64 hash_icon_data(const DATA32 *data, int count)
+{
+    guint64 hash = 14695981039346656037ULL;
+    for (int i = 0; i < count; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Creates the icon from an unscaled image, which it frees.
+static TaskIcon *create_task_icon(Imlib_Image img, int icon_size)
+{
+    TaskIcon *icon = (TaskIcon *)calloc(1, sizeof(TaskIcon));
+    icon->icon_size = icon_size;
+    get_image_mean_color(img, &icon->color);
+
+    imlib_context_set_image(img);
+    imlib_image_set_has_alpha(1);
+    int w = imlib_image_get_width();
+    int h = imlib_image_get_height();
+    icon->original = imlib_create_cropped_scaled_image(0, 0, w, h, icon_size, icon_size);
+    imlib_free_image();
+    return icon;
+}
+
+// Returns the icon of the window, scaled to icon_size. The caller must release it with unref_task_icon.
+TaskIcon *task_get_icon(Window win, int icon_size)
 {
     Imlib_Image img = NULL;
+    TaskIcon key = {.cached = TRUE, .icon_size = icon_size};
+
+    if (!task_icon_cache)
+        task_icon_cache = g_hash_table_new_full(task_icon_hash, task_icon_equal, NULL, free_task_icon);
 
     if (!img) {
-        int len;
-        gulong *data = server_get_property(win, server.atom._NET_WM_ICON, XA_CARDINAL, &len);
+        // get ARGB icon
+        int w, h;
+        DATA32 *data = get_window_icon(win, icon_size, &w, &h);
         if (data) {
-            if (len > 0) {
-                // get ARGB icon
-                int w, h;
-                gulong *tmp_data = get_best_icon(data, get_icon_count(data, len), len, &w, &h, icon_size);
-                if (tmp_data) {
-                    int array_size = w * h;
-                    // imlib needs the array in DATA32 type
-                    // using malloc for the array to protect from stack overflow
-                    DATA32 *icon_data = (DATA32*) g_try_malloc(sizeof(*icon_data) * array_size);
-                    if (icon_data) {
-                        for (int j = 0; j < array_size; ++j)
-                            icon_data[j] = tmp_data[j];
-                        img = imlib_create_image_using_copied_data(w, h, icon_data);
-                        g_free(icon_data);
-                    }
-                }
+            key.hash = hash_icon_data(data, w * h);
+            key.source_width = w;
+            key.source_height = h;
+            TaskIcon *icon = (TaskIcon *)g_hash_table_lookup(task_icon_cache, &key);
+            if (icon)
+                task_icon_cache_hits++;
+            else
+                task_icon_cache_misses++;
+            if (debug_icon_cache)
+                fprintf(stderr,
+                        "tint2: task icon cache %s for window %lu: %lu hits, %lu misses (%.1f%% hit rate)\n",
+                        icon ? "hit" : "miss",
+                        win,
+                        task_icon_cache_hits,
+                        task_icon_cache_misses,
+                        100.0 * task_icon_cache_hits / (task_icon_cache_hits + task_icon_cache_misses));
+            if (icon) {
+                XFree(data);
+                ref_task_icon(icon);
+                return icon;
             }
+            img = imlib_create_image_using_copied_data(w, h, data);
             XFree(data);
         }
     }
+    if (img) {
+        TaskIcon *icon = create_task_icon(img, icon_size);
+        icon->cached = TRUE;
+        icon->hash = key.hash;
+        icon->source_width = key.source_width;
+        icon->source_height = key.source_height;
+        g_hash_table_insert(task_icon_cache, icon, icon);
+        ref_task_icon(icon);
+        return icon;
+    }
 
     if (!img) {
         XWMHints *hints = XGetWMHints(server.display, win);
@@ -351,12 +530,15 @@ Imlib_Image task_get_icon(Window win, int icon_size)
         img = imlib_clone_image();
     }
 
-    return img;
+    // Icons from pixmaps and the default icon are not cached
+    TaskIcon *icon = create_task_icon(img, icon_size);
+    ref_task_icon(icon);
+    return icon;
 }
 
-void task_set_icon_color(Task *task, Imlib_Image icon)
+void task_set_icon_color(Task *task, const Color *color)
 {
-    get_image_mean_color(icon, &task->icon_color);
+    task->icon_color = *color;
     if (panel_config.mouse_effects) {
         task->icon_color_hover = task->icon_color;
         adjust_color(&task->icon_color_hover,
@@ -376,49 +558,22 @@ void task_update_icon(Task *task)
     Panel *panel = task->area.panel;
     if (!panel->g_task.has_icon) {
         if (panel_config.g_task.has_content_tint) {
-            Imlib_Image img = task_get_icon(task->win, panel->g_task.icon_size1);
-            task_set_icon_color(task, img);
-            imlib_context_set_image(img);
-            imlib_free_image();
+            TaskIcon *icon = task_get_icon(task->win, panel->g_task.icon_size1);
+            task_set_icon_color(task, &icon->color);
+            unref_task_icon(icon);
         }
         return;
     }
 
+    // Get the new icon before releasing the old one, which is often the same
+    TaskIcon *icon = task_get_icon(task->win, panel->g_task.icon_size1);
     task_remove_icon(task);
+    task->icon = icon;
+    task_set_icon_color(task, &icon->color);
 
-    Imlib_Image img = task_get_icon(task->win, panel->g_task.icon_size1);
-    task_set_icon_color(task, img);
-
-    // transform icons
-    imlib_context_set_image(img);
-    imlib_image_set_has_alpha(1);
-    int w = imlib_image_get_width();
-    int h = imlib_image_get_height();
-    Imlib_Image orig_image =
-        imlib_create_cropped_scaled_image(0, 0, w, h, panel->g_task.icon_size1, panel->g_task.icon_size1);
-    imlib_free_image();
-
-    imlib_context_set_image(orig_image);
+    imlib_context_set_image(icon->original);
     task->icon_width = imlib_image_get_width();
     task->icon_height = imlib_image_get_height();
-    for (int k = 0; k < TASK_STATE_COUNT; ++k) {
-        task->icon[k] = adjust_icon(orig_image,
-                                    panel->g_task.alpha[k],
-                                    panel->g_task.saturation[k],
-                                    panel->g_task.brightness[k]);
-        if (panel_config.mouse_effects) {
-            task->icon_hover[k] = adjust_icon(task->icon[k],
-                                              panel_config.mouse_over_alpha,
-                                              panel_config.mouse_over_saturation,
-                                              panel_config.mouse_over_brightness);
-            task->icon_press[k] = adjust_icon(task->icon[k],
-                                              panel_config.mouse_pressed_alpha,
-                                              panel_config.mouse_pressed_saturation,
-                                              panel_config.mouse_pressed_brightness);
-        }
-    }
-    imlib_context_set_image(orig_image);
-    imlib_free_image();
 
     GPtrArray *task_buttons = get_task_buttons(task->win);
     if (task_buttons) {
@@ -429,20 +584,16 @@ void task_update_icon(Task *task)
             task2->icon_color = task->icon_color;
             task2->icon_color_hover = task->icon_color_hover;
             task2->icon_color_press = task->icon_color_press;
-            for (int k = 0; k < TASK_STATE_COUNT; ++k) {
-                task2->icon[k] = task->icon[k];
-                task2->icon_hover[k] = task->icon_hover[k];
-                task2->icon_press[k] = task->icon_press[k];
-            }
+            task2->icon = task->icon;
             schedule_redraw(&task2->area);
         }
     }
 }
 
 // TODO icons look too large when the panel is large
-void draw_task_icon(Task *task, int text_width)
+void draw_task_icon(Task *task, int text_width, cairo_t *c)
 {
-    if (!task->icon[task->current_state])
+    if (!task->icon || !task->icon->original)
         return;
 
     // Find pos
@@ -458,22 +609,12 @@ void draw_task_icon(Task *task, int text_width)
 
     // Render
 
-    Imlib_Image image;
-    // Render
-    if (panel_config.mouse_effects) {
-        if (task->area.mouse_state == MOUSE_OVER)
-            image = task->icon_hover[task->current_state];
-        else if (task->area.mouse_state == MOUSE_DOWN)
-            image = task->icon_press[task->current_state];
-        else
-            image = task->icon[task->current_state];
-    } else {
-        image = task->icon[task->current_state];
-    }
-
+    Imlib_Image image = get_task_icon_variant(task);
+    if (!image)
+        return;
     imlib_context_set_image(image);
     task->_icon_y = (task->area.height - panel->g_task.icon_size1) / 2;
-    render_image(task->area.pix, task->_icon_x, task->_icon_y);
+    draw_area_image(&task->area, c, task->_icon_x, task->_icon_y);
 }
 
 void draw_task(void *obj, cairo_t *c)
@@ -483,34 +624,28 @@ void draw_task(void *obj, cairo_t *c)
 
     task->_text_width = 0;
     if (panel->g_task.has_text) {
-        PangoContext *context = pango_cairo_create_context(c);
-        pango_cairo_context_set_resolution(context, 96 * panel->scale);
-        PangoLayout *layout = pango_layout_new(context);
-        pango_layout_set_font_description(layout, panel->g_task.font_desc);
-        pango_layout_set_text(layout, task->title, -1);
-
-        pango_layout_set_width(layout, (((Taskbar *)task->area.parent)->text_width + TINT2_PANGO_SLACK) * PANGO_SCALE);
-        pango_layout_set_height(layout, panel->g_task.text_height * PANGO_SCALE);
-        pango_layout_set_wrap(layout, PANGO_WRAP_WORD_CHAR);
-        pango_layout_set_ellipsize(layout, PANGO_ELLIPSIZE_END);
-
-        if (panel->g_task.centered)
-            pango_layout_set_alignment(layout, PANGO_ALIGN_CENTER);
-        else
-            pango_layout_set_alignment(layout, PANGO_ALIGN_LEFT);
+        PangoLayout *layout =
+            update_text_layout(&task->area.text_layouts[0],
+                               panel->g_task.font_desc,
+                               task->title,
+                               FALSE,
+                               (((Taskbar *)task->area.parent)->text_width + TINT2_PANGO_SLACK) * PANGO_SCALE,
+                               panel->g_task.text_height * PANGO_SCALE,
+                               PANGO_WRAP_WORD_CHAR,
+                               PANGO_ELLIPSIZE_END,
+                               panel->g_task.centered ? PANGO_ALIGN_CENTER : PANGO_ALIGN_LEFT,
+                               panel->scale);
+        pango_cairo_update_layout(c, layout);
 
         pango_layout_get_pixel_size(layout, &task->_text_width, &task->_text_height);
         task->_text_posy = (panel->g_task.area.height - task->_text_height) / 2.0;
 
         Color *config_text = &panel->g_task.font[task->current_state];
         draw_text(layout, c, panel->g_task.text_posx, task->_text_posy, config_text, panel->font_shadow ? layout : NULL);
-
-        g_object_unref(layout);
-        g_object_unref(context);
     }
 
     if (panel->g_task.has_icon)
-        draw_task_icon(task, task->_text_width);
+        draw_task_icon(task, task->_text_width, c);
 }
 
 void task_dump_geometry(void *obj, int indent)
@@ -724,8 +859,7 @@ void set_task_state(Task *task, TaskState state)
             if (task_buttons) {
                 for (int i = 0; i < task_buttons->len; ++i) {
                     Task *task1 = g_ptr_array_index(task_buttons, i);
-                    Taskbar *taskbar = (Taskbar *)task1->area.parent;
-                    sort_tasks(taskbar);
+                    resort_task(task1);
                 }
             }
         }
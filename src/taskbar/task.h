@@ -51,6 +51,30 @@ typedef struct GlobalTask {
     int thumbnail_width;
 } GlobalTask;
 
+// The icon of a window, shared by all the Task instances of the window.
+// Icons read from _NET_WM_ICON are cached by content, so windows with the same icon share the same object.
+// Up to 32 of them are kept after they are no longer used; across a restart all of them are kept
+// (see task_icon_cache_keep_unused).
+typedef struct TaskIcon {
+    // Scaled to the icon size, without adjustments
+    Imlib_Image original;
+    // TaskIconVariant *, the adjusted icons for the task and mouse states, created when first drawn.
+    // States with the same alpha/saturation/brightness settings share a variant.
+    GSList *variants;
+    // The mean color of the icon, before scaling
+    Color color;
+    // Number of windows using the icon
+    int refcount;
+    // Cache key: hash and size of the image selected from _NET_WM_ICON, and the icon size
+    gboolean cached;
+    guint64 hash;
+    int source_width;
+    int source_height;
+    int icon_size;
+    // Position in the list of unused cached icons, if refcount is zero
+    GList *unused_link;
+} TaskIcon;
+
 // Stores information about a task.
 // Warning: any dynamically allocated members are shared between the Task instances created for the same window
 // (if the task appears on all desktops, there will be a different instance on each desktop's taskbar).
@@ -59,9 +83,7 @@ typedef struct Task {
     Window win;
     int desktop;
     TaskState current_state;
-    Imlib_Image icon[TASK_STATE_COUNT];
-    Imlib_Image icon_hover[TASK_STATE_COUNT];
-    Imlib_Image icon_press[TASK_STATE_COUNT];
+    TaskIcon *icon;
     unsigned int icon_width;
     unsigned int icon_height;
     Color icon_color;
@@ -95,6 +117,11 @@ void draw_task(void *obj, cairo_t *c);
 void on_change_task(void *obj);
 
 void task_update_icon(Task *task);
+// Releases the cached window icons. Call only once all the tasks have been removed.
+void cleanup_task_icon_cache();
+// While keep is set, the cached icons that are no longer used are not evicted. Used to carry all the icons over a
+// restart; once the restarted instance has picked up its icons, the cache is trimmed again.
+void task_icon_cache_keep_unused(gboolean keep);
 void task_update_desktop(Task *task);
 gboolean task_update_title(Task *task);
 void reset_active_task();
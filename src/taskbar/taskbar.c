@@ -30,6 +30,7 @@
 #include "taskbar.h"
 #include "server.h"
 #include "window.h"
+#include "window_prefetch.h"
 #include "panel.h"
 #include "strnatcmp.h"
 #include "tooltip.h"
@@ -50,8 +51,21 @@ Alignment taskbar_alignment;
 static Timer thumbnail_update_timer_all;
 static Timer thumbnail_update_timer_active;
 static Timer thumbnail_update_timer_tooltip;
-
-static GList *taskbar_task_orderings = NULL;
+// Window geometry changes are applied at most once per frame (at 60 Hz), e.g. while a window is dragged
+#define TASK_GEOMETRY_UPDATE_INTERVAL_MS 16
+static Timer task_geometry_timer;
+static double last_task_geometry_update = 0;
+// The windows whose tasks must be resorted or moved to another monitor after a geometry change:
+// Window -> TRUE if the position must be queried
+static GHashTable *pending_task_geometries = NULL;
+
+// The order of the tasks in each taskbar, saved before a restart to restore it afterwards.
+// Maps each window to the array of its positions in the saved taskbars (-1 if not in that taskbar).
+static GHashTable *taskbar_task_orderings = NULL;
+static int num_taskbar_task_orderings = 0;
+// Set while adding a batch of tasks: the taskbars are sorted once, after the batch
+static gboolean taskbar_sort_deferred = FALSE;
+static GList *taskbars_to_sort = NULL;
 static GList *taskbar_thumbnail_jobs_done = NULL;
 
 void taskbar_init_fonts();
@@ -98,32 +112,41 @@ void taskbar_clear_orderings()
 {
     if (!taskbar_task_orderings)
         return;
-    for (GList *order = taskbar_task_orderings; order; order = order->next) {
-        g_list_free_full((GList *)order->data, free);
-    }
-    g_list_free(taskbar_task_orderings);
+    g_hash_table_destroy(taskbar_task_orderings);
     taskbar_task_orderings = NULL;
+    num_taskbar_task_orderings = 0;
 }
 
 void taskbar_save_orderings()
 {
     taskbar_clear_orderings();
-    taskbar_task_orderings = NULL;
+    int num_orderings = 0;
+    for (int i = 0; i < num_panels; i++)
+        num_orderings += panels[i].num_desktops;
+    taskbar_task_orderings = g_hash_table_new_full(win_hash, win_compare, free, free);
+    num_taskbar_task_orderings = num_orderings;
+    int ordering = 0;
     for (int i = 0; i < num_panels; i++) {
         Panel *panel = &panels[i];
-        for (int j = 0; j < panel->num_desktops; j++) {
+        for (int j = 0; j < panel->num_desktops; j++, ordering++) {
             Taskbar *taskbar = &panel->taskbar[j];
-            GList *task_order = NULL;
+            int pos = 0;
             for (GList *c = (taskbar->area.children && taskbarname_enabled) ? taskbar->area.children->next
                                                                             : taskbar->area.children;
                  c;
-                 c = c->next) {
+                 c = c->next, pos++) {
                 Task *t = (Task *)c->data;
-                Window *window = calloc(1, sizeof(Window));
-                *window = t->win;
-                task_order = g_list_append(task_order, window);
+                int *positions = g_hash_table_lookup(taskbar_task_orderings, &t->win);
+                if (!positions) {
+                    Window *window = calloc(1, sizeof(Window));
+                    *window = t->win;
+                    positions = calloc(num_orderings, sizeof(int));
+                    for (int k = 0; k < num_orderings; k++)
+                        positions[k] = -1;
+                    g_hash_table_insert(taskbar_task_orderings, window, positions);
+                }
+                positions[ordering] = pos;
             }
-            taskbar_task_orderings = g_list_append(taskbar_task_orderings, task_order);
         }
     }
 }
@@ -133,6 +156,11 @@ void cleanup_taskbar()
     destroy_timer(&thumbnail_update_timer_all);
     destroy_timer(&thumbnail_update_timer_active);
     destroy_timer(&thumbnail_update_timer_tooltip);
+    destroy_timer(&task_geometry_timer);
+    if (pending_task_geometries) {
+        g_hash_table_destroy(pending_task_geometries);
+        pending_task_geometries = NULL;
+    }
     g_list_free(taskbar_thumbnail_jobs_done);
     taskbar_save_orderings();
     if (win_to_task) {
@@ -181,9 +209,16 @@ void cleanup_taskbar()
 void init_taskbar()
 {
     INIT_TIMER(urgent_timer);
+    set_timer_anchored(&urgent_timer, true);
+    set_timer_slack(&urgent_timer, 50);
     INIT_TIMER(thumbnail_update_timer_all);
+    set_timer_anchored(&thumbnail_update_timer_all, true);
+    set_timer_slack(&thumbnail_update_timer_all, 500);
     INIT_TIMER(thumbnail_update_timer_active);
+    set_timer_slack(&thumbnail_update_timer_active, 100);
     INIT_TIMER(thumbnail_update_timer_tooltip);
+    set_timer_slack(&thumbnail_update_timer_tooltip, 100);
+    INIT_TIMER(task_geometry_timer);
 
     if (!panel_config.g_task.has_text && !panel_config.g_task.has_icon) {
         panel_config.g_task.has_text = panel_config.g_task.has_icon = 1;
@@ -455,32 +490,24 @@ GPtrArray *get_task_buttons(Window win)
     return NULL;
 }
 
-static Window *sort_windows = NULL;
+// The saved positions of the windows being sorted, by index (NULL for the windows that were not saved)
+static int **sort_positions = NULL;
 
 int compare_windows(const void *a, const void *b)
 {
-    if (!sort_windows)
+    if (!sort_positions)
         return 0;
 
     int ia = *(int *)a;
     int ib = *(int *)b;
 
-    Window wina = sort_windows[ia];
-    Window winb = sort_windows[ib];
-
-    for (GList *order = taskbar_task_orderings; order; order = order->next) {
-        int posa = -1;
-        int posb = -1;
-        int pos = 0;
-        for (GList *item = (GList *)order->data; item; item = item->next, pos++) {
-            Window win = *(Window *)item->data;
-            if (win == wina)
-                posa = pos;
-            if (win == winb)
-                posb = pos;
-        }
-        if (posa >= 0 && posb >= 0) {
-            return posa - posb;
+    // Use the first saved taskbar that contains both windows
+    const int *posa = sort_positions[ia];
+    const int *posb = sort_positions[ib];
+    if (posa && posb) {
+        for (int i = 0; i < num_taskbar_task_orderings; i++) {
+            if (posa[i] >= 0 && posb[i] >= 0)
+                return posa[i] - posb[i];
         }
     }
 
@@ -490,9 +517,11 @@ int compare_windows(const void *a, const void *b)
 void sort_win_list(Window *windows, int count)
 {
     int *indices = (int *)calloc(count, sizeof(int));
-    for (int i = 0; i < count; i++)
+    sort_positions = (int **)calloc(count, sizeof(int *));
+    for (int i = 0; i < count; i++) {
         indices[i] = i;
-    sort_windows = windows;
+        sort_positions[i] = g_hash_table_lookup(taskbar_task_orderings, &windows[i]);
+    }
     qsort(indices, count, sizeof(int), compare_windows);
     Window *result = (Window *)calloc(count, sizeof(Window));
     for (int i = 0; i < count; i++)
@@ -500,7 +529,8 @@ void sort_win_list(Window *windows, int count)
     memcpy(windows, result, count * sizeof(Window));
     free(result);
     free(indices);
-    sort_windows = NULL;
+    free(sort_positions);
+    sort_positions = NULL;
 }
 
 void taskbar_refresh_tasklist()
@@ -510,30 +540,57 @@ void taskbar_refresh_tasklist()
 
     int num_results;
     Window *win = server_get_property(server.root_win, server.atom._NET_CLIENT_LIST, XA_WINDOW, &num_results);
+    if (!win)
+        return;
     Window *sorted = (Window *)calloc(num_results, sizeof(Window));
     memcpy(sorted, win, num_results * sizeof(Window));
     if (taskbar_task_orderings) {
         sort_win_list(sorted, num_results);
         taskbar_clear_orderings();
     }
-    if (!win)
-        return;
 
-    GList *win_list = g_hash_table_get_keys(win_to_task);
-    for (GList *it = win_list; it; it = it->next) {
-        int i;
-        for (i = 0; i < num_results; i++)
-            if (*((Window *)it->data) == sorted[i])
-                break;
-        if (i == num_results)
-            taskbar_remove_task(it->data);
+    // Diff the client list against the known tasks: the windows to add, in order, and the tasks to remove
+    GHashTable *client_list = g_hash_table_new(win_hash, win_compare);
+    Window *added = (Window *)calloc(num_results, sizeof(Window));
+    int num_added = 0;
+    for (int i = 0; i < num_results; i++) {
+        if (g_hash_table_contains(client_list, &sorted[i]))
+            continue;
+        g_hash_table_add(client_list, &sorted[i]);
+        if (!get_task(sorted[i]))
+            added[num_added++] = sorted[i];
     }
-    g_list_free(win_list);
 
-    // Add any new
-    for (int i = 0; i < num_results; i++)
-        if (!get_task(sorted[i]))
-            add_task(sorted[i]);
+    GArray *removed = g_array_new(FALSE, FALSE, sizeof(Window));
+    GHashTableIter iter;
+    gpointer key;
+    g_hash_table_iter_init(&iter, win_to_task);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        if (!g_hash_table_contains(client_list, key))
+            g_array_append_val(removed, *(Window *)key);
+    }
+    g_hash_table_destroy(client_list);
+
+    for (guint i = 0; i < removed->len; i++)
+        taskbar_remove_task(&g_array_index(removed, Window, i));
+    g_array_free(removed, TRUE);
+
+    // Add the new tasks, reading the properties of all the new windows in one batch.
+    // Removing tasks keeps the order, so only the taskbars that received tasks are sorted, once.
+    if (num_added > 0) {
+        gboolean need_icons = panels[0].g_task.has_icon || panel_config.g_task.has_content_tint;
+        prefetch_windows(added, num_added, need_icons ? panels[0].g_task.icon_size1 : 0);
+    }
+    taskbar_sort_deferred = TRUE;
+    for (int i = 0; i < num_added; i++)
+        add_task(added[i]);
+    taskbar_sort_deferred = FALSE;
+    clear_window_prefetch();
+    for (GList *l = taskbars_to_sort; l; l = l->next)
+        sort_tasks((Taskbar *)l->data);
+    g_list_free(taskbars_to_sort);
+    taskbars_to_sort = NULL;
+    free(added);
 
     XFree(win);
     free(sorted);
@@ -791,6 +848,49 @@ void sort_tasks(Taskbar *taskbar)
     ((Panel *)taskbar->area.panel)->area.resize_needed = TRUE;
 }
 
+static gboolean task_is_in_order(Task *task, GList *link, Taskbar *taskbar)
+{
+    return (!link->prev || compare_tasks(link->prev->data, task, taskbar) <= 0) &&
+           (!link->next || compare_tasks(task, link->next->data, taskbar) <= 0);
+}
+
+void resort_task(Task *task)
+{
+    Taskbar *taskbar = (Taskbar *)task->area.parent;
+    if (!taskbar || taskbar_sort_method == TASKBAR_NOSORT)
+        return;
+    GList *link = g_list_find(taskbar->area.children, task);
+    if (!link || task_is_in_order(task, link, taskbar))
+        return;
+
+    // Binary search for the new place among the other tasks, which are in order
+    taskbar->area.children = g_list_delete_link(taskbar->area.children, link);
+    guint count = g_list_length(taskbar->area.children);
+    GList **links = g_new(GList *, count + 1);
+    guint i = 0;
+    for (GList *l = taskbar->area.children; l; l = l->next)
+        links[i++] = l;
+    links[count] = NULL;
+    guint low = 0, high = count;
+    while (low < high) {
+        guint mid = low + (high - low) / 2;
+        if (compare_tasks(links[mid]->data, task, taskbar) <= 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    taskbar->area.children = g_list_insert_before(taskbar->area.children, links[low], task);
+    link = links[low] ? links[low]->prev : g_list_last(taskbar->area.children);
+    g_free(links);
+
+    // The center ordering is not transitive for overlapping windows, so the others may not have been in order
+    if (!task_is_in_order(task, link, taskbar))
+        taskbar->area.children = g_list_sort_with_data(taskbar->area.children, (GCompareDataFunc)compare_tasks, taskbar);
+    taskbar->area.resize_needed = TRUE;
+    schedule_panel_redraw();
+    ((Panel *)taskbar->area.panel)->area.resize_needed = TRUE;
+}
+
 void sort_taskbar_for_win(Window win)
 {
     if (taskbar_sort_method == TASKBAR_NOSORT)
@@ -798,18 +898,101 @@ void sort_taskbar_for_win(Window win)
 
     GPtrArray *task_buttons = get_task_buttons(win);
     if (task_buttons) {
-        Task *task0 = g_ptr_array_index(task_buttons, 0);
-        if (task0) {
-            get_window_coordinates(win, &task0->win_x, &task0->win_y, &task0->win_w, &task0->win_h);
-        }
         for (int i = 0; i < task_buttons->len; ++i) {
             Task *task = g_ptr_array_index(task_buttons, i);
-            task->win_x = task0->win_x;
-            task->win_y = task0->win_y;
-            task->win_w = task0->win_w;
-            task->win_h = task0->win_h;
-            sort_tasks(task->area.parent);
+            if (!taskbar_sort_deferred)
+                resort_task(task);
+            else if (!g_list_find(taskbars_to_sort, task->area.parent))
+                taskbars_to_sort = g_list_prepend(taskbars_to_sort, task->area.parent);
+        }
+    }
+}
+
+// Moves the tasks of a window that is now on another monitor to the right panel (or hides them, see
+// hide_task_diff_monitor). Returns FALSE if the tasks have been recreated.
+static gboolean update_task_monitor(Window win, Task *task)
+{
+    Panel *p = task->area.panel;
+    int monitor = get_monitor_for_geometry(task->win_x, task->win_y, task->win_w, task->win_h);
+    if ((hide_task_diff_monitor && p->monitor != monitor && task->area.on_screen) ||
+        (hide_task_diff_monitor && p->monitor == monitor && !task->area.on_screen) ||
+        (p->monitor != monitor && num_panels > 1)) {
+        remove_task(task);
+        task = add_task(win);
+        if (task && win == get_active_window()) {
+            set_task_state(task, TASK_ACTIVE);
+            active_task = task;
+        }
+        schedule_panel_redraw();
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void update_task_geometries(void *arg)
+{
+    last_task_geometry_update = get_time();
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, pending_task_geometries);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        Window win = *(Window *)key;
+        GPtrArray *task_buttons = get_task_buttons(win);
+        if (!task_buttons)
+            continue;
+        if (GPOINTER_TO_INT(value)) {
+            Task *task0 = g_ptr_array_index(task_buttons, 0);
+            get_window_coordinates(win, &task0->win_x, &task0->win_y, &task0->win_w, &task0->win_h);
+            for (int i = 1; i < task_buttons->len; ++i) {
+                Task *task = g_ptr_array_index(task_buttons, i);
+                task->win_x = task0->win_x;
+                task->win_y = task0->win_y;
+                task->win_w = task0->win_w;
+                task->win_h = task0->win_h;
+            }
+        }
+        if ((num_panels > 1 || hide_task_diff_monitor) &&
+            !update_task_monitor(win, g_ptr_array_index(task_buttons, 0)))
+            continue;
+        if (taskbar_sort_method == TASKBAR_SORT_CENTER)
+            sort_taskbar_for_win(win);
+    }
+    g_hash_table_remove_all(pending_task_geometries);
+}
+
+void taskbar_handle_configure_notify(XConfigureEvent *ev)
+{
+    GPtrArray *task_buttons = get_task_buttons(ev->window);
+    if (!task_buttons)
+        return;
+
+    // The position is relative to the root window only in the synthetic events sent by the window manager
+    // (ICCCM 4.1.5); otherwise it is relative to the frame and must be queried.
+    gboolean position_known = ev->send_event;
+    for (int i = 0; i < task_buttons->len; ++i) {
+        Task *task = g_ptr_array_index(task_buttons, i);
+        if (position_known) {
+            task->win_x = ev->x;
+            task->win_y = ev->y;
         }
+        task->win_w = ev->width + ev->border_width;
+        task->win_h = ev->height + ev->border_width;
+    }
+    if (taskbar_sort_method != TASKBAR_SORT_CENTER && num_panels <= 1 && !hide_task_diff_monitor)
+        return;
+
+    if (!pending_task_geometries)
+        pending_task_geometries = g_hash_table_new_full(win_hash, win_compare, free, NULL);
+    gboolean timer_pending = g_hash_table_size(pending_task_geometries) > 0;
+    gboolean query = !position_known || GPOINTER_TO_INT(g_hash_table_lookup(pending_task_geometries, &ev->window));
+    Window *key = calloc(1, sizeof(Window));
+    *key = ev->window;
+    g_hash_table_insert(pending_task_geometries, key, GINT_TO_POINTER(query));
+    if (!timer_pending) {
+        double elapsed_ms = (get_time() - last_task_geometry_update) * 1000;
+        int delay_ms = elapsed_ms >= TASK_GEOMETRY_UPDATE_INTERVAL_MS ? 0
+                                                                       : (int)(TASK_GEOMETRY_UPDATE_INTERVAL_MS - elapsed_ms);
+        change_timer(&task_geometry_timer, true, delay_ms, 0, update_task_geometries, NULL);
     }
 }
 
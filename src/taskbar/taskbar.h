@@ -99,11 +99,18 @@ void update_all_taskbars_visibility();
 
 void update_minimized_icon_positions(void *p);
 
-// Sorts the taskbar(s) on which the window is present.
+// Moves the tasks of the window to their place in the taskbar(s) on which the window is present.
 void sort_taskbar_for_win(Window win);
 
 void sort_tasks(Taskbar *taskbar);
 
+// Moves a task to its place in its taskbar, whose other tasks are assumed to be in order.
+void resort_task(Task *task);
+
+// Updates the geometry of the tasks of a window from a ConfigureNotify event.
+// With the center sort order, the tasks are resorted at most once per frame.
+void taskbar_handle_configure_notify(XConfigureEvent *ev);
+
 gboolean taskbar_is_under_mouse(void *obj, int x, int y);
 
 #endif
@@ -202,23 +202,21 @@ void draw_taskbarname(void *obj, cairo_t *c)
     Color *config_text = (taskbar->desktop == server.desktop) ? &taskbarname_active_font : &taskbarname_font;
 
     // draw content
-    PangoContext *context = pango_cairo_create_context(c);
-    pango_cairo_context_set_resolution(context, 96 * panel->scale);
-    PangoLayout *layout = pango_layout_new(context);
-    pango_layout_set_font_description(layout, panel_config.taskbarname_font_desc);
-    pango_layout_set_width(layout, taskbar_name->area.width * PANGO_SCALE);
-    pango_layout_set_alignment(layout, PANGO_ALIGN_CENTER);
-    pango_layout_set_wrap(layout, PANGO_WRAP_WORD_CHAR);
-    pango_layout_set_ellipsize(layout, PANGO_ELLIPSIZE_NONE);
-    pango_layout_set_text(layout, taskbar_name->name, strlen(taskbar_name->name));
+    PangoLayout *layout = update_text_layout(&taskbar_name->area.text_layouts[0],
+                                             panel_config.taskbarname_font_desc,
+                                             taskbar_name->name,
+                                             FALSE,
+                                             taskbar_name->area.width * PANGO_SCALE,
+                                             -1,
+                                             PANGO_WRAP_WORD_CHAR,
+                                             PANGO_ELLIPSIZE_NONE,
+                                             PANGO_ALIGN_CENTER,
+                                             panel->scale);
 
     cairo_set_source_rgba(c, config_text->rgb[0], config_text->rgb[1], config_text->rgb[2], config_text->alpha);
 
     pango_cairo_update_layout(c, layout);
     draw_text(layout, c, 0, taskbar_name->posy, config_text, ((Panel *)taskbar_name->area.panel)->font_shadow ? layout : NULL);
-
-    g_object_unref(layout);
-    g_object_unref(context);
 }
 
 void update_desktop_names()
@@ -113,6 +113,9 @@ GArray *executors;
 // Buttons
 GArray *buttons;
 
+// Metrics
+GArray *metrics_elements;
+
 // launcher
 
 GtkListStore *launcher_apps, *all_apps;
@@ -223,6 +226,7 @@ GtkWidget *create_properties()
     separators = g_array_new(FALSE, TRUE, sizeof(Separator));
     executors = g_array_new(FALSE, TRUE, sizeof(Executor));
     buttons = g_array_new(FALSE, TRUE, sizeof(Button));
+    metrics_elements = g_array_new(FALSE, TRUE, sizeof(Metrics));
 
     // global layer
     view = gtk_dialog_new();
@@ -1306,6 +1310,7 @@ void set_panel_items(const char *items)
     int separator_index = -1;
     int execp_index = -1;
     int button_index = -1;
+    int metrics_index = -1;
 
     for (; items && *items; items++) {
         const char *value = NULL;
@@ -1349,6 +1354,12 @@ void set_panel_items(const char *items)
             snprintf(buffer, sizeof(buffer), "%s %d", _("Button"), button_index + 1);
             name = buffer;
             value = "P";
+        } else if (v == 'M') {
+            metrics_index++;
+            buffer[0] = 0;
+            snprintf(buffer, sizeof(buffer), "%s %d", _("Metrics"), metrics_index + 1);
+            name = buffer;
+            value = "M";
         } else {
             continue;
         }
@@ -1387,6 +1398,7 @@ void panel_add_item(GtkWidget *widget, gpointer data)
     separator_update_indices();
     execp_update_indices();
     button_update_indices();
+    metrics_update_indices();
 }
 
 void panel_remove_item(GtkWidget *widget, gpointer data)
@@ -1424,6 +1436,14 @@ void panel_remove_item(GtkWidget *widget, gpointer data)
                     break;
                 }
             }
+        } else if (g_str_equal(value, "M")) {
+            for (int i = 0; i < metrics_elements->len; i++) {
+                Metrics *metrics = &g_array_index(metrics_elements, Metrics, i);
+                if (g_str_equal(name, metrics->name)) {
+                    metrics_remove(i);
+                    break;
+                }
+            }
         }
 
         gtk_list_store_remove(panel_items, &iter);
@@ -1432,6 +1452,7 @@ void panel_remove_item(GtkWidget *widget, gpointer data)
     separator_update_indices();
     execp_update_indices();
     button_update_indices();
+    metrics_update_indices();
 }
 
 void panel_move_item_down(GtkWidget *widget, gpointer data)
@@ -1494,6 +1515,21 @@ void panel_move_item_down(GtkWidget *widget, gpointer data)
                 Button tmp = *button1;
                 *button1 = *button2;
                 *button2 = tmp;
+            } else if (g_str_equal(value1, "M") && g_str_equal(value2, "M")) {
+                Metrics *metrics1 = NULL;
+                Metrics *metrics2 = NULL;
+                for (int i = 0; i < metrics_elements->len; i++) {
+                    Metrics *metrics = &g_array_index(metrics_elements, Metrics, i);
+                    if (g_str_equal(name1, metrics->name)) {
+                        metrics1 = metrics;
+                    }
+                    if (g_str_equal(name2, metrics->name)) {
+                        metrics2 = metrics;
+                    }
+                }
+                Metrics tmp = *metrics1;
+                *metrics1 = *metrics2;
+                *metrics2 = tmp;
             }
 
             gtk_list_store_swap(panel_items, &iter, &next);
@@ -1502,6 +1538,7 @@ void panel_move_item_down(GtkWidget *widget, gpointer data)
     separator_update_indices();
     execp_update_indices();
     button_update_indices();
+    metrics_update_indices();
 }
 
 void panel_move_item_up(GtkWidget *widget, gpointer data)
@@ -1567,6 +1604,21 @@ void panel_move_item_up(GtkWidget *widget, gpointer data)
                     Button tmp = *button1;
                     *button1 = *button2;
                     *button2 = tmp;
+                } else if (g_str_equal(value1, "M") && g_str_equal(value2, "M")) {
+                    Metrics *metrics1 = NULL;
+                    Metrics *metrics2 = NULL;
+                    for (int i = 0; i < metrics_elements->len; i++) {
+                        Metrics *metrics = &g_array_index(metrics_elements, Metrics, i);
+                        if (g_str_equal(name1, metrics->name)) {
+                            metrics1 = metrics;
+                        }
+                        if (g_str_equal(name2, metrics->name)) {
+                            metrics2 = metrics;
+                        }
+                    }
+                    Metrics tmp = *metrics1;
+                    *metrics1 = *metrics2;
+                    *metrics2 = tmp;
                 }
 
                 gtk_list_store_swap(panel_items, &iter, &prev);
@@ -1576,6 +1628,7 @@ void panel_move_item_up(GtkWidget *widget, gpointer data)
     separator_update_indices();
     execp_update_indices();
     button_update_indices();
+    metrics_update_indices();
 }
 
 enum { iconsColName = 0, iconsColDescr, iconsNumCols };
@@ -4302,6 +4355,22 @@ void create_execp(GtkWidget *notebook, int i)
     col++;
     gtk_widget_set_tooltip_text(executor->execp_command, _("Specifies the command to execute."));
 
+    row++, col = 2;
+    label = gtk_label_new(_("Socket"));
+    gtk_misc_set_alignment(GTK_MISC(label), 0, 0);
+    gtk_widget_show(label);
+    gtk_table_attach(GTK_TABLE(table), label, col, col + 1, row, row + 1, GTK_FILL, 0, 0, 0);
+    col++;
+
+    executor->execp_socket = gtk_entry_new();
+    gtk_widget_show(executor->execp_socket);
+    gtk_entry_set_width_chars(GTK_ENTRY(executor->execp_socket), 50);
+    gtk_table_attach(GTK_TABLE(table), executor->execp_socket, col, col + 1, row, row + 1, GTK_FILL, 0, 0, 0);
+    col++;
+    gtk_widget_set_tooltip_text(executor->execp_socket,
+                                _("Optional. Specifies a UNIX socket (or an existing FIFO) on which other programs "
+                                  "can send updates, instead of running a command."));
+
     row++, col = 2;
     label = gtk_label_new(_("Interval"));
     gtk_misc_set_alignment(GTK_MISC(label), 0, 0);
@@ -5184,6 +5253,59 @@ void button_update_indices()
     }
 }
 
+void metrics_create_new()
+{
+    g_array_set_size(metrics_elements, metrics_elements->len + 1);
+    Metrics *metrics = &g_array_index(metrics_elements, Metrics, metrics_elements->len - 1);
+    snprintf(metrics->name, sizeof(metrics->name), "%s %d", _("Metrics"), metrics_elements->len);
+    metrics->config = g_string_new("");
+}
+
+Metrics *metrics_get_last()
+{
+    if (metrics_elements->len <= 0)
+        metrics_create_new();
+    return &g_array_index(metrics_elements, Metrics, metrics_elements->len - 1);
+}
+
+void metrics_remove(int i)
+{
+    Metrics *metrics = &g_array_index(metrics_elements, Metrics, i);
+    g_string_free(metrics->config, TRUE);
+    metrics_elements = g_array_remove_index(metrics_elements, i);
+}
+
+void metrics_update_indices()
+{
+    for (int i = 0; i < metrics_elements->len; i++) {
+        Metrics *metrics = &g_array_index(metrics_elements, Metrics, i);
+        snprintf(metrics->name, sizeof(metrics->name), "%s %d", _("Metrics"), i + 1);
+    }
+
+    GtkTreeModel *model = GTK_TREE_MODEL(panel_items);
+    GtkTreeIter iter;
+    if (!gtk_tree_model_get_iter_first(model, &iter))
+        return;
+    int metrics_index = -1;
+    while (1) {
+        gchar *name;
+        gchar *value;
+        gtk_tree_model_get(model, &iter, itemsColName, &name, itemsColValue, &value, -1);
+
+        if (g_str_equal(value, "M")) {
+            metrics_index++;
+            char buffer[256];
+            buffer[0] = 0;
+            snprintf(buffer, sizeof(buffer), "%s %d", _("Metrics"), metrics_index + 1);
+
+            gtk_list_store_set(panel_items, &iter, itemsColName, buffer, -1);
+        }
+
+        if (!gtk_tree_model_iter_next(model, &iter))
+            break;
+    }
+}
+
 void create_systemtray(GtkWidget *parent)
 {
     GtkWidget *table;
@@ -133,7 +133,7 @@ typedef struct Executor {
     GtkWidget *page_execp;
     GtkWidget *page_label;
     GtkWidget *execp_name;
-    GtkWidget *execp_command, *execp_interval, *execp_has_icon, *execp_cache_icon, *execp_show_tooltip;
+    GtkWidget *execp_command, *execp_socket, *execp_interval, *execp_has_icon, *execp_cache_icon, *execp_show_tooltip;
     GtkWidget *execp_continuous, *execp_markup, *execp_tooltip, *execp_monitor;
     GtkWidget *execp_left_command, *execp_right_command;
     GtkWidget *execp_mclick_command, *execp_rclick_command, *execp_uwheel_command, *execp_dwheel_command;
@@ -159,6 +159,16 @@ typedef struct Button {
 
 extern GArray *buttons;
 
+// Metrics
+// There is no page to edit the metrics elements; their settings are kept as read, so that saving does not lose them.
+typedef struct Metrics {
+    char name[256];
+    // The metrics_* lines of the element, in the order they were read
+    GString *config;
+} Metrics;
+
+extern GArray *metrics_elements;
+
 // launcher
 
 enum { appsColIcon = 0, appsColIconName, appsColText, appsColPath, appsNumCols };
@@ -249,6 +259,11 @@ Button *button_get_last();
 void button_remove(int i);
 void button_update_indices();
 
+void metrics_create_new();
+Metrics *metrics_get_last();
+void metrics_remove(int i);
+void metrics_update_indices();
+
 void create_please_wait(GtkWindow *parent);
 void process_events();
 void destroy_please_wait();
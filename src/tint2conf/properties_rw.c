@@ -860,6 +860,8 @@ void config_write_execp(FILE *fp)
         fprintf(fp, "execp = new\n");
         fprintf(fp, "execp_name = %s\n", gtk_entry_get_text(GTK_ENTRY(executor->execp_name)));
         fprintf(fp, "execp_command = %s\n", gtk_entry_get_text(GTK_ENTRY(executor->execp_command)));
+        if (strlen(gtk_entry_get_text(GTK_ENTRY(executor->execp_socket))) > 0)
+            fprintf(fp, "execp_socket = %s\n", gtk_entry_get_text(GTK_ENTRY(executor->execp_socket)));
         fprintf(fp, "execp_interval = %d\n", (int)gtk_spin_button_get_value(GTK_SPIN_BUTTON(executor->execp_interval)));
         fprintf(fp,
                 "execp_has_icon = %d\n",
@@ -966,6 +968,20 @@ void config_write_button(FILE *fp)
     }
 }
 
+void config_write_metrics(FILE *fp)
+{
+    for (int i = 0; i < metrics_elements->len; i++) {
+        fprintf(fp, "#-------------------------------------\n");
+        fprintf(fp, "# Metrics %d\n", i + 1);
+
+        Metrics *metrics = &g_array_index(metrics_elements, Metrics, i);
+
+        fprintf(fp, "metrics = new\n");
+        fputs(metrics->config->str, fp);
+        fprintf(fp, "\n");
+    }
+}
+
 void config_write_tooltip(FILE *fp)
 {
     fprintf(fp, "#-------------------------------------\n");
@@ -1040,6 +1056,7 @@ void config_save_file(const char *path)
     config_write_separator(fp);
     config_write_execp(fp);
     config_write_button(fp);
+    config_write_metrics(fp);
     config_write_tooltip(fp);
 
     checksum = checksum_txt(fp);
@@ -1961,6 +1978,13 @@ void add_entry(char *key, char *value)
             gtk_spin_button_set_value(GTK_SPIN_BUTTON(separator_get_last()->separator_padding_y), atoi(value2));
     }
 
+    /* Metrics */
+    else if (strcmp(key, "metrics") == 0) {
+        metrics_create_new();
+    } else if (g_str_has_prefix(key, "metrics_")) {
+        g_string_append_printf(metrics_get_last()->config, "%s = %s\n", key, value);
+    }
+
     /* Executor */
     else if (strcmp(key, "execp") == 0) {
         execp_create_new();
@@ -1968,6 +1992,8 @@ void add_entry(char *key, char *value)
         gtk_entry_set_text(GTK_ENTRY(execp_get_last()->execp_name), value);
     } else if (strcmp(key, "execp_command") == 0) {
         gtk_entry_set_text(GTK_ENTRY(execp_get_last()->execp_command), value);
+    } else if (strcmp(key, "execp_socket") == 0) {
+        gtk_entry_set_text(GTK_ENTRY(execp_get_last()->execp_socket), value);
     } else if (strcmp(key, "execp_interval") == 0) {
         gtk_spin_button_set_value(GTK_SPIN_BUTTON(execp_get_last()->execp_interval), atoi(value));
     } else if (strcmp(key, "execp_has_icon") == 0) {
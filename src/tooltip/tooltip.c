@@ -26,8 +26,11 @@
 #include "tooltip.h"
 #include "panel.h"
 #include "timer.h"
+#include "shm_image.h"
+#include "window_registry.h"
 
 static int x, y, width, height;
+static int text_ink_x, text_ink_y;
 static gboolean just_shown;
 
 // the next functions are helper functions for tooltip handling
@@ -61,11 +64,16 @@ void cleanup_tooltip()
     destroy_timer(&g_tooltip.update_timer);
     tooltip_hide(NULL);
     tooltip_update_contents_for(NULL);
-    if (g_tooltip.window)
+    if (g_tooltip.window) {
+        unregister_window(g_tooltip.window, &g_tooltip);
         XDestroyWindow(server.display, g_tooltip.window);
+    }
     g_tooltip.window = 0;
     pango_font_description_free(g_tooltip.font_desc);
     g_tooltip.font_desc = NULL;
+    free_text_layout(&g_tooltip.text_layout);
+    free_text_layout(&g_tooltip.measure_layout);
+    free_text_layout(&g_tooltip.reference_layout);
 }
 
 void init_tooltip()
@@ -81,8 +89,10 @@ void init_tooltip()
     attr.background_pixel = 0;
     attr.border_pixel = 0;
     unsigned long mask = CWEventMask | CWColormap | CWBorderPixel | CWBackPixel | CWOverrideRedirect;
-    if (g_tooltip.window)
+    if (g_tooltip.window) {
+        unregister_window(g_tooltip.window, &g_tooltip);
         XDestroyWindow(server.display, g_tooltip.window);
+    }
     g_tooltip.window = XCreateWindow(server.display,
                                      server.root_win,
                                      0,
@@ -95,6 +105,7 @@ void init_tooltip()
                                      server.visual,
                                      mask,
                                      &attr);
+    register_window(g_tooltip.window, WINDOW_TOOLTIP, &g_tooltip);
 }
 
 void tooltip_init_fonts()
@@ -151,25 +162,34 @@ void tooltip_update_geometry()
     Panel *panel = g_tooltip.panel;
     int screen_width = server.monitors[panel->monitor].width;
 
-    cairo_surface_t *cs = cairo_xlib_surface_create(server.display, g_tooltip.window, server.visual, width, height);
-    cairo_t *c = cairo_create(cs);
-    PangoContext *context = pango_cairo_create_context(c);
-    pango_cairo_context_set_resolution(context, 96 * panel->scale);
-    PangoLayout *layout = pango_layout_new(context);
-
-    pango_layout_set_font_description(layout, g_tooltip.font_desc);
+    PangoLayout *layout = update_text_layout(&g_tooltip.reference_layout,
+                                             g_tooltip.font_desc,
+                                             "1234567890abcdef",
+                                             FALSE,
+                                             -1,
+                                             -1,
+                                             PANGO_WRAP_WORD,
+                                             PANGO_ELLIPSIZE_NONE,
+                                             PANGO_ALIGN_LEFT,
+                                             panel->scale);
     PangoRectangle r1, r2;
-    pango_layout_set_text(layout, "1234567890abcdef", -1);
     pango_layout_get_pixel_extents(layout, &r1, &r2);
     int max_width = MIN(r2.width * 5, screen_width * 2 / 3);
     if (g_tooltip.image && cairo_image_surface_get_width(g_tooltip.image) > 0) {
         max_width = left_right_bg_border_width(g_tooltip.bg) + 2 * g_tooltip.paddingx * panel->scale +
                                 cairo_image_surface_get_width(g_tooltip.image);
     }
-    pango_layout_set_width(layout, max_width * PANGO_SCALE);
 
-    pango_layout_set_text(layout, g_tooltip.tooltip_text ? g_tooltip.tooltip_text : "1234567890abcdef", -1);
-    pango_layout_set_wrap(layout, PANGO_WRAP_WORD);
+    layout = update_text_layout(&g_tooltip.measure_layout,
+                                g_tooltip.font_desc,
+                                g_tooltip.tooltip_text ? g_tooltip.tooltip_text : "1234567890abcdef",
+                                FALSE,
+                                max_width * PANGO_SCALE,
+                                -1,
+                                PANGO_WRAP_WORD,
+                                PANGO_ELLIPSIZE_NONE,
+                                PANGO_ALIGN_LEFT,
+                                panel->scale);
     pango_layout_get_pixel_extents(layout, &r1, &r2);
     width = left_right_bg_border_width(g_tooltip.bg) + 2 * g_tooltip.paddingx * panel->scale + r2.width;
     height = top_bottom_bg_border_width(g_tooltip.bg) + 2 * g_tooltip.paddingy * panel->scale + r2.height;
@@ -188,10 +208,9 @@ void tooltip_update_geometry()
     else
         x = panel->posx - width;
 
-    g_object_unref(layout);
-    g_object_unref(context);
-    cairo_destroy(c);
-    cairo_surface_destroy(cs);
+    // Ink offsets used to center the text when drawing
+    text_ink_x = r1.x;
+    text_ink_y = r1.y;
 }
 
 void tooltip_adjust_geometry()
@@ -258,12 +277,17 @@ void tooltip_update()
     XMoveResizeWindow(server.display, g_tooltip.window, x, y, width, height);
 
     // Stuff for drawing the tooltip
-    cairo_surface_t *cs = cairo_xlib_surface_create(server.display, g_tooltip.window, server.visual, width, height);
+    // With client-side rendering, the tooltip is drawn in memory and uploaded in one go
+    cairo_surface_t *cs = client_side_rendering
+                              ? create_client_side_surface(width, height)
+                              : cairo_xlib_surface_create(server.display, g_tooltip.window, server.visual, width, height);
     cairo_t *c = cairo_create(cs);
     Color bc = g_tooltip.bg->fill_color;
     Border b = g_tooltip.bg->border;
     if (server.real_transparency) {
-        clear_pixmap(g_tooltip.window, 0, 0, width, height);
+        // Image surfaces start out transparent
+        if (!client_side_rendering)
+            clear_pixmap(g_tooltip.window, 0, 0, width, height);
         draw_rect(c, b.width, b.width, width - 2 * b.width, height - 2 * b.width, b.radius - b.width / 1.571);
         cairo_set_source_rgba(c, bc.rgb[0], bc.rgb[1], bc.rgb[2], bc.alpha);
     } else {
@@ -281,25 +305,23 @@ void tooltip_update()
 
     Color fc = g_tooltip.font_color;
     cairo_set_source_rgba(c, fc.rgb[0], fc.rgb[1], fc.rgb[2], fc.alpha);
-    PangoContext *context = pango_cairo_create_context(c);
-    pango_cairo_context_set_resolution(context, 96 * panel->scale);
-    PangoLayout *layout = pango_layout_new(context);
-    pango_layout_set_font_description(layout, g_tooltip.font_desc);
-    pango_layout_set_wrap(layout, PANGO_WRAP_WORD);
-    pango_layout_set_text(layout, g_tooltip.tooltip_text, -1);
-    PangoRectangle r1, r2;
-    pango_layout_get_pixel_extents(layout, &r1, &r2);
-    pango_layout_set_width(layout, width * PANGO_SCALE);
-    pango_layout_set_height(layout, height * PANGO_SCALE);
-    pango_layout_set_ellipsize(layout, PANGO_ELLIPSIZE_END);
+    PangoLayout *layout = update_text_layout(&g_tooltip.text_layout,
+                                             g_tooltip.font_desc,
+                                             g_tooltip.tooltip_text,
+                                             FALSE,
+                                             width * PANGO_SCALE,
+                                             height * PANGO_SCALE,
+                                             PANGO_WRAP_WORD,
+                                             PANGO_ELLIPSIZE_END,
+                                             PANGO_ALIGN_LEFT,
+                                             panel->scale);
     // I do not know why this is the right way, but with the below cairo_move_to it seems to be centered (horiz. and
     // vert.)
     cairo_move_to(c,
-                  -r1.x / 2 + left_bg_border_width(g_tooltip.bg) + g_tooltip.paddingx * panel->scale,
-                  -r1.y / 2 + 1 + top_bg_border_width(g_tooltip.bg) + g_tooltip.paddingy * panel->scale);
+                  -text_ink_x / 2 + left_bg_border_width(g_tooltip.bg) + g_tooltip.paddingx * panel->scale,
+                  -text_ink_y / 2 + 1 + top_bg_border_width(g_tooltip.bg) + g_tooltip.paddingy * panel->scale);
+    pango_cairo_update_layout(c, layout);
     pango_cairo_show_layout(c, layout);
-    g_object_unref(layout);
-    g_object_unref(context);
 
     if (g_tooltip.image) {
         cairo_translate(c,
@@ -310,6 +332,8 @@ void tooltip_update()
     }
 
     cairo_destroy(c);
+    if (client_side_rendering)
+        put_surface_to_drawable(cs, g_tooltip.window, server.gc, NULL);
     cairo_surface_destroy(cs);
 }
 
@@ -39,6 +39,13 @@ typedef struct {
     Timer visibility_timer;
     Timer update_timer;
     cairo_surface_t *image;
+    // Layout of the tooltip text, kept between updates
+    TextLayout text_layout;
+    // Layout of the tooltip text used to compute the geometry. It is separate from text_layout, since the two are
+    // configured with different sizes and ellipsization and would otherwise rebuild each other on every update.
+    TextLayout measure_layout;
+    // Layout of a sample text, used to compute the maximum width
+    TextLayout reference_layout;
 } Tooltip;
 
 extern Tooltip g_tooltip;
@@ -32,6 +32,7 @@
 #include "server.h"
 #include "panel.h"
 #include "common.h"
+#include "shm_image.h"
 
 Area *mouse_over_area = NULL;
 
@@ -341,56 +342,107 @@ int relayout_with_constraint(Area *a, int maximum_size)
     return 0;
 }
 
+// Frees the pixmaps (and surfaces) of all mouse states
+static void free_area_pixmaps(Area *a)
+{
+    for (int i = 0; i < MOUSE_STATE_COUNT; i++) {
+        XFreePixmap(server.display, a->pix_by_state[i]);
+        if (a->pix == a->pix_by_state[i])
+            a->pix = None;
+        a->pix_by_state[i] = None;
+        if (a->surface_by_state[i])
+            cairo_surface_destroy(a->surface_by_state[i]);
+        a->surface_by_state[i] = NULL;
+    }
+    if (a->pix) {
+        XFreePixmap(server.display, a->pix);
+        a->pix = None;
+    }
+    a->surface = NULL;
+}
+
 void schedule_redraw(Area *a)
 {
     a->_redraw_needed = TRUE;
 
-    if (a->has_mouse_over_effect) {
-        for (int i = 0; i < MOUSE_STATE_COUNT; i++) {
-            XFreePixmap(server.display, a->pix_by_state[i]);
-            if (a->pix == a->pix_by_state[i])
-                a->pix = None;
-            a->pix_by_state[i] = None;
-        }
-        if (a->pix) {
-            XFreePixmap(server.display, a->pix);
-            a->pix = None;
-        }
-    }
+    if (a->has_mouse_over_effect)
+        free_area_pixmaps(a);
 
     for (GList *l = a->children; l; l = l->next)
         schedule_redraw((Area *)l->data);
     schedule_panel_redraw();
 }
 
+void collect_damage(Area *a)
+{
+    if (!a->on_screen)
+        return;
+
+    if (a->_redraw_needed || a->pix != a->_last_pix || a->surface != a->_last_surface || a->posx != a->_last_x || a->posy != a->_last_y ||
+        a->width != a->_last_width || a->height != a->_last_height) {
+        Panel *panel = (Panel *)a->panel;
+        damage_panel(panel, a->_last_x, a->_last_y, a->_last_width, a->_last_height);
+        damage_panel(panel, a->posx, a->posy, a->width, a->height);
+        a->_last_x = a->posx;
+        a->_last_y = a->posy;
+        a->_last_width = a->width;
+        a->_last_height = a->height;
+    }
+
+    for (GList *l = a->children; l; l = l->next)
+        collect_damage((Area *)l->data);
+}
+
 void draw_tree(Area *a)
 {
     if (!a->on_screen)
         return;
 
+    // Children are laid out inside their parent, so an untouched Area has an untouched subtree
+    Panel *panel = (Panel *)a->panel;
+    if (!panel_damaged(panel, a->posx, a->posy, a->width, a->height))
+        return;
+
     if (a->_redraw_needed) {
         a->_redraw_needed = FALSE;
         draw(a);
     }
-
-    if (a->pix)
-        XCopyArea(server.display,
-                  a->pix,
-                  ((Panel *)a->panel)->temp_pmap,
-                  server.gc,
-                  0,
-                  0,
-                  a->width,
-                  a->height,
-                  a->posx,
-                  a->posy);
-    else
+    a->_last_pix = a->pix;
+    a->_last_surface = a->surface;
+
+    // Only the damaged part of the back buffer is out of date
+    if (client_side_rendering && a->surface) {
+        cairo_t *c = cairo_create(panel->back_surface);
+        clip_cairo_to_damage(panel, c);
+        cairo_set_operator(c, CAIRO_OPERATOR_SOURCE);
+        cairo_set_source_surface(c, a->surface, a->posx, a->posy);
+        cairo_rectangle(c, a->posx, a->posy, a->width, a->height);
+        cairo_fill(c);
+        cairo_destroy(c);
+    } else if (!client_side_rendering && a->pix) {
+        clip_gc_to_damage(panel, server.gc);
+        XCopyArea(server.display, a->pix, panel->temp_pmap, server.gc, 0, 0, a->width, a->height, a->posx, a->posy);
+        XSetClipMask(server.display, server.gc, None);
+    } else {
         fprintf(stderr, RED "tint2: %s %d: area %s has no pixmap!!!" RESET "\n", __FILE__, __LINE__, a->name);
+    }
 
     for (GList *l = a->children; l; l = l->next)
         draw_tree((Area *)l->data);
 }
 
+// Marks the rectangle last covered by the Area as damaged, so that it gets repainted
+static void damage_last_blit(Area *a)
+{
+    if (a->panel)
+        damage_panel((Panel *)a->panel, a->_last_x, a->_last_y, a->_last_width, a->_last_height);
+    a->_last_pix = None;
+    a->_last_surface = NULL;
+    a->_last_width = a->_last_height = 0;
+    for (GList *l = a->children; l; l = l->next)
+        damage_last_blit((Area *)l->data);
+}
+
 void hide(Area *a)
 {
     Area *parent = (Area *)a->parent;
@@ -398,6 +450,7 @@ void hide(Area *a)
     if (!a->on_screen)
         return;
     a->on_screen = FALSE;
+    damage_last_blit(a);
     if (parent)
         parent->resize_needed = TRUE;
     if (panel_horizontal)
@@ -435,21 +488,45 @@ void update_dependent_gradients(Area *a)
         update_dependent_gradients((Area *)l->data);
 }
 
+// Replaces the image surface of the current mouse state with a new one, of the format of the back buffer
+static cairo_surface_t *create_area_surface(Area *a)
+{
+    int state = a->has_mouse_over_effect ? a->mouse_state : 0;
+    if (a->surface_by_state[state])
+        cairo_surface_destroy(a->surface_by_state[state]);
+    a->surface = create_client_side_surface(a->width, a->height);
+    a->surface_by_state[state] = a->surface;
+    return a->surface;
+}
+
+// Draws the Area client-side, on top of the part of the panel back buffer it covers
+static void draw_on_surface(Area *a)
+{
+    cairo_t *c = cairo_create(create_area_surface(a));
+
+    cairo_set_operator(c, CAIRO_OPERATOR_SOURCE);
+    cairo_set_source_surface(c, ((Panel *)a->panel)->back_surface, -a->posx, -a->posy);
+    cairo_paint(c);
+    cairo_set_operator(c, CAIRO_OPERATOR_OVER);
+
+    draw_background(a, c);
+
+    if (a->_draw_foreground)
+        a->_draw_foreground(a, c);
+
+    cairo_destroy(c);
+}
+
 void draw(Area *a)
 {
     if (a->_changed) {
         // On resize/move, invalidate cached pixmaps
-        for (int i = 0; i < MOUSE_STATE_COUNT; i++) {
-            XFreePixmap(server.display, a->pix_by_state[i]);
-            if (a->pix == a->pix_by_state[i]) {
-                a->pix = None;
-            }
-            a->pix_by_state[i] = None;
-        }
-        if (a->pix) {
-            XFreePixmap(server.display, a->pix);
-            a->pix = None;
-        }
+        free_area_pixmaps(a);
+    }
+
+    if (client_side_rendering && !a->_clear) {
+        draw_on_surface(a);
+        return;
     }
 
     if (a->pix) {
@@ -487,9 +564,27 @@ void draw(Area *a)
         a->_draw_foreground(a, c);
 
     cairo_destroy(c);
+
+    if (client_side_rendering) {
+        // The background has been prepared server-side (e.g. from the root pixmap), fetch the result once
+        c = cairo_create(create_area_surface(a));
+        cairo_set_operator(c, CAIRO_OPERATOR_SOURCE);
+        cairo_set_source_surface(c, cs, 0, 0);
+        cairo_paint(c);
+        cairo_destroy(c);
+    }
+
     cairo_surface_destroy(cs);
 }
 
+void draw_area_image(Area *a, cairo_t *c, int x, int y)
+{
+    if (a->surface && cairo_get_target(c) == a->surface)
+        render_image_to_cairo(c, x, y);
+    else
+        render_image(a->pix, x, y);
+}
+
 double tint_color_channel(double a, double b, double tint_weight)
 {
     double gamma = 2.2;
@@ -590,6 +685,9 @@ void remove_area(Area *a)
     Area *parent = (Area *)area->parent;
 
     free_area_gradient_instances(a);
+    for (int i = 0; i < AREA_TEXT_LAYOUT_COUNT; i++)
+        free_text_layout(&a->text_layouts[i]);
+    damage_last_blit(a);
 
     if (parent) {
         parent->children = g_list_remove(parent->children, area);
@@ -627,21 +725,22 @@ void free_area(Area *a)
         g_list_free(a->children);
         a->children = NULL;
     }
-    for (int i = 0; i < MOUSE_STATE_COUNT; i++) {
-        XFreePixmap(server.display, a->pix_by_state[i]);
-        if (a->pix == a->pix_by_state[i]) {
-            a->pix = None;
-        }
-        a->pix_by_state[i] = None;
-    }
-    if (a->pix) {
-        XFreePixmap(server.display, a->pix);
-        a->pix = None;
-    }
+    free_area_pixmaps(a);
     if (mouse_over_area == a) {
         mouse_over_area = NULL;
     }
     free_area_gradient_instances(a);
+    for (int i = 0; i < AREA_TEXT_LAYOUT_COUNT; i++)
+        free_text_layout(&a->text_layouts[i]);
+}
+
+// Switches to the cached pixmap of the current mouse state, or schedules drawing it
+static void apply_mouse_state(Area *a)
+{
+    a->pix = a->pix_by_state[a->mouse_state];
+    a->surface = a->surface_by_state[a->mouse_state];
+    if (client_side_rendering ? !a->surface : !a->pix)
+        a->_redraw_needed = TRUE;
 }
 
 void mouse_over(Area *area, gboolean pressed)
@@ -667,9 +766,7 @@ void mouse_over(Area *area, gboolean pressed)
     mouse_over_area = area;
 
     mouse_over_area->mouse_state = new_state;
-    mouse_over_area->pix = mouse_over_area->pix_by_state[mouse_over_area->mouse_state];
-    if (!mouse_over_area->pix)
-        mouse_over_area->_redraw_needed = TRUE;
+    apply_mouse_state(mouse_over_area);
     schedule_panel_redraw();
 }
 
@@ -678,9 +775,7 @@ void mouse_out()
     if (!mouse_over_area)
         return;
     mouse_over_area->mouse_state = MOUSE_NORMAL;
-    mouse_over_area->pix = mouse_over_area->pix_by_state[mouse_over_area->mouse_state];
-    if (!mouse_over_area->pix)
-        mouse_over_area->_redraw_needed = TRUE;
+    apply_mouse_state(mouse_over_area);
     schedule_panel_redraw();
     mouse_over_area = NULL;
 }
@@ -970,6 +1065,21 @@ void area_compute_text_geometry(Area *area,
         *line2_width = *line2_height = 0;
 }
 
+static int text_area_desired_size_from_geometry(Area *area,
+                                                int line1_height,
+                                                int line1_width,
+                                                int line2_height,
+                                                int line2_width)
+{
+    if (panel_horizontal) {
+        int new_size = MAX(line1_width, line2_width) + 2 * area->paddingxlr + left_right_border_width(area);
+        return new_size;
+    } else {
+        int new_size = line1_height + line2_height + 2 * area->paddingy + top_bottom_border_width(area);
+        return new_size;
+    }
+}
+
 int text_area_compute_desired_size(Area *area,
                                    const char *line1,
                                    const char *line2,
@@ -986,14 +1096,7 @@ int text_area_compute_desired_size(Area *area,
                                &line1_width,
                                &line2_height,
                                &line2_width);
-
-    if (panel_horizontal) {
-        int new_size = MAX(line1_width, line2_width) + 2 * area->paddingxlr + left_right_border_width(area);
-        return new_size;
-    } else {
-        int new_size = line1_height + line2_height + 2 * area->paddingy + top_bottom_border_width(area);
-        return new_size;
-    }
+    return text_area_desired_size_from_geometry(area, line1_height, line1_width, line2_height, line2_width);
 }
 
 gboolean resize_text_area(Area *area,
@@ -1020,11 +1123,7 @@ gboolean resize_text_area(Area *area,
                                &line2_height,
                                &line2_width);
 
-    int new_size = text_area_compute_desired_size(area,
-                                                  line1,
-                                                  line2,
-                                                  line1_font_desc,
-                                                  line2_font_desc);
+    int new_size = text_area_desired_size_from_geometry(area, line1_height, line1_width, line2_height, line2_width);
     if (panel_horizontal) {
         if (new_size != area->width) {
             if (new_size < area->width && abs(new_size - area->width) < 6) {
@@ -1055,6 +1154,59 @@ gboolean resize_text_area(Area *area,
     return result;
 }
 
+int text_layout_rebuilds = 0;
+
+PangoLayout *update_text_layout(TextLayout *text_layout,
+                                const PangoFontDescription *font,
+                                const char *text,
+                                gboolean markup,
+                                int width,
+                                int height,
+                                PangoWrapMode wrap,
+                                PangoEllipsizeMode ellipsis,
+                                PangoAlignment alignment,
+                                double scale)
+{
+    if (!text_layout->layout) {
+        text_layout->layout = create_text_layout(scale);
+        text_layout->scale = scale;
+    } else if (text_layout->scale != scale) {
+        set_text_layout_scale(text_layout->layout, scale);
+        text_layout->scale = scale;
+    }
+    PangoLayout *layout = text_layout->layout;
+    // Pango ignores the setters that do not change anything, so the layout is kept
+    pango_layout_set_font_description(layout, font);
+    pango_layout_set_width(layout, width);
+    pango_layout_set_height(layout, height);
+    pango_layout_set_wrap(layout, wrap);
+    pango_layout_set_ellipsize(layout, ellipsis);
+    pango_layout_set_alignment(layout, alignment);
+    if (!text)
+        text = "";
+    if (!text_layout->text || markup != text_layout->markup || strcmp(text, text_layout->text) != 0) {
+        // Invalid markup is displayed as plain text, so the layout always matches the cached text
+        layout_set_text_or_markup(layout, text, -1, markup);
+        g_free(text_layout->text);
+        text_layout->text = g_strdup(text);
+        text_layout->markup = markup;
+    }
+    guint serial = pango_layout_get_serial(layout);
+    if (serial != text_layout->serial) {
+        text_layout->serial = serial;
+        text_layout_rebuilds++;
+    }
+    return layout;
+}
+
+void free_text_layout(TextLayout *text_layout)
+{
+    if (text_layout->layout)
+        g_object_unref(text_layout->layout);
+    g_free(text_layout->text);
+    memset(text_layout, 0, sizeof(*text_layout));
+}
+
 void draw_text_area(Area *area,
                     cairo_t *c,
                     const char *line1,
@@ -1069,34 +1221,27 @@ void draw_text_area(Area *area,
     int inner_w, inner_h;
     area_compute_inner_size(area, &inner_w, &inner_h);
 
-    PangoContext *context = pango_cairo_create_context(c);
-    pango_cairo_context_set_resolution(context, 96 * scale);
-    PangoLayout *layout = pango_layout_new(context);
-
-    pango_layout_set_alignment(layout, PANGO_ALIGN_CENTER);
-    pango_layout_set_wrap(layout, PANGO_WRAP_WORD_CHAR);
-    pango_layout_set_ellipsize(layout, PANGO_ELLIPSIZE_NONE);
-    pango_layout_set_width(layout, inner_w * PANGO_SCALE);
-    pango_layout_set_height(layout, inner_h * PANGO_SCALE);
     cairo_set_source_rgba(c, color->rgb[0], color->rgb[1], color->rgb[2], color->alpha);
 
-    if (line1 && line1[0]) {
-        pango_layout_set_font_description(layout, line1_font_desc);
-        pango_layout_set_text(layout, line1, strlen(line1));
-        pango_cairo_update_layout(c, layout);
-        draw_text(layout, c, (area->width - inner_w) / 2, line1_posy, color, ((Panel *)area->panel)->font_shadow ? layout : NULL);
-    }
-
-    if (line2 && line2[0]) {
-        pango_layout_set_font_description(layout, line2_font_desc);
-        pango_layout_set_indent(layout, 0);
-        pango_layout_set_text(layout, line2, strlen(line2));
+    const char *lines[AREA_TEXT_LAYOUT_COUNT] = {line1, line2};
+    PangoFontDescription *fonts[AREA_TEXT_LAYOUT_COUNT] = {line1_font_desc, line2_font_desc};
+    int posy[AREA_TEXT_LAYOUT_COUNT] = {line1_posy, line2_posy};
+    for (int i = 0; i < AREA_TEXT_LAYOUT_COUNT; i++) {
+        if (!lines[i] || !lines[i][0])
+            continue;
+        PangoLayout *layout = update_text_layout(&area->text_layouts[i],
+                                                 fonts[i],
+                                                 lines[i],
+                                                 FALSE,
+                                                 inner_w * PANGO_SCALE,
+                                                 inner_h * PANGO_SCALE,
+                                                 PANGO_WRAP_WORD_CHAR,
+                                                 PANGO_ELLIPSIZE_NONE,
+                                                 PANGO_ALIGN_CENTER,
+                                                 scale);
         pango_cairo_update_layout(c, layout);
-        draw_text(layout, c, (area->width - inner_w) / 2, line2_posy, color, ((Panel *)area->panel)->font_shadow ? layout : NULL);
+        draw_text(layout, c, (area->width - inner_w) / 2, posy[i], color, ((Panel *)area->panel)->font_shadow ? layout : NULL);
     }
-
-    g_object_unref(layout);
-    g_object_unref(context);
 }
 
 Area *compute_element_area(Area *area, Element element)
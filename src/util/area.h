@@ -10,6 +10,7 @@
 #include <X11/Xlib.h>
 #include <cairo.h>
 #include <cairo-xlib.h>
+#include <pango/pangocairo.h>
 
 #include "color.h"
 #include "gradient.h"
@@ -171,6 +172,20 @@ typedef enum Alignment {
 
 struct Panel;
 
+// A PangoLayout kept across redraws, so that the text is only laid out again when something changes.
+typedef struct TextLayout {
+    PangoLayout *layout;
+    char *text;
+    gboolean markup;
+    double scale;
+    guint serial;
+} TextLayout;
+
+// Number of times a TextLayout had to be laid out again (DEBUG_FPS).
+extern int text_layout_rebuilds;
+
+#define AREA_TEXT_LAYOUT_COUNT 2
+
 typedef struct Area {
     // Position relative to the panel window
     int posx, posy;
@@ -210,7 +225,18 @@ typedef struct Area {
     // This is the pixmap on which the Area is rendered. Render to it directly if needed.
     Pixmap pix;
     Pixmap pix_by_state[MOUSE_STATE_COUNT];
+    // With client_side_rendering, the image surface on which the Area is rendered (instead of pix).
+    // Areas with a _clear callback are still drawn on pix, then fetched once into the surface.
+    cairo_surface_t *surface;
+    cairo_surface_t *surface_by_state[MOUSE_STATE_COUNT];
+    // Pixmap (or surface) and rectangle last copied to the panel back buffer, used to compute the damaged region.
+    // Do not set these directly; they are maintained by collect_damage() and draw_tree().
+    Pixmap _last_pix;
+    cairo_surface_t *_last_surface;
+    int _last_x, _last_y, _last_width, _last_height;
     char name[32];
+    // Layouts of the text drawn by the Area (e.g. one per line), see update_text_layout().
+    TextLayout text_layouts[AREA_TEXT_LAYOUT_COUNT];
 
     // Callbacks
 
@@ -289,6 +315,23 @@ gboolean resize_text_area(Area *area,
                           PangoFontDescription *line2_font_desc,
                           int *line1_posy,
                           int *line2_posy);
+// Returns the layout of text_layout set up with the given parameters, creating it on first use.
+// Width and height are in Pango units (-1 = unlimited). The text may be NULL.
+// Call pango_cairo_update_layout() before drawing it on a cairo context.
+PangoLayout *update_text_layout(TextLayout *text_layout,
+                                const PangoFontDescription *font,
+                                const char *text,
+                                gboolean markup,
+                                int width,
+                                int height,
+                                PangoWrapMode wrap,
+                                PangoEllipsizeMode ellipsis,
+                                PangoAlignment alignment,
+                                double scale);
+
+// Releases the layout. The TextLayout can be reused afterwards.
+void free_text_layout(TextLayout *text_layout);
+
 void draw_text_area(Area *area,
                     cairo_t *c,
                     const char *line1,
@@ -325,10 +368,18 @@ void draw(Area *a);
 // Draws the background of the Area
 void draw_background(Area *a, cairo_t *c);
 
-// Explores the entire Area subtree (only if the on_screen flag set)
-// and draws the areas with the redraw_needed flag set
+// Explores the entire Area subtree (only if the on_screen flag set) and adds to the panel damage
+// the old and new rectangles of the areas that will be redrawn, have moved or have swapped their pixmap
+void collect_damage(Area *a);
+
+// Explores the Area subtree intersecting the panel damage (only if the on_screen flag set),
+// draws the areas with the redraw_needed flag set and copies them to the back buffer, clipped to the damage
 void draw_tree(Area *a);
 
+// Renders the current Imlib image on the Area at (x, y), from its _draw_foreground callback (c is its context).
+// Works with both the xlib and the client-side rendering.
+void draw_area_image(Area *a, cairo_t *c, int x, int y);
+
 // Clears the on_screen flag, sets the size to zero and triggers a parent resize
 void hide(Area *a);
 
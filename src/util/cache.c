@@ -18,30 +18,238 @@
 **************************************************************************/
 #include "common.h"
 #include "cache.h"
+#include "timer.h"
 
 #include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+// File format (native byte order, the file is not meant to be shared between machines):
+// a header with a fixed-size hash table of chains, followed by the records. Each record links to the
+// previous head of its chain, so records can be appended without rewriting the file, and newer records
+// shadow older ones with the same key.
+#define CACHE_MAGIC "tint2ch"
+#define CACHE_FORMAT_VERSION 1
+#define CACHE_BUCKET_COUNT 1024
+// The file is compacted on save once it grows past this size, mostly with superseded records
+#define CACHE_MAX_FILE_SIZE (1 << 20)
+// Minimum interval between two checks of the modification time of a directory, in seconds
+#define CACHE_DIR_VALIDATION_INTERVAL 1.0
+
+typedef struct CacheFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t bucket_count;
+    // Offsets of the newest record of each chain, 0 if empty
+    uint32_t buckets[CACHE_BUCKET_COUNT];
+} CacheFileHeader;
+
+typedef struct CacheFileRecord {
+    // Offset of the next (older) record of the chain, 0 at the end
+    uint32_t next;
+    uint32_t hash;
+    uint32_t key_len;
+    uint32_t value_len;
+    // Modification time of the directory of the value, if it is a path; -1 otherwise
+    int64_t dir_mtime;
+    // Followed by the key and the value, both null-terminated, padded to a multiple of 8 bytes
+} CacheFileRecord;
+
+typedef struct CacheEntry {
+    gchar *value;
+    gint64 dir_mtime;
+} CacheEntry;
+
+typedef struct CacheDirStamp {
+    gint64 mtime;
+    double last_checked;
+} CacheDirStamp;
+
+static void free_cache_entry(gpointer data)
+{
+    CacheEntry *entry = (CacheEntry *)data;
+    g_free(entry->value);
+    g_free(entry);
+}
+
+static CacheEntry *make_cache_entry(const gchar *value, gint64 dir_mtime)
+{
+    CacheEntry *entry = g_new0(CacheEntry, 1);
+    entry->value = g_strdup(value);
+    entry->dir_mtime = dir_mtime;
+    return entry;
+}
+
+// FNV-1a; g_str_hash is not guaranteed to be stable across GLib versions
+static uint32_t cache_hash(const gchar *key)
+{
+    uint32_t h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)key; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static size_t cache_record_size(size_t key_len, size_t value_len)
+{
+    return (sizeof(CacheFileRecord) + key_len + value_len + 2 + 7) & ~(size_t)7;
+}
+
+static void unmap_cache_file(Cache *cache)
+{
+    if (cache->_map)
+        munmap((void *)cache->_map, cache->_map_size);
+    cache->_map = NULL;
+    cache->_map_size = 0;
+}
+
+static gboolean cache_header_valid(const CacheFileHeader *header)
+{
+    return memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) == 0 &&
+           header->version == CACHE_FORMAT_VERSION && header->bucket_count == CACHE_BUCKET_COUNT;
+}
+
+static void map_cache_file(Cache *cache)
+{
+    unmap_cache_file(cache);
+    if (!cache->_path)
+        return;
+
+    int fd = open(cache->_path, O_RDONLY);
+    if (fd == -1)
+        return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(CacheFileHeader)) {
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED) {
+            cache->_map = map;
+            cache->_map_size = (size_t)st.st_size;
+        }
+    }
+    close(fd);
+
+    if (cache->_map && !cache_header_valid((const CacheFileHeader *)cache->_map)) {
+        fprintf(stderr, YELLOW "tint2: Ignoring cache file in an unknown format: %s" RESET "\n", cache->_path);
+        unmap_cache_file(cache);
+    }
+}
+
+// Returns the record at offset, or NULL if it is not entirely within the mapped file
+static const CacheFileRecord *get_cache_record(Cache *cache, uint32_t offset)
+{
+    if (offset < sizeof(CacheFileHeader) || offset % 8 != 0 || offset + sizeof(CacheFileRecord) > cache->_map_size)
+        return NULL;
+    const CacheFileRecord *record = (const CacheFileRecord *)(cache->_map + offset);
+    if (offset + cache_record_size(record->key_len, record->value_len) > cache->_map_size)
+        return NULL;
+    const char *key = (const char *)(record + 1);
+    if (key[record->key_len] != '\0' || key[record->key_len + 1 + record->value_len] != '\0')
+        return NULL;
+    return record;
+}
+
+static const CacheFileRecord *find_cache_record(Cache *cache, const gchar *key)
+{
+    if (!cache->_map)
+        return NULL;
+    uint32_t hash = cache_hash(key);
+    gboolean remapped = FALSE;
+    const CacheFileHeader *header = (const CacheFileHeader *)cache->_map;
+    uint32_t offset = header->buckets[hash % CACHE_BUCKET_COUNT];
+    while (offset) {
+        const CacheFileRecord *record = get_cache_record(cache, offset);
+        if (!record) {
+            if (remapped || offset + sizeof(CacheFileRecord) <= cache->_map_size)
+                return NULL;
+            // Appended by another process after the file was mapped
+            map_cache_file(cache);
+            remapped = TRUE;
+            if (!cache->_map)
+                return NULL;
+            header = (const CacheFileHeader *)cache->_map;
+            offset = header->buckets[hash % CACHE_BUCKET_COUNT];
+            continue;
+        }
+        if (record->hash == hash && strcmp((const char *)(record + 1), key) == 0)
+            return record;
+        // Records only link to older ones, which also protects against cycles in corrupted files
+        if (record->next >= offset)
+            return NULL;
+        offset = record->next;
+    }
+    return NULL;
+}
+
+static gint64 get_dir_mtime(const gchar *path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return -1;
+    return (gint64)st.st_mtime;
+}
+
+// Returns the modification time of the directory of a path value, or -1 if the value is not a path
+static gint64 get_value_dir_mtime(const gchar *value)
+{
+    if (value[0] != '/')
+        return -1;
+    gchar *dir = g_path_get_dirname(value);
+    gint64 mtime = get_dir_mtime(dir);
+    g_free(dir);
+    return mtime;
+}
+
+static gboolean cache_value_valid(Cache *cache, const gchar *value, gint64 dir_mtime)
+{
+    if (dir_mtime < 0)
+        return TRUE;
+    gchar *dir = g_path_get_dirname(value);
+    CacheDirStamp *stamp = g_hash_table_lookup(cache->_dir_stamps, dir);
+    double now = get_time();
+    if (!stamp) {
+        stamp = g_new0(CacheDirStamp, 1);
+        stamp->mtime = get_dir_mtime(dir);
+        stamp->last_checked = now;
+        g_hash_table_insert(cache->_dir_stamps, dir, stamp);
+    } else {
+        if (now - stamp->last_checked >= CACHE_DIR_VALIDATION_INTERVAL) {
+            stamp->mtime = get_dir_mtime(dir);
+            stamp->last_checked = now;
+        }
+        g_free(dir);
+    }
+    return stamp->mtime == dir_mtime;
+}
+
 void init_cache(Cache *cache)
 {
-    if (cache->_table)
+    if (cache->_pending)
         free_cache(cache);
-    cache->_table = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    cache->_pending = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free_cache_entry);
+    cache->_dir_stamps = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
     cache->dirty = FALSE;
     cache->loaded = FALSE;
 }
 
 void free_cache(Cache *cache)
 {
-    if (cache->_table)
-        g_hash_table_destroy(cache->_table);
-    cache->_table = NULL;
+    unmap_cache_file(cache);
+    if (cache->_pending)
+        g_hash_table_destroy(cache->_pending);
+    cache->_pending = NULL;
+    if (cache->_dir_stamps)
+        g_hash_table_destroy(cache->_dir_stamps);
+    cache->_dir_stamps = NULL;
+    g_free(cache->_path);
+    cache->_path = NULL;
     cache->dirty = FALSE;
     cache->loaded = FALSE;
 }
@@ -51,108 +259,219 @@ void load_cache(Cache *cache, const gchar *cache_path)
     init_cache(cache);
 
     cache->loaded = TRUE;
+    cache->_path = g_strdup(cache_path);
+    map_cache_file(cache);
+}
 
-    int fd = open(cache_path, O_RDONLY);
-    if (fd == -1)
-        return;
-    flock(fd, LOCK_SH);
-
-    FILE *f = fopen(cache_path, "rt");
-    if (!f)
-        goto unlock;
-
-    char *line = NULL;
-    size_t line_size;
+static void write_cache_record(GByteArray *buffer,
+                               uint32_t *buckets,
+                               const gchar *key,
+                               const gchar *value,
+                               gint64 dir_mtime,
+                               size_t file_offset)
+{
+    CacheFileRecord record;
+    memset(&record, 0, sizeof(record));
+    record.hash = cache_hash(key);
+    record.key_len = (uint32_t)strlen(key);
+    record.value_len = (uint32_t)strlen(value);
+    record.dir_mtime = dir_mtime;
+    record.next = buckets[record.hash % CACHE_BUCKET_COUNT];
+    buckets[record.hash % CACHE_BUCKET_COUNT] = (uint32_t)(file_offset + buffer->len);
 
-    while (getline(&line, &line_size, f) >= 0) {
-        char *key, *value;
+    size_t size = cache_record_size(record.key_len, record.value_len);
+    guint start = buffer->len;
+    g_byte_array_set_size(buffer, start + (guint)size);
+    memset(buffer->data + start, 0, size);
+    memcpy(buffer->data + start, &record, sizeof(record));
+    memcpy(buffer->data + start + sizeof(record), key, record.key_len);
+    memcpy(buffer->data + start + sizeof(record) + record.key_len + 1, value, record.value_len);
+}
 
-        size_t line_len = strlen(line);
-        gboolean has_newline = FALSE;
-        if (line_len >= 1) {
-            if (line[line_len - 1] == '\n') {
-                line[line_len - 1] = '\0';
-                line_len--;
-                has_newline = TRUE;
+// Writes all the current entries (mapped and pending) to a new file, which replaces the old one.
+// The old file is not modified, since other processes may have it mapped.
+static gboolean rewrite_cache_file(Cache *cache, const gchar *cache_path)
+{
+    // Newest value of each key
+    GHashTable *entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free_cache_entry);
+    if (cache->_map) {
+        const CacheFileHeader *header = (const CacheFileHeader *)cache->_map;
+        for (int b = 0; b < CACHE_BUCKET_COUNT; b++) {
+            uint32_t offset = header->buckets[b];
+            const CacheFileRecord *record;
+            while (offset && (record = get_cache_record(cache, offset))) {
+                const gchar *key = (const gchar *)(record + 1);
+                const gchar *value = key + record->key_len + 1;
+                if (!g_hash_table_contains(entries, key) && cache_value_valid(cache, value, record->dir_mtime))
+                    g_hash_table_insert(entries, g_strdup(key), make_cache_entry(value, record->dir_mtime));
+                if (record->next >= offset)
+                    break;
+                offset = record->next;
             }
         }
-        if (!has_newline)
-            break;
+    }
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, cache->_pending);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        CacheEntry *entry = (CacheEntry *)value;
+        g_hash_table_insert(entries, g_strdup(key), make_cache_entry(entry->value, entry->dir_mtime));
+    }
 
-        if (line_len == 0)
-            continue;
+    CacheFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.version = CACHE_FORMAT_VERSION;
+    header.bucket_count = CACHE_BUCKET_COUNT;
+    GByteArray *records = g_byte_array_new();
+    g_hash_table_iter_init(&iter, entries);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        CacheEntry *entry = (CacheEntry *)value;
+        write_cache_record(records, header.buckets, key, entry->value, entry->dir_mtime, sizeof(header));
+    }
+    g_hash_table_destroy(entries);
 
-        if (parse_line(line, &key, &value)) {
-            g_hash_table_insert(cache->_table, g_strdup(key), g_strdup(value));
-            free(key);
-            free(value);
-        }
+    gboolean ok = FALSE;
+    gchar *tmp_path = g_strdup_printf("%s.%d.tmp", cache_path, (int)getpid());
+    FILE *f = fopen(tmp_path, "wb");
+    if (f) {
+        ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+             (records->len == 0 || fwrite(records->data, records->len, 1, f) == 1);
+        ok = fclose(f) == 0 && ok;
+        ok = ok && rename(tmp_path, cache_path) == 0;
+        if (!ok)
+            unlink(tmp_path);
     }
-    free(line);
-    fclose(f);
+    g_free(tmp_path);
+    g_byte_array_free(records, TRUE);
+    return ok;
+}
 
-unlock:
-    flock(fd, LOCK_UN);
-    close(fd);
+// Appends the pending entries to a valid cache file, locked for writing
+static gboolean append_to_cache_file(Cache *cache, int fd, off_t file_size)
+{
+    CacheFileHeader header;
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header))
+        return FALSE;
+    size_t offset = ((size_t)file_size + 7) & ~(size_t)7;
+
+    GByteArray *records = g_byte_array_new();
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, cache->_pending);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        CacheEntry *entry = (CacheEntry *)value;
+        write_cache_record(records, header.buckets, key, entry->value, entry->dir_mtime, offset);
+    }
+
+    // Write the records before publishing them in the hash table, so that readers never see partial records
+    gboolean ok = pwrite(fd, records->data, records->len, (off_t)offset) == (ssize_t)records->len &&
+                  pwrite(fd, header.buckets, sizeof(header.buckets), offsetof(CacheFileHeader, buckets)) ==
+                      (ssize_t)sizeof(header.buckets);
+    g_byte_array_free(records, TRUE);
+    return ok;
 }
 
-void write_cache_line(gpointer key, gpointer value, gpointer user_data)
+// Opens the cache file and locks it for writing. Returns -1 on failure.
+static int open_locked_cache_file(const gchar *cache_path)
 {
-    gchar *k = key;
-    gchar *v = value;
-    FILE *f = user_data;
+    // Another process may replace the file while we wait for the lock, in which case we would hold the lock of an
+    // orphaned file. Retry until the locked file is the one at cache_path.
+    for (int attempt = 0; attempt < 10; attempt++) {
+        int fd = open(cache_path, O_RDWR | O_CREAT, 0600);
+        if (fd == -1) {
+            gchar *dir_path = g_path_get_dirname(cache_path);
+            g_mkdir_with_parents(dir_path, 0700);
+            g_free(dir_path);
+            fd = open(cache_path, O_RDWR | O_CREAT, 0600);
+        }
+        if (fd == -1)
+            return -1;
+        flock(fd, LOCK_EX);
 
-    fprintf(f, "%s=%s\n", k, v);
+        struct stat fd_st, path_st;
+        if (fstat(fd, &fd_st) == 0 && stat(cache_path, &path_st) == 0 && fd_st.st_dev == path_st.st_dev &&
+            fd_st.st_ino == path_st.st_ino)
+            return fd;
+        flock(fd, LOCK_UN);
+        close(fd);
+    }
+    return -1;
 }
 
 void save_cache(Cache *cache, const gchar *cache_path)
 {
-    int fd = open(cache_path, O_RDONLY | O_CREAT, 0600);
-    if (fd == -1) {
-        gchar *dir_path = g_path_get_dirname(cache_path);
-        g_mkdir_with_parents(dir_path, 0700);
-        g_free(dir_path);
-        fd = open(cache_path, O_RDONLY | O_CREAT, 0600);
-    }
+    int fd = open_locked_cache_file(cache_path);
     if (fd == -1) {
         fprintf(stderr, RED "tint2: Could not save icon theme cache!" RESET "\n");
         return;
     }
-    flock(fd, LOCK_EX);
 
-    FILE *f = fopen(cache_path, "w");
-    if (!f) {
+    struct stat st;
+    CacheFileHeader header;
+    gboolean can_append = fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(header) &&
+                          st.st_size < CACHE_MAX_FILE_SIZE && pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+                          cache_header_valid(&header);
+    gboolean ok;
+    if (can_append) {
+        ok = append_to_cache_file(cache, fd, st.st_size);
+    } else {
+        // Pick up the entries saved by other processes
+        g_free(cache->_path);
+        cache->_path = g_strdup(cache_path);
+        map_cache_file(cache);
+        ok = rewrite_cache_file(cache, cache_path);
+    }
+    if (!ok) {
         fprintf(stderr, RED "tint2: Could not save icon theme cache!" RESET "\n");
-        goto unlock;
+    } else {
+        g_hash_table_remove_all(cache->_pending);
+        cache->dirty = FALSE;
     }
-    g_hash_table_foreach(cache->_table, write_cache_line, f);
-    fclose(f);
-    cache->dirty = FALSE;
 
-unlock:
     flock(fd, LOCK_UN);
     close(fd);
+
+    g_free(cache->_path);
+    cache->_path = g_strdup(cache_path);
+    map_cache_file(cache);
 }
 
 const gchar *get_from_cache(Cache *cache, const gchar *key)
 {
-    if (!cache->_table)
+    if (!cache->_pending)
+        return NULL;
+
+    const gchar *value;
+    gint64 dir_mtime;
+    CacheEntry *entry = g_hash_table_lookup(cache->_pending, key);
+    if (entry) {
+        value = entry->value;
+        dir_mtime = entry->dir_mtime;
+    } else {
+        const CacheFileRecord *record = find_cache_record(cache, key);
+        if (!record)
+            return NULL;
+        value = (const gchar *)(record + 1) + record->key_len + 1;
+        dir_mtime = record->dir_mtime;
+    }
+    if (!cache_value_valid(cache, value, dir_mtime))
         return NULL;
-    return g_hash_table_lookup(cache->_table, key);
+    return value;
 }
 
 void add_to_cache(Cache *cache, const gchar *key, const gchar *value)
 {
-    if (!cache->_table)
+    if (!cache->_pending)
         init_cache(cache);
 
     if (!key || !value)
         return;
 
-    gchar *old_value = g_hash_table_lookup(cache->_table, key);
+    const gchar *old_value = get_from_cache(cache, key);
     if (old_value && g_str_equal(old_value, value))
         return;
 
-    g_hash_table_insert(cache->_table, g_strdup(key), g_strdup(value));
+    g_hash_table_insert(cache->_pending, g_strdup(key), make_cache_entry(value, get_value_dir_mtime(value)));
     cache->dirty = TRUE;
 }
@@ -2,13 +2,25 @@
 #define CACHE_H
 
 #include <glib.h>
-
-// A cache with string keys and values, backed by a file.
-// The strings must not be NULL and are stripped of any whitespace at start and end.
+#include <stddef.h>
+
+// A cache with string keys and values, backed by a binary file.
+// The file is memory-mapped read-only, so loading needs no parsing and the file can be shared by several
+// processes. New entries are appended to it on save.
+// Values that are absolute file paths are validated against the modification time of their directory,
+// recorded when they were added; stale values are not returned.
+// The strings must not be NULL.
 typedef struct Cache {
     gboolean dirty;
     gboolean loaded;
-    GHashTable *_table;
+    gchar *_path;
+    // The backing file mapped in memory, or NULL
+    const char *_map;
+    size_t _map_size;
+    // Entries added since the file was mapped (key -> CacheEntry*), written on save
+    GHashTable *_pending;
+    // Directory path -> CacheDirStamp*, the modification times of the directories of the path values
+    GHashTable *_dir_stamps;
 } Cache;
 
 // Initializes the cache. You can also call load_cache directly if you set the memory contents to zero first.
@@ -18,16 +30,17 @@ void init_cache(Cache *cache);
 // You can use init_cache or load_cache afterwards.
 void free_cache(Cache *cache);
 
-// Clears the cache contents and loads new contents from a file.
+// Clears the cache contents and maps the contents of a file.
 // Sets the loaded flag to TRUE.
 void load_cache(Cache *cache, const gchar *cache_path);
 
-// Saves the cache contents to a file.
+// Appends the entries added since loading to a file (or rewrites it, if it is missing, in another format or
+// too large).
 // Clears the dirty flag.
 void save_cache(Cache *cache, const gchar *cache_path);
 
 // Returns a pointer to the value in the cache, or NULL if not found.
-// Do not free the returned value!
+// Do not free the returned value! It is valid until the next call to a cache function.
 const gchar *get_from_cache(Cache *cache, const gchar *key);
 
 // Adds a key-value pair to the cache. NULL keys or values are not allowed.
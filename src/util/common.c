@@ -38,6 +38,8 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <errno.h>
 #include <dirent.h>
 #if !defined(__OpenBSD__)
@@ -46,12 +48,17 @@
 
 #ifdef HAVE_RSVG
 #include <librsvg/rsvg.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 #endif
 
 #include "../panel.h"
 #include "timer.h"
 #include "signals.h"
+#include "subprocess.h"
 #include "bt.h"
+#include "test.h"
 
 void write_string(int fd, const char *s)
 {
@@ -348,57 +355,54 @@ pid_t tint_exec(const char *command,
         sn_launcher_context_initiate(ctx, "tint2", command, time);
     }
 #endif /* HAVE_SN */
-    pid_t pid;
-    pid = fork();
-    if (pid < 0) {
-        fprintf(stderr, "tint2: Could not fork\n");
-    } else if (pid == 0) {
-// Child process
+    SpawnOptions options = SPAWN_OPTIONS_DEFAULT;
+    // Allow children to exist after parent destruction
+    options.new_session = TRUE;
+    if (dir) {
+        if (g_file_test(dir, G_FILE_TEST_IS_DIR))
+            options.dir = dir;
+        else
+            fprintf(stderr, "tint2: failed to chdir to %s\n", dir);
+    }
 #if HAVE_SN
-        if (startup_notifications && startup_notification && time) {
-            sn_launcher_context_setup_child_process(ctx);
-        }
+    if (ctx)
+        setenv("DESKTOP_STARTUP_ID", sn_launcher_context_get_startup_id(ctx), 1);
 #endif // HAVE_SN
-        // Allow children to exist after parent destruction
-        setsid();
-        // Run the command
-        if (dir) {
-            int ret = chdir(dir);
-            if (ret != 0) {
-                fprintf(stderr, "tint2: failed to chdir to %s\n", dir);
-            }
-        }
-        close_all_fds();
-        reset_signals();
-        if (terminal) {
+    // Run the command
+    pid_t pid = -1;
+    if (terminal) {
 #if !defined(__OpenBSD__)
-            fprintf(stderr, "tint2: executing in x-terminal-emulator: %s\n", command);
-            wordexp_t words;
-            words.we_offs = 2;
-            if (wordexp(command, &words, WRDE_DOOFFS | WRDE_SHOWERR) == 0) {
-                words.we_wordv[0] = (char *)"x-terminal-emulator";
-                words.we_wordv[1] = (char *)"-e";
-                execvp("x-terminal-emulator", words.we_wordv);
-            }
+        fprintf(stderr, "tint2: executing in x-terminal-emulator: %s\n", command);
+        wordexp_t words;
+        words.we_offs = 2;
+        if (wordexp(command, &words, WRDE_DOOFFS | WRDE_SHOWERR) == 0) {
+            words.we_wordv[0] = (char *)"x-terminal-emulator";
+            words.we_wordv[1] = (char *)"-e";
+            pid = spawn_process(words.we_wordv, &options);
+            wordfree(&words);
+        }
 #endif
+        if (pid < 0)
             fprintf(stderr,
                     "tint2: could not execute command in x-terminal-emulator: %s, executting in shell\n",
                     command);
-        }
-        execlp("sh", "sh", "-c", command, NULL);
+    }
+    if (pid < 0)
+        pid = spawn_shell_command(command, &options);
+#if HAVE_SN
+    if (ctx)
+        unsetenv("DESKTOP_STARTUP_ID");
+#endif // HAVE_SN
+    if (pid < 0) {
         fprintf(stderr, "tint2: Failed to execute %s\n", command);
 #if HAVE_SN
-        if (startup_notifications && startup_notification && time) {
+        if (ctx)
             sn_launcher_context_unref(ctx);
-        }
 #endif // HAVE_SN
-        _exit(1);
     } else {
-// Parent process
 #if HAVE_SN
-        if (startup_notifications && startup_notification && time) {
+        if (ctx)
             g_tree_insert(server.pids, GINT_TO_POINTER(pid), ctx);
-        }
 #endif // HAVE_SN
     }
 
@@ -556,111 +560,328 @@ void extract_values_4(const char *str, char **value1, char **value2, char **valu
     g_strfreev(tokens);
 }
 
-void adjust_asb(DATA32 *data, int w, int h, float alpha_adjust, float satur_adjust, float bright_adjust)
+// Lookup tables for the alpha and brightness adjustments, which depend on a single channel each.
+typedef struct AsbTables {
+    gboolean valid;
+    float alpha_adjust;
+    float bright_adjust;
+    unsigned char alpha[256];
+    unsigned char bright[256];
+} AsbTables;
+
+// Icons are adjusted with a few distinct settings (hover, pressed, per task state), so keep the tables of the most
+// recent ones. The saturation adjustment is not part of the key, it does not affect the tables.
+#define ASB_TABLE_CACHE_SIZE 8
+static AsbTables asb_tables[ASB_TABLE_CACHE_SIZE];
+static int asb_tables_next = 0;
+
+static const AsbTables *get_asb_tables(float alpha_adjust, float bright_adjust)
 {
-    for (int id = 0; id < w * h; id++) {
-        unsigned int argb = data[id];
-        int a = (argb >> 24) & 0xff;
+    for (int i = 0; i < ASB_TABLE_CACHE_SIZE; i++) {
+        if (asb_tables[i].valid && asb_tables[i].alpha_adjust == alpha_adjust &&
+            asb_tables[i].bright_adjust == bright_adjust)
+            return &asb_tables[i];
+    }
+    AsbTables *tables = &asb_tables[asb_tables_next];
+    asb_tables_next = (asb_tables_next + 1) % ASB_TABLE_CACHE_SIZE;
+    tables->valid = TRUE;
+    tables->alpha_adjust = alpha_adjust;
+    tables->bright_adjust = bright_adjust;
+    // Same arithmetic as the per-pixel conversion used to do, so that the results are identical
+    for (int i = 0; i < 256; i++) {
+        int a = i;
+        a *= alpha_adjust;
+        tables->alpha[i] = (unsigned char)CLAMP(a, 0, 255);
+        int c = i;
+        c += bright_adjust * 255;
+        tables->bright[i] = (unsigned char)CLAMP(c, 0, 255);
+    }
+    return tables;
+}
+
+// Converts a color to HSV, adjusts the saturation and converts it back to RGB.
+static void adjust_saturation(int *red, int *green, int *blue, float satur_adjust)
+{
+    int r = *red;
+    int g = *green;
+    int b = *blue;
+
+    // Convert RGB to HSV
+    int cmax = MAX3(r, g, b);
+    int cmin = MIN3(r, g, b);
+    int delta = cmax - cmin;
+    float brightness = cmax / 255.0f;
+    float saturation;
+    if (cmax != 0)
+        saturation = delta / (float)cmax;
+    else
+        saturation = 0;
+    float hue;
+    if (saturation == 0) {
+        hue = 0;
+    } else {
+        float redc = (cmax - r) / (float)delta;
+        float greenc = (cmax - g) / (float)delta;
+        float bluec = (cmax - b) / (float)delta;
+        if (r == cmax)
+            hue = bluec - greenc;
+        else if (g == cmax)
+            hue = 2.0f + redc - bluec;
+        else
+            hue = 4.0f + greenc - redc;
+        hue = hue / 6.0f;
+        if (hue < 0)
+            hue = hue + 1.0f;
+    }
+
+    // Adjust S
+    saturation += satur_adjust;
+    saturation = CLAMP(saturation, 0.0, 1.0);
+
+    // Convert HSV to RGB
+    if (saturation == 0) {
+        r = g = b = (int)(brightness * 255.0f + 0.5f);
+    } else {
+        float h2 = (hue - (int)hue) * 6.0f;
+        float f = h2 - (int)(h2);
+        float p = brightness * (1.0f - saturation);
+        float q = brightness * (1.0f - saturation * f);
+        float t = brightness * (1.0f - (saturation * (1.0f - f)));
+
+        switch ((int)h2) {
+        case 0:
+            r = (int)(brightness * 255.0f + 0.5f);
+            g = (int)(t * 255.0f + 0.5f);
+            b = (int)(p * 255.0f + 0.5f);
+            break;
+        case 1:
+            r = (int)(q * 255.0f + 0.5f);
+            g = (int)(brightness * 255.0f + 0.5f);
+            b = (int)(p * 255.0f + 0.5f);
+            break;
+        case 2:
+            r = (int)(p * 255.0f + 0.5f);
+            g = (int)(brightness * 255.0f + 0.5f);
+            b = (int)(t * 255.0f + 0.5f);
+            break;
+        case 3:
+            r = (int)(p * 255.0f + 0.5f);
+            g = (int)(q * 255.0f + 0.5f);
+            b = (int)(brightness * 255.0f + 0.5f);
+            break;
+        case 4:
+            r = (int)(t * 255.0f + 0.5f);
+            g = (int)(p * 255.0f + 0.5f);
+            b = (int)(brightness * 255.0f + 0.5f);
+            break;
+        case 5:
+            r = (int)(brightness * 255.0f + 0.5f);
+            g = (int)(p * 255.0f + 0.5f);
+            b = (int)(q * 255.0f + 0.5f);
+            break;
+        }
+    }
+    *red = r;
+    *green = g;
+    *blue = b;
+}
+
+static void adjust_asb_scalar(DATA32 *data, int n, float satur_adjust, const AsbTables *tables)
+{
+    for (int id = 0; id < n; id++) {
+        DATA32 argb = data[id];
+        DATA32 a = (argb >> 24) & 0xff;
         // transparent => nothing to do.
         if (a == 0)
             continue;
         int r = (argb >> 16) & 0xff;
         int g = (argb >> 8) & 0xff;
         int b = (argb)&0xff;
+        adjust_saturation(&r, &g, &b, satur_adjust);
+        data[id] = ((DATA32)tables->alpha[a] << 24) | ((DATA32)tables->bright[r] << 16) |
+                   ((DATA32)tables->bright[g] << 8) | tables->bright[b];
+    }
+}
 
-        // Convert RGB to HSV
-        int cmax = MAX3(r, g, b);
-        int cmin = MIN3(r, g, b);
-        int delta = cmax - cmin;
-        float brightness = cmax / 255.0f;
-        float saturation;
-        if (cmax != 0)
-            saturation = delta / (float)cmax;
-        else
-            saturation = 0;
-        float hue;
-        if (saturation == 0) {
-            hue = 0;
-        } else {
-            float redc = (cmax - r) / (float)delta;
-            float greenc = (cmax - g) / (float)delta;
-            float bluec = (cmax - b) / (float)delta;
-            if (r == cmax)
-                hue = bluec - greenc;
-            else if (g == cmax)
-                hue = 2.0f + redc - bluec;
-            else
-                hue = 4.0f + greenc - redc;
-            hue = hue / 6.0f;
-            if (hue < 0)
-                hue = hue + 1.0f;
-        }
+// The HSV conversion is done on several pixels at a time with the GCC vector extensions: 4 with SSE2, or 8 when
+// building for AVX2 (e.g. with -march=native). The operations are the same as in adjust_saturation(), in the same
+// order, so the results are identical. Only enabled on x86-64, where scalar float math uses SSE registers as well.
+#if defined(__x86_64__) && (defined(__clang__) || __GNUC__ >= 9)
+#define ASB_VECTORIZED
+#ifdef __AVX2__
+#define ASB_LANES 8
+#else
+#define ASB_LANES 4
+#endif
 
-        // Adjust H, S
-        saturation += satur_adjust;
-        saturation = CLAMP(saturation, 0.0, 1.0);
+typedef float AsbFloats __attribute__((vector_size(ASB_LANES * sizeof(float))));
+typedef int AsbInts __attribute__((vector_size(ASB_LANES * sizeof(int))));
 
-        a *= alpha_adjust;
-        a = CLAMP(a, 0, 255);
+#define ASB_INLINE static inline __attribute__((always_inline))
 
-        // Convert HSV to RGB
-        if (saturation == 0) {
-            r = g = b = (int)(brightness * 255.0f + 0.5f);
-        } else {
-            float h2 = (hue - (int)hue) * 6.0f;
-            float f = h2 - (int)(h2);
-            float p = brightness * (1.0f - saturation);
-            float q = brightness * (1.0f - saturation * f);
-            float t = brightness * (1.0f - (saturation * (1.0f - f)));
+ASB_INLINE AsbInts asb_select(AsbInts mask, AsbInts x, AsbInts y)
+{
+    return (mask & x) | (~mask & y);
+}
 
-            switch ((int)h2) {
-            case 0:
-                r = (int)(brightness * 255.0f + 0.5f);
-                g = (int)(t * 255.0f + 0.5f);
-                b = (int)(p * 255.0f + 0.5f);
-                break;
-            case 1:
-                r = (int)(q * 255.0f + 0.5f);
-                g = (int)(brightness * 255.0f + 0.5f);
-                b = (int)(p * 255.0f + 0.5f);
-                break;
-            case 2:
-                r = (int)(p * 255.0f + 0.5f);
-                g = (int)(brightness * 255.0f + 0.5f);
-                b = (int)(t * 255.0f + 0.5f);
-                break;
-            case 3:
-                r = (int)(p * 255.0f + 0.5f);
-                g = (int)(q * 255.0f + 0.5f);
-                b = (int)(brightness * 255.0f + 0.5f);
-                break;
-            case 4:
-                r = (int)(t * 255.0f + 0.5f);
-                g = (int)(p * 255.0f + 0.5f);
-                b = (int)(brightness * 255.0f + 0.5f);
-                break;
-            case 5:
-                r = (int)(brightness * 255.0f + 0.5f);
-                g = (int)(p * 255.0f + 0.5f);
-                b = (int)(q * 255.0f + 0.5f);
-                break;
-            }
+ASB_INLINE AsbFloats asb_select_float(AsbInts mask, AsbFloats x, AsbFloats y)
+{
+    return (AsbFloats)asb_select(mask, (AsbInts)x, (AsbInts)y);
+}
+
+ASB_INLINE AsbInts asb_to_int(AsbFloats x)
+{
+    return __builtin_convertvector(x, AsbInts);
+}
+
+ASB_INLINE AsbFloats asb_to_float(AsbInts x)
+{
+    return __builtin_convertvector(x, AsbFloats);
+}
+
+// Picks the value for each lane from the hue sector; lanes outside [0, 5] keep the original value,
+// like the switch in adjust_saturation().
+ASB_INLINE AsbInts asb_pick_sector(AsbInts sector,
+                                   AsbInts original,
+                                   AsbInts c0,
+                                   AsbInts c1,
+                                   AsbInts c2,
+                                   AsbInts c3,
+                                   AsbInts c4,
+                                   AsbInts c5)
+{
+    AsbInts result = original;
+    result = asb_select(sector == 0, c0, result);
+    result = asb_select(sector == 1, c1, result);
+    result = asb_select(sector == 2, c2, result);
+    result = asb_select(sector == 3, c3, result);
+    result = asb_select(sector == 4, c4, result);
+    result = asb_select(sector == 5, c5, result);
+    return result;
+}
+
+ASB_INLINE void asb_adjust_saturation(AsbInts *red, AsbInts *green, AsbInts *blue, float satur_adjust)
+{
+    const AsbInts zero = {0};
+    const AsbInts one = zero + 1;
+    const AsbFloats zerof = {0};
+    const AsbFloats onef = zerof + 1.0f;
+    AsbInts r = *red;
+    AsbInts g = *green;
+    AsbInts b = *blue;
+
+    // Convert RGB to HSV
+    AsbInts cmax = asb_select(r > g, r, g);
+    cmax = asb_select(cmax > b, cmax, b);
+    AsbInts cmin = asb_select(r < g, r, g);
+    cmin = asb_select(cmin < b, cmin, b);
+    AsbInts delta = cmax - cmin;
+    AsbFloats brightness = asb_to_float(cmax) / 255.0f;
+    // Divide by one instead of zero; the result is zero either way
+    AsbFloats saturation = asb_to_float(delta) / asb_to_float(asb_select(cmax != 0, cmax, one));
+    AsbInts gray = delta == 0;
+    AsbFloats fdelta = asb_to_float(asb_select(gray, one, delta));
+    AsbFloats redc = asb_to_float(cmax - r) / fdelta;
+    AsbFloats greenc = asb_to_float(cmax - g) / fdelta;
+    AsbFloats bluec = asb_to_float(cmax - b) / fdelta;
+    AsbFloats hue = asb_select_float(r == cmax,
+                                     bluec - greenc,
+                                     asb_select_float(g == cmax, 2.0f + redc - bluec, 4.0f + greenc - redc));
+    hue = hue / 6.0f;
+    hue = asb_select_float(hue < 0, hue + 1.0f, hue);
+    hue = asb_select_float(gray, zerof, hue);
+
+    // Adjust S
+    saturation += satur_adjust;
+    saturation = asb_select_float(saturation > 1.0f, onef, asb_select_float(saturation < 0.0f, zerof, saturation));
+
+    // Convert HSV to RGB
+    AsbFloats h2 = (hue - asb_to_float(asb_to_int(hue))) * 6.0f;
+    AsbInts sector = asb_to_int(h2);
+    AsbFloats f = h2 - asb_to_float(sector);
+    AsbFloats p = brightness * (1.0f - saturation);
+    AsbFloats q = brightness * (1.0f - saturation * f);
+    AsbFloats t = brightness * (1.0f - (saturation * (1.0f - f)));
+    AsbInts vi = asb_to_int(brightness * 255.0f + 0.5f);
+    AsbInts pi = asb_to_int(p * 255.0f + 0.5f);
+    AsbInts qi = asb_to_int(q * 255.0f + 0.5f);
+    AsbInts ti = asb_to_int(t * 255.0f + 0.5f);
+    AsbInts gray_after = saturation == 0.0f;
+    *red = asb_select(gray_after, vi, asb_pick_sector(sector, r, vi, qi, pi, pi, ti, vi));
+    *green = asb_select(gray_after, vi, asb_pick_sector(sector, g, ti, vi, vi, qi, pi, pi));
+    *blue = asb_select(gray_after, vi, asb_pick_sector(sector, b, pi, pi, ti, vi, vi, qi));
+}
+
+static void adjust_asb_vector(DATA32 *data, int n, float satur_adjust, const AsbTables *tables)
+{
+    int id = 0;
+    for (; id + ASB_LANES <= n; id += ASB_LANES) {
+        AsbInts argb;
+        memcpy(&argb, data + id, sizeof(argb));
+        AsbInts r = (argb >> 16) & 0xff;
+        AsbInts g = (argb >> 8) & 0xff;
+        AsbInts b = argb & 0xff;
+        asb_adjust_saturation(&r, &g, &b, satur_adjust);
+        for (int k = 0; k < ASB_LANES; k++) {
+            DATA32 a = (data[id + k] >> 24) & 0xff;
+            // transparent => nothing to do.
+            if (a == 0)
+                continue;
+            data[id + k] = ((DATA32)tables->alpha[a] << 24) | ((DATA32)tables->bright[r[k]] << 16) |
+                           ((DATA32)tables->bright[g[k]] << 8) | tables->bright[b[k]];
         }
+    }
+    adjust_asb_scalar(data + id, n - id, satur_adjust, tables);
+}
+#endif
 
-        r += bright_adjust * 255;
-        g += bright_adjust * 255;
-        b += bright_adjust * 255;
+typedef enum AsbKernel { ASB_KERNEL_AUTO = 0, ASB_KERNEL_SCALAR } AsbKernel;
 
-        r = CLAMP(r, 0, 255);
-        g = CLAMP(g, 0, 255);
-        b = CLAMP(b, 0, 255);
+static void adjust_asb_with_kernel(DATA32 *data,
+                                   int w,
+                                   int h,
+                                   float alpha_adjust,
+                                   float satur_adjust,
+                                   float bright_adjust,
+                                   AsbKernel kernel)
+{
+    if (alpha_adjust == 1.0f && satur_adjust == 0 && bright_adjust == 0)
+        return;
+    const AsbTables *tables = get_asb_tables(alpha_adjust, bright_adjust);
+    int n = w * h;
+
+    // Without a saturation change, the HSV round trip gives back the same color, so only the tables are needed
+    if (satur_adjust == 0) {
+        if (bright_adjust == 0) {
+            for (int id = 0; id < n; id++) {
+                DATA32 a = data[id] >> 24;
+                data[id] = ((DATA32)tables->alpha[a] << 24) | (data[id] & 0xffffff);
+            }
+        } else {
+            for (int id = 0; id < n; id++) {
+                DATA32 argb = data[id];
+                DATA32 a = argb >> 24;
+                if (a == 0)
+                    continue;
+                data[id] = ((DATA32)tables->alpha[a] << 24) | ((DATA32)tables->bright[(argb >> 16) & 0xff] << 16) |
+                           ((DATA32)tables->bright[(argb >> 8) & 0xff] << 8) | tables->bright[argb & 0xff];
+            }
+        }
+        return;
+    }
 
-        argb = a;
-        argb = (argb << 8) + r;
-        argb = (argb << 8) + g;
-        argb = (argb << 8) + b;
-        data[id] = argb;
+#ifdef ASB_VECTORIZED
+    if (kernel != ASB_KERNEL_SCALAR) {
+        adjust_asb_vector(data, n, satur_adjust, tables);
+        return;
     }
+#endif
+    adjust_asb_scalar(data, n, satur_adjust, tables);
+}
+
+void adjust_asb(DATA32 *data, int w, int h, float alpha_adjust, float satur_adjust, float bright_adjust)
+{
+    adjust_asb_with_kernel(data, w, h, alpha_adjust, satur_adjust, bright_adjust, ASB_KERNEL_AUTO);
 }
 
 void create_heuristic_mask(DATA32 *data, int w, int h)
@@ -728,6 +949,44 @@ void render_image(Drawable d, int x, int y)
     XFreePixmap(server.display, pixmap);
 }
 
+void render_image_to_cairo(cairo_t *c, int x, int y)
+{
+    int w = imlib_image_get_width(), h = imlib_image_get_height();
+    gboolean has_alpha = imlib_image_has_alpha();
+    DATA32 *data = imlib_image_get_data_for_reading_only();
+
+    // Imlib2 uses non-premultiplied ARGB, cairo premultiplied ARGB
+    cairo_surface_t *image = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+    cairo_surface_flush(image);
+    unsigned char *dst = cairo_image_surface_get_data(image);
+    int stride = cairo_image_surface_get_stride(image);
+    for (int j = 0; j < h; j++) {
+        DATA32 *row = (DATA32 *)(dst + j * stride);
+        for (int i = 0; i < w; i++) {
+            DATA32 argb = data[j * w + i];
+            DATA32 alpha = has_alpha ? (argb >> 24) & 0xff : 0xff;
+            if (alpha == 0xff) {
+                row[i] = argb | 0xff000000;
+            } else if (alpha == 0) {
+                row[i] = 0;
+            } else {
+                DATA32 r = ((argb >> 16) & 0xff) * alpha / 255;
+                DATA32 g = ((argb >> 8) & 0xff) * alpha / 255;
+                DATA32 b = (argb & 0xff) * alpha / 255;
+                row[i] = (alpha << 24) | (r << 16) | (g << 8) | b;
+            }
+        }
+    }
+    cairo_surface_mark_dirty(image);
+
+    cairo_save(c);
+    cairo_set_source_surface(c, image, x, y);
+    cairo_rectangle(c, x, y, w, h);
+    cairo_fill(c);
+    cairo_restore(c);
+    cairo_surface_destroy(image);
+}
+
 gboolean is_color_attribute(PangoAttribute *attr, gpointer user_data)
 {
     return attr->klass->type == PANGO_ATTR_FOREGROUND ||
@@ -757,6 +1016,28 @@ gboolean layout_set_markup_strip_colors(PangoLayout *layout, const char *markup)
     return TRUE;
 }
 
+gboolean layout_set_text_or_markup(PangoLayout *layout, const char *text, int text_len, gboolean markup)
+{
+    gboolean valid = TRUE;
+    PangoAttrList *attrs = NULL;
+    char *markup_text = NULL;
+    if (markup) {
+        GError *error = NULL;
+        valid = pango_parse_markup(text, text_len, 0, &attrs, &markup_text, NULL, &error);
+        if (!valid)
+            g_error_free(error);
+    }
+    pango_layout_set_attributes(layout, attrs);
+    if (markup_text)
+        pango_layout_set_text(layout, markup_text, -1);
+    else
+        pango_layout_set_text(layout, text, text_len);
+    if (attrs)
+        pango_attr_list_unref(attrs);
+    g_free(markup_text);
+    return valid;
+}
+
 void draw_shadow(cairo_t *c, int posx, int posy, PangoLayout *shadow_layout)
 {
     const int shadow_size = 3;
@@ -788,51 +1069,247 @@ void draw_text(PangoLayout *layout, cairo_t *c, int posx, int posy, Color *color
     pango_cairo_show_layout(c, layout);
 }
 
-Imlib_Image load_image(const char *path, int cached)
-{
-    Imlib_Image image;
-    static unsigned long counter = 0;
-    if (debug_icons)
-        fprintf(stderr, "tint2: loading icon %s\n", path);
-    image = imlib_load_image(path);
 #ifdef HAVE_RSVG
-    if (!image && g_str_has_suffix(path, ".svg")) {
-        char tmp_filename[128];
-        snprintf(tmp_filename, sizeof(tmp_filename), "/tmp/tint2-%d-%lu.png", (int)getpid(), counter);
-        counter++;
-        int fd = open(tmp_filename, O_CREAT | O_EXCL, 0600);
-        if (fd >= 0) {
-            // We fork here because librsvg allocates memory like crazy
-            pid_t pid = fork();
-            if (pid == 0) {
-                // Child
-                GError *err = NULL;
-                RsvgHandle *svg = rsvg_handle_new_from_file(path, &err);
-
-                if (err != NULL) {
-                    fprintf(stderr, "tint2: Could not load svg image!: %s", err->message);
-                    g_error_free(err);
+// SVG documents larger than this are not rendered, since librsvg memory use grows with the document
+#define SVG_MAX_FILE_SIZE (4 << 20)
+// Largest rendered size of an SVG image, in pixels
+#define SVG_MAX_RASTER_SIZE 1024
+// Total size of the rendered images kept in raster_cache
+#define RASTER_CACHE_MAX_BYTES (8 << 20)
+
+typedef struct RasterEntry {
+    // "size:path"
+    gchar *key;
+    time_t mtime;
+    off_t file_size;
+    int width;
+    int height;
+    // Non-premultiplied ARGB, as used by Imlib2
+    DATA32 *data;
+    // Position in raster_lru
+    GList *lru_link;
+} RasterEntry;
+
+// Rendered SVG images, keyed by path and requested size, so that reloading the icons does not render them again.
+// key -> RasterEntry *
+static GHashTable *raster_cache = NULL;
+// Most recently used entries first
+static GQueue raster_lru = G_QUEUE_INIT;
+static size_t raster_cache_bytes = 0;
+
+static void free_raster_entry(gpointer data)
+{
+    RasterEntry *entry = (RasterEntry *)data;
+    raster_cache_bytes -= (size_t)entry->width * (size_t)entry->height * sizeof(DATA32);
+    g_free(entry->key);
+    free(entry->data);
+    g_free(entry);
+}
+
+static Imlib_Image create_image_from_raster(RasterEntry *entry)
+{
+    Imlib_Image image = imlib_create_image_using_copied_data(entry->width, entry->height, entry->data);
+    if (image) {
+        imlib_context_set_image(image);
+        imlib_image_set_has_alpha(1);
+    }
+    return image;
+}
+
+// Renders an SVG document so that its largest side is size pixels (or at its natural size, if size is zero).
+// The result is non-premultiplied ARGB data, which the caller must free.
+static DATA32 *render_svg(const char *path, int size, int *width, int *height)
+{
+    GError *err = NULL;
+    RsvgHandle *svg = rsvg_handle_new_from_file(path, &err);
+    if (err != NULL) {
+        fprintf(stderr, "tint2: Could not load svg image!: %s\n", err->message);
+        g_error_free(err);
+        return NULL;
+    }
+
+    double doc_w, doc_h;
+#if LIBRSVG_CHECK_VERSION(2, 52, 0)
+    if (!rsvg_handle_get_intrinsic_size_in_pixels(svg, &doc_w, &doc_h)) {
+        // The size is relative (e.g. a percentage), use the viewBox instead
+        gboolean has_viewbox;
+        RsvgRectangle viewbox;
+        rsvg_handle_get_intrinsic_dimensions(svg, NULL, NULL, NULL, NULL, &has_viewbox, &viewbox);
+        doc_w = has_viewbox ? viewbox.width : 0;
+        doc_h = has_viewbox ? viewbox.height : 0;
+    }
+#else
+    RsvgDimensionData dimensions;
+    rsvg_handle_get_dimensions(svg, &dimensions);
+    doc_w = dimensions.width;
+    doc_h = dimensions.height;
+#endif
+    int w = (int)(doc_w + 0.5);
+    int h = (int)(doc_h + 0.5);
+    if (w <= 0 || h <= 0) {
+        g_object_unref(svg);
+        return NULL;
+    }
+    if (size <= 0)
+        size = MAX(w, h);
+    size = MIN(size, SVG_MAX_RASTER_SIZE);
+    double scale = size / (double)MAX(w, h);
+    w = MAX(1, (int)(w * scale + 0.5));
+    h = MAX(1, (int)(h * scale + 0.5));
+
+    cairo_surface_t *cs = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+    cairo_t *c = cairo_create(cs);
+#if LIBRSVG_CHECK_VERSION(2, 52, 0)
+    RsvgRectangle viewport = {0, 0, w, h};
+    gboolean ok = rsvg_handle_render_document(svg, c, &viewport, NULL);
+#else
+    cairo_scale(c, w / doc_w, h / doc_h);
+    gboolean ok = rsvg_handle_render_cairo(svg, c);
+#endif
+    cairo_destroy(c);
+    g_object_unref(svg);
+    cairo_surface_flush(cs);
+
+    DATA32 *data = NULL;
+    if (ok && cairo_surface_status(cs) == CAIRO_STATUS_SUCCESS) {
+        data = (DATA32 *)malloc((size_t)w * (size_t)h * sizeof(DATA32));
+        const unsigned char *src = cairo_image_surface_get_data(cs);
+        int stride = cairo_image_surface_get_stride(cs);
+        // Cairo uses premultiplied ARGB, Imlib2 non-premultiplied ARGB
+        for (int j = 0; j < h; j++) {
+            const DATA32 *row = (const DATA32 *)(src + j * stride);
+            for (int i = 0; i < w; i++) {
+                DATA32 argb = row[i];
+                DATA32 alpha = argb >> 24;
+                if (alpha == 0xff || alpha == 0) {
+                    data[j * w + i] = argb;
                 } else {
-                    GdkPixbuf *pixbuf = rsvg_handle_get_pixbuf(svg);
-                    gdk_pixbuf_save(pixbuf, tmp_filename, "png", NULL, NULL);
+                    DATA32 r = (((argb >> 16) & 0xff) * 255 + alpha / 2) / alpha;
+                    DATA32 g = (((argb >> 8) & 0xff) * 255 + alpha / 2) / alpha;
+                    DATA32 b = ((argb & 0xff) * 255 + alpha / 2) / alpha;
+                    data[j * w + i] = (alpha << 24) | (MIN(r, 255) << 16) | (MIN(g, 255) << 8) | MIN(b, 255);
                 }
-                _exit(0);
-            } else {
-                // Parent
-                close(fd);
-                waitpid(pid, 0, 0);
-                image = imlib_load_image_immediately(tmp_filename);
-                unlink(tmp_filename);
             }
         }
+        *width = w;
+        *height = h;
+    }
+    cairo_surface_destroy(cs);
+#ifdef __GLIBC__
+    // librsvg allocates memory like crazy; give the freed heap back to the system
+    malloc_trim(0);
+#endif
+    return data;
+}
+
+static Imlib_Image load_svg_image(const char *path, int size, int cached)
+{
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return NULL;
+    if (st.st_size > SVG_MAX_FILE_SIZE) {
+        fprintf(stderr, "tint2: svg image too large, not loading: %s\n", path);
+        return NULL;
+    }
+
+    if (!raster_cache)
+        raster_cache = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free_raster_entry);
+    gchar *key = g_strdup_printf("%d:%s", size, path);
+    RasterEntry *entry = cached ? (RasterEntry *)g_hash_table_lookup(raster_cache, key) : NULL;
+    if (entry && entry->mtime == st.st_mtime && entry->file_size == st.st_size) {
+        g_free(key);
+        g_queue_unlink(&raster_lru, entry->lru_link);
+        g_queue_push_head_link(&raster_lru, entry->lru_link);
+        return create_image_from_raster(entry);
+    }
+    if (entry) {
+        g_queue_delete_link(&raster_lru, entry->lru_link);
+        g_hash_table_remove(raster_cache, key);
+    }
+
+    int width, height;
+    DATA32 *data = render_svg(path, size, &width, &height);
+    if (!data) {
+        g_free(key);
+        return NULL;
+    }
+    entry = g_new0(RasterEntry, 1);
+    entry->key = key;
+    entry->mtime = st.st_mtime;
+    entry->file_size = st.st_size;
+    entry->width = width;
+    entry->height = height;
+    entry->data = data;
+    raster_cache_bytes += (size_t)width * (size_t)height * sizeof(DATA32);
+    Imlib_Image image = create_image_from_raster(entry);
+    if (!cached) {
+        free_raster_entry(entry);
+        return image;
+    }
+
+    g_queue_push_head(&raster_lru, entry);
+    entry->lru_link = raster_lru.head;
+    g_hash_table_insert(raster_cache, entry->key, entry);
+    while (raster_cache_bytes > RASTER_CACHE_MAX_BYTES && g_queue_get_length(&raster_lru) > 1) {
+        RasterEntry *oldest = (RasterEntry *)g_queue_pop_tail(&raster_lru);
+        g_hash_table_remove(raster_cache, oldest->key);
+    }
+    return image;
+}
+#endif
+
+void cleanup_image_cache()
+{
+#ifdef HAVE_RSVG
+    if (raster_cache) {
+        g_queue_clear(&raster_lru);
+        g_hash_table_destroy(raster_cache);
+        raster_cache = NULL;
+    }
+#endif
+}
+
+Imlib_Image load_image(const char *path, int cached)
+{
+    return load_image_at_size(path, 0, cached);
+}
+
+Imlib_Image load_image_at_size(const char *path, int size, int cached)
+{
+    Imlib_Image image = NULL;
+    if (debug_icons)
+        fprintf(stderr, "tint2: loading icon %s\n", path);
+#ifdef HAVE_RSVG
+    // Render vector images directly at the size they will be displayed
+    if (g_str_has_suffix(path, ".svg")) {
+        image = load_svg_image(path, size, cached);
+        if (image)
+            return image;
     }
 #endif
+    image = imlib_load_image(path);
+    if (!image)
+        return NULL;
     imlib_context_set_image(image);
     imlib_image_set_changes_on_disk();
     return image;
 }
 
 Imlib_Image adjust_icon(Imlib_Image original, int alpha, int saturation, int brightness)
+{
+    return adjust_icon_twice(original, alpha, saturation, brightness, 100, 0, 0);
+}
+
+// Number of pixels adjusted at a time by adjust_icon_twice, small enough to stay in the L1 cache
+#define ADJUST_ICON_CHUNK 1024
+
+Imlib_Image adjust_icon_twice(Imlib_Image original,
+                              int alpha,
+                              int saturation,
+                              int brightness,
+                              int alpha2,
+                              int saturation2,
+                              int brightness2)
 {
     if (!original)
         return NULL;
@@ -843,12 +1320,12 @@ Imlib_Image adjust_icon(Imlib_Image original, int alpha, int saturation, int bri
     imlib_context_set_image(copy);
     imlib_image_set_has_alpha(1);
     DATA32 *data = imlib_image_get_data();
-    adjust_asb(data,
-               imlib_image_get_width(),
-               imlib_image_get_height(),
-               alpha / 100.0,
-               saturation / 100.0,
-               brightness / 100.0);
+    int n = imlib_image_get_width() * imlib_image_get_height();
+    for (int i = 0; i < n; i += ADJUST_ICON_CHUNK) {
+        int count = MIN(ADJUST_ICON_CHUNK, n - i);
+        adjust_asb(data + i, count, 1, alpha / 100.0, saturation / 100.0, brightness / 100.0);
+        adjust_asb(data + i, count, 1, alpha2 / 100.0, saturation2 / 100.0, brightness2 / 100.0);
+    }
     imlib_image_put_back_data(data);
     return copy;
 }
@@ -922,6 +1399,148 @@ void clear_pixmap(Pixmap p, int x, int y, int w, int h)
     XRenderFreePicture(server.display, pict);
 }
 
+// Text layout and measurement.
+// Pango contexts are created directly from the font map, so no X requests are needed.
+// The font options of the X visual are copied once, so that the metrics match those of the actual rendering.
+
+#define TEXT_SIZE_CACHE_MAX_ENTRIES 512
+
+typedef struct TextSizeKey {
+    PangoFontDescription *font;
+    char *text;
+    int text_len;
+    int available_height;
+    int available_width;
+    PangoWrapMode wrap;
+    PangoEllipsizeMode ellipsis;
+    PangoAlignment alignment;
+    gboolean markup;
+    double scale;
+} TextSizeKey;
+
+typedef struct TextSizeEntry {
+    TextSizeKey key;
+    int height;
+    int width;
+    // Position in text_size_lru
+    GList *lru_link;
+} TextSizeEntry;
+
+static cairo_font_options_t *text_font_options = NULL;
+
+// All measurements share one layout.
+// The results are kept in a LRU cache, since most areas re-measure the same strings on every resize.
+static PangoLayout *text_measure_layout = NULL;
+static double text_measure_scale = 0;
+// TextSizeKey * -> TextSizeEntry *
+static GHashTable *text_size_cache = NULL;
+// Most recently used entries first
+static GQueue text_size_lru = G_QUEUE_INIT;
+
+static guint text_size_key_hash(gconstpointer data)
+{
+    const TextSizeKey *key = (const TextSizeKey *)data;
+    guint h = pango_font_description_hash(key->font);
+    for (int i = 0; i < key->text_len; i++)
+        h = h * 31 + (guchar)key->text[i];
+    h = h * 31 + (guint)key->available_height;
+    h = h * 31 + (guint)key->available_width;
+    h = h * 31 + (guint)(key->wrap | key->ellipsis << 4 | key->alignment << 8 | key->markup << 12);
+    h = h * 31 + (guint)(key->scale * 1000);
+    return h;
+}
+
+static gboolean text_size_key_equal(gconstpointer a, gconstpointer b)
+{
+    const TextSizeKey *ka = (const TextSizeKey *)a;
+    const TextSizeKey *kb = (const TextSizeKey *)b;
+    return ka->text_len == kb->text_len && ka->available_height == kb->available_height &&
+           ka->available_width == kb->available_width && ka->wrap == kb->wrap && ka->ellipsis == kb->ellipsis &&
+           ka->alignment == kb->alignment && ka->markup == kb->markup && ka->scale == kb->scale &&
+           memcmp(ka->text, kb->text, ka->text_len) == 0 && pango_font_description_equal(ka->font, kb->font);
+}
+
+static void free_text_size_entry(gpointer data)
+{
+    TextSizeEntry *entry = (TextSizeEntry *)data;
+    pango_font_description_free(entry->key.font);
+    g_free(entry->key.text);
+    g_free(entry);
+}
+
+PangoLayout *create_text_layout(double scale)
+{
+    if (!text_font_options) {
+        // Use the same font options (antialiasing, hinting) as the xlib surfaces we draw on
+        Pixmap pmap = XCreatePixmap(server.display, server.root_win, 1, 1, server.depth);
+        cairo_surface_t *cs = cairo_xlib_surface_create(server.display, pmap, server.visual, 1, 1);
+        text_font_options = cairo_font_options_create();
+        cairo_surface_get_font_options(cs, text_font_options);
+        cairo_surface_destroy(cs);
+        XFreePixmap(server.display, pmap);
+    }
+    PangoContext *context = pango_font_map_create_context(pango_cairo_font_map_get_default());
+    pango_cairo_context_set_font_options(context, text_font_options);
+    pango_cairo_context_set_resolution(context, 96 * scale);
+    PangoLayout *layout = pango_layout_new(context);
+    g_object_unref(context);
+    return layout;
+}
+
+void set_text_layout_scale(PangoLayout *layout, double scale)
+{
+    pango_cairo_context_set_resolution(pango_layout_get_context(layout), 96 * scale);
+    pango_layout_context_changed(layout);
+}
+
+static void init_text_measure_context()
+{
+    text_measure_layout = create_text_layout(1.0);
+    text_measure_scale = 1.0;
+
+    text_size_cache = g_hash_table_new_full(text_size_key_hash, text_size_key_equal, NULL, free_text_size_entry);
+    g_queue_init(&text_size_lru);
+}
+
+void cleanup_text_size_cache()
+{
+    if (text_measure_layout) {
+        g_queue_clear(&text_size_lru);
+        g_hash_table_destroy(text_size_cache);
+        text_size_cache = NULL;
+        g_object_unref(text_measure_layout);
+        text_measure_layout = NULL;
+    }
+    if (text_font_options) {
+        cairo_font_options_destroy(text_font_options);
+        text_font_options = NULL;
+    }
+}
+
+// Returns FALSE if the markup is invalid, in which case the text is measured as plain text.
+static gboolean measure_text(const TextSizeKey *key, int *height, int *width)
+{
+    if (key->scale != text_measure_scale) {
+        set_text_layout_scale(text_measure_layout, key->scale);
+        text_measure_scale = key->scale;
+    }
+    PangoLayout *layout = text_measure_layout;
+    pango_layout_set_width(layout, key->available_width * PANGO_SCALE);
+    pango_layout_set_height(layout, key->available_height * PANGO_SCALE);
+    pango_layout_set_alignment(layout, key->alignment);
+    pango_layout_set_wrap(layout, key->wrap);
+    pango_layout_set_ellipsize(layout, key->ellipsis);
+    pango_layout_set_font_description(layout, key->font);
+    // The layout is reused, so the attributes of the previous markup must not leak into this text
+    gboolean valid = layout_set_text_or_markup(layout, key->text, key->text_len, key->markup);
+
+    PangoRectangle rect_ink, rect;
+    pango_layout_get_pixel_extents(layout, &rect_ink, &rect);
+    *height = rect.height;
+    *width = rect.width;
+    return valid;
+}
+
 void get_text_size(const PangoFontDescription *font,
                    int *height,
                    int *width,
@@ -935,42 +1554,47 @@ void get_text_size(const PangoFontDescription *font,
                    gboolean markup,
                    double scale)
 {
-    PangoRectangle rect_ink, rect;
-
-    available_width = MAX(0, available_width);
-    available_height = MAX(0, available_height);
-
-    Pixmap pmap = XCreatePixmap(server.display, server.root_win, available_height, available_width, server.depth);
-    cairo_surface_t *cs =
-        cairo_xlib_surface_create(server.display, pmap, server.visual, available_height, available_width);
-    cairo_t *c = cairo_create(cs);
-
-    PangoContext *context = pango_cairo_create_context(c);
-    pango_cairo_context_set_resolution(context, 96 * scale);
-    PangoLayout *layout = pango_layout_new(context);
-    pango_layout_set_width(layout, available_width * PANGO_SCALE);
-    pango_layout_set_height(layout, available_height * PANGO_SCALE);
-    pango_layout_set_alignment(layout, alignment);
-    pango_layout_set_wrap(layout, wrap);
-    pango_layout_set_ellipsize(layout, ellipsis);
-    pango_layout_set_font_description(layout, font);
-    text_len = MAX(0, text_len);
-    if (!markup)
-        pango_layout_set_text(layout, text, text_len);
-    else
-        pango_layout_set_markup(layout, text, text_len);
-
-    pango_layout_get_pixel_extents(layout, &rect_ink, &rect);
-    *height = rect.height;
-    *width = rect.width;
+    if (!text_measure_layout)
+        init_text_measure_context();
+
+    TextSizeKey key;
+    key.font = (PangoFontDescription *)font;
+    key.text = (char *)text;
+    key.text_len = MAX(0, text_len);
+    key.available_height = MAX(0, available_height);
+    key.available_width = MAX(0, available_width);
+    key.wrap = wrap;
+    key.ellipsis = ellipsis;
+    key.alignment = alignment;
+    key.markup = markup;
+    key.scale = scale;
+
+    TextSizeEntry *entry = (TextSizeEntry *)g_hash_table_lookup(text_size_cache, &key);
+    if (entry) {
+        g_queue_unlink(&text_size_lru, entry->lru_link);
+        g_queue_push_head_link(&text_size_lru, entry->lru_link);
+        *height = entry->height;
+        *width = entry->width;
+        return;
+    }
 
-    // fprintf(stderr, "tint2: dimension : %d - %d\n", rect_ink.height, rect.height);
+    // Invalid markup is measured as plain text, which must not be cached as the size of the markup
+    if (!measure_text(&key, height, width))
+        return;
 
-    g_object_unref(layout);
-    g_object_unref(context);
-    cairo_destroy(c);
-    cairo_surface_destroy(cs);
-    XFreePixmap(server.display, pmap);
+    if (g_queue_get_length(&text_size_lru) >= TEXT_SIZE_CACHE_MAX_ENTRIES) {
+        TextSizeEntry *oldest = (TextSizeEntry *)g_queue_pop_tail(&text_size_lru);
+        g_hash_table_remove(text_size_cache, &oldest->key);
+    }
+    entry = g_new0(TextSizeEntry, 1);
+    entry->key = key;
+    entry->key.font = pango_font_description_copy(font);
+    entry->key.text = g_strndup(text, key.text_len);
+    entry->height = *height;
+    entry->width = *width;
+    g_queue_push_head(&text_size_lru, entry);
+    entry->lru_link = text_size_lru.head;
+    g_hash_table_insert(text_size_cache, &entry->key, entry);
 }
 
 void get_text_size2(const PangoFontDescription *font,
@@ -988,36 +1612,44 @@ void get_text_size2(const PangoFontDescription *font,
 {
     get_text_size(font, height, width, available_height, available_width, text, text_len, wrap, ellipsis, alignment, markup, scale);
 
-    // We do multiple passes, because pango sucks
-    int actual_height, actual_width, overflow = 0;
-    while (true) {
-        get_text_size(font, &actual_height, &actual_width, *height, *width, text, text_len, wrap, ellipsis, alignment, markup, scale);
-        if (actual_height <= *height)
-            break;
-        if (*width >= available_width)
-            break;
-        overflow = 1;
-        fprintf(stderr, "tint2: text overflows, recomputing: available %dx%d, computed %dx%d, actual %dx%d: %s\n",
-                available_width,
-                available_height,
-                *width,
-                *height,
-                actual_width,
-                actual_height,
-                text);
-        (*width)++;
-    }
-    if (overflow) {
-        *height = actual_height;
-        fprintf(stderr, "tint2: text final size computed as: available %dx%d, computed %dx%d, actual %dx%d: %s\n",
-                available_width,
-                available_height,
-                *width,
-                *height,
-                actual_width,
-                actual_height,
-                text);
+    // We do multiple passes, because pango sucks:
+    // laying out the text again in a box of the computed size might not fit.
+    int actual_height, actual_width;
+    get_text_size(font, &actual_height, &actual_width, *height, *width, text, text_len, wrap, ellipsis, alignment, markup, scale);
+    if (actual_height <= *height || *width >= available_width)
+        return;
+
+    // Find the smallest width that fits, up to the available width.
+    // The wider the box, the less lines are needed, so we can bisect.
+    int computed_width = *width;
+    int computed_height = *height;
+    int lo = *width;
+    int hi = available_width;
+    get_text_size(font, &actual_height, &actual_width, *height, hi, text, text_len, wrap, ellipsis, alignment, markup, scale);
+    if (actual_height <= *height) {
+        while (hi - lo > 1) {
+            int mid = lo + (hi - lo) / 2;
+            int mid_height, mid_width;
+            get_text_size(font, &mid_height, &mid_width, *height, mid, text, text_len, wrap, ellipsis, alignment, markup, scale);
+            if (mid_height <= *height) {
+                hi = mid;
+                actual_height = mid_height;
+                actual_width = mid_width;
+            } else {
+                lo = mid;
+            }
+        }
     }
+    *width = hi;
+    *height = actual_height;
+    fprintf(stderr, "tint2: text overflows, final size computed as: available %dx%d, computed %dx%d, actual %dx%d: %s\n",
+            available_width,
+            available_height,
+            computed_width,
+            computed_height,
+            actual_width,
+            actual_height,
+            text);
 }
 
 #if !GLIB_CHECK_VERSION(2, 34, 0)
@@ -1088,14 +1720,6 @@ gint cmp_ptr(gconstpointer a, gconstpointer b)
         return 1;
 }
 
-void close_all_fds()
-{
-    long maxfd = sysconf(_SC_OPEN_MAX);
-    for (int fd = 3; fd < maxfd; fd++) {
-        close(fd);
-    }
-}
-
 GString *tint2_g_string_replace(GString *s, const char *from, const char *to)
 {
     GString *result = g_string_new("");
@@ -1226,3 +1850,222 @@ void dump_image_data(const char *file_name, const char *name)
 
     imlib_free_image();
 }
+
+// The per-pixel HSV implementation that adjust_asb() replaced; the results must stay identical.
+static void adjust_asb_reference(DATA32 *data, int w, int h, float alpha_adjust, float satur_adjust, float bright_adjust)
+{
+    for (int id = 0; id < w * h; id++) {
+        unsigned int argb = data[id];
+        int a = (argb >> 24) & 0xff;
+        // transparent => nothing to do.
+        if (a == 0)
+            continue;
+        int r = (argb >> 16) & 0xff;
+        int g = (argb >> 8) & 0xff;
+        int b = (argb)&0xff;
+
+        // Convert RGB to HSV
+        int cmax = MAX3(r, g, b);
+        int cmin = MIN3(r, g, b);
+        int delta = cmax - cmin;
+        float brightness = cmax / 255.0f;
+        float saturation;
+        if (cmax != 0)
+            saturation = delta / (float)cmax;
+        else
+            saturation = 0;
+        float hue;
+        if (saturation == 0) {
+            hue = 0;
+        } else {
+            float redc = (cmax - r) / (float)delta;
+            float greenc = (cmax - g) / (float)delta;
+            float bluec = (cmax - b) / (float)delta;
+            if (r == cmax)
+                hue = bluec - greenc;
+            else if (g == cmax)
+                hue = 2.0f + redc - bluec;
+            else
+                hue = 4.0f + greenc - redc;
+            hue = hue / 6.0f;
+            if (hue < 0)
+                hue = hue + 1.0f;
+        }
+
+        // Adjust H, S
+        saturation += satur_adjust;
+        saturation = CLAMP(saturation, 0.0, 1.0);
+
+        a *= alpha_adjust;
+        a = CLAMP(a, 0, 255);
+
+        // Convert HSV to RGB
+        if (saturation == 0) {
+            r = g = b = (int)(brightness * 255.0f + 0.5f);
+        } else {
+            float h2 = (hue - (int)hue) * 6.0f;
+            float f = h2 - (int)(h2);
+            float p = brightness * (1.0f - saturation);
+            float q = brightness * (1.0f - saturation * f);
+            float t = brightness * (1.0f - (saturation * (1.0f - f)));
+
+            switch ((int)h2) {
+            case 0:
+                r = (int)(brightness * 255.0f + 0.5f);
+                g = (int)(t * 255.0f + 0.5f);
+                b = (int)(p * 255.0f + 0.5f);
+                break;
+            case 1:
+                r = (int)(q * 255.0f + 0.5f);
+                g = (int)(brightness * 255.0f + 0.5f);
+                b = (int)(p * 255.0f + 0.5f);
+                break;
+            case 2:
+                r = (int)(p * 255.0f + 0.5f);
+                g = (int)(brightness * 255.0f + 0.5f);
+                b = (int)(t * 255.0f + 0.5f);
+                break;
+            case 3:
+                r = (int)(p * 255.0f + 0.5f);
+                g = (int)(q * 255.0f + 0.5f);
+                b = (int)(brightness * 255.0f + 0.5f);
+                break;
+            case 4:
+                r = (int)(t * 255.0f + 0.5f);
+                g = (int)(p * 255.0f + 0.5f);
+                b = (int)(brightness * 255.0f + 0.5f);
+                break;
+            case 5:
+                r = (int)(brightness * 255.0f + 0.5f);
+                g = (int)(p * 255.0f + 0.5f);
+                b = (int)(q * 255.0f + 0.5f);
+                break;
+            }
+        }
+
+        r += bright_adjust * 255;
+        g += bright_adjust * 255;
+        b += bright_adjust * 255;
+
+        r = CLAMP(r, 0, 255);
+        g = CLAMP(g, 0, 255);
+        b = CLAMP(b, 0, 255);
+
+        argb = a;
+        argb = (argb << 8) + r;
+        argb = (argb << 8) + g;
+        argb = (argb << 8) + b;
+        data[id] = argb;
+    }
+}
+
+static DATA32 asb_test_random(DATA32 *state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return *state;
+}
+
+static DATA32 *create_asb_test_image(int n)
+{
+    DATA32 *data = (DATA32 *)malloc((size_t)n * sizeof(DATA32));
+    DATA32 state = 42;
+    for (int i = 0; i < n; i++)
+        data[i] = asb_test_random(&state);
+    // Grays, primaries and fully transparent/opaque pixels
+    for (int i = 0; i < n && i < 256; i++) {
+        DATA32 alpha = (i % 4 == 0) ? 0 : (i % 4 == 1) ? 0xff : (DATA32)i;
+        DATA32 c = (DATA32)i;
+        data[i] = (alpha << 24) | (i % 3 == 0 ? (c << 16) | (c << 8) | c : (i % 3 == 1 ? c << 16 : c));
+    }
+    return data;
+}
+
+TEST(adjust_asb_matches_reference)
+{
+    const int n = 64 * 1024 + 3;
+    const float settings[][3] = {{1.0f, 0.0f, 0.0f},
+                                 {0.5f, 0.0f, 0.0f},
+                                 {2.0f, 0.0f, 0.0f},
+                                 {1.0f, 0.0f, 0.1f},
+                                 {0.8f, 0.0f, -0.3f},
+                                 {1.0f, -1.0f, 0.0f},
+                                 {1.0f, -0.5f, 0.0f},
+                                 {1.0f, 0.3f, 0.0f},
+                                 {1.0f, 1.0f, 0.0f},
+                                 {0.7f, -0.2f, 0.15f},
+                                 {1.5f, 0.6f, -0.9f},
+                                 {0.0f, 0.1f, 1.0f}};
+    const AsbKernel kernels[] = {ASB_KERNEL_AUTO, ASB_KERNEL_SCALAR};
+    DATA32 *original = create_asb_test_image(n);
+    DATA32 *expected = (DATA32 *)malloc(n * sizeof(DATA32));
+    DATA32 *actual = (DATA32 *)malloc(n * sizeof(DATA32));
+    for (size_t s = 0; s < sizeof(settings) / sizeof(settings[0]); s++) {
+        memcpy(expected, original, n * sizeof(DATA32));
+        adjust_asb_reference(expected, n, 1, settings[s][0], settings[s][1], settings[s][2]);
+        for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+            memcpy(actual, original, n * sizeof(DATA32));
+            adjust_asb_with_kernel(actual, n, 1, settings[s][0], settings[s][1], settings[s][2], kernels[k]);
+            for (int i = 0; i < n; i++) {
+                if (actual[i] != expected[i])
+                    printf("settings %d, kernel %d, pixel %08x: %08x != %08x\n",
+                           (int)s,
+                           (int)kernels[k],
+                           original[i],
+                           actual[i],
+                           expected[i]);
+                ASSERT_EQUAL(actual[i], expected[i]);
+            }
+        }
+    }
+    free(original);
+    free(expected);
+    free(actual);
+}
+
+BENCHMARK(adjust_asb)
+{
+    const int sizes[] = {16, 24, 32, 48, 64, 128, 256};
+    const float settings[][3] = {{0.5f, 0.0f, 0.0f}, {1.0f, 0.0f, 0.1f}, {0.7f, -0.5f, 0.1f}};
+    const char *setting_names[] = {"alpha", "brightness", "all"};
+    const AsbKernel kernels[] = {ASB_KERNEL_SCALAR, ASB_KERNEL_AUTO};
+    const char *kernel_names[] = {"scalar", "vector"};
+    const int pixels_per_size = 4 * 1024 * 1024;
+
+    for (size_t z = 0; z < sizeof(sizes) / sizeof(sizes[0]); z++) {
+        int n = sizes[z] * sizes[z];
+        int iterations = MAX(1, pixels_per_size / n);
+        DATA32 *original = create_asb_test_image(n);
+        DATA32 *data = (DATA32 *)malloc(n * sizeof(DATA32));
+        for (size_t s = 0; s < sizeof(settings) / sizeof(settings[0]); s++) {
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (int it = 0; it < iterations; it++) {
+                memcpy(data, original, n * sizeof(DATA32));
+                adjust_asb_reference(data, sizes[z], sizes[z], settings[s][0], settings[s][1], settings[s][2]);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            double reference_ms = (end.tv_sec - start.tv_sec) * 1.0e3 + (end.tv_nsec - start.tv_nsec) * 1.0e-6;
+            printf("%3dx%-3d %-10s reference: %8.3f ms", sizes[z], sizes[z], setting_names[s], reference_ms);
+            for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                for (int it = 0; it < iterations; it++) {
+                    memcpy(data, original, n * sizeof(DATA32));
+                    adjust_asb_with_kernel(data,
+                                           sizes[z],
+                                           sizes[z],
+                                           settings[s][0],
+                                           settings[s][1],
+                                           settings[s][2],
+                                           kernels[k]);
+                }
+                clock_gettime(CLOCK_MONOTONIC, &end);
+                printf(", %s: %8.3f ms",
+                       kernel_names[k],
+                       (end.tv_sec - start.tv_sec) * 1.0e3 + (end.tv_nsec - start.tv_nsec) * 1.0e-6);
+            }
+            printf("\n");
+        }
+        free(original);
+        free(data);
+    }
+}
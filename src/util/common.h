@@ -95,6 +95,14 @@ void get_color(char *hex, double *rgb);
 
 Imlib_Image load_image(const char *path, int cached);
 
+// Loads an image that will be displayed at size x size pixels. SVG images are rendered directly at that size;
+// if cached is set, the rendered images are kept and reused while the file does not change.
+// Other images are loaded at their natural size. A size of zero means the natural size for all images.
+Imlib_Image load_image_at_size(const char *path, int size, int cached);
+
+// Releases the rendered images kept by load_image_at_size.
+void cleanup_image_cache();
+
 // Adjusts the alpha/saturation/brightness on an ARGB image.
 // Parameters:
 // * alpha_adjust: multiplicative:
@@ -109,8 +117,18 @@ Imlib_Image load_image(const char *path, int cached);
 //   * -1 = black
 //   *  0 = no adjustment
 //   *  1 = white
+// Without a saturation adjustment, only lookup tables are used; the colors are not converted to HSV.
 void adjust_asb(DATA32 *data, int w, int h, float alpha_adjust, float satur_adjust, float bright_adjust);
 Imlib_Image adjust_icon(Imlib_Image original, int alpha, int saturation, int brightness);
+// Same as adjusting the icon twice, first with (alpha, saturation, brightness), then with
+// (alpha2, saturation2, brightness2), but done in a single pass without an intermediate image.
+Imlib_Image adjust_icon_twice(Imlib_Image original,
+                              int alpha,
+                              int saturation,
+                              int brightness,
+                              int alpha2,
+                              int saturation2,
+                              int brightness2);
 void adjust_color(Color *color, int alpha, int saturation, int brightness);
 
 void create_heuristic_mask(DATA32 *data, int w, int h);
@@ -118,6 +136,9 @@ void create_heuristic_mask(DATA32 *data, int w, int h);
 // Renders the current Imlib image to a drawable. Wrapper around imlib_render_image_on_drawable.
 void render_image(Drawable d, int x, int y);
 
+// Renders the current Imlib image to a cairo context, e.g. an image surface.
+void render_image_to_cairo(cairo_t *c, int x, int y);
+
 void get_text_size2(const PangoFontDescription *font,
                     int *height,
                     int *width,
@@ -131,7 +152,20 @@ void get_text_size2(const PangoFontDescription *font,
                     gboolean markup,
                     double scale);
 
+// Releases the layout and the cached results used by get_text_size2, and the font options shared by all text layouts.
+void cleanup_text_size_cache();
+
+// Creates a PangoLayout with its own context, set up like the xlib surfaces we draw on.
+PangoLayout *create_text_layout(double scale);
+
+// Changes the scale of a layout created with create_text_layout.
+void set_text_layout_scale(PangoLayout *layout, double scale);
+
 gboolean layout_set_markup_strip_colors(PangoLayout *layout, const char *markup);
+
+// Sets the text of a layout, replacing the attributes of the previous markup if any.
+// Invalid markup is set as plain text; returns FALSE in that case.
+gboolean layout_set_text_or_markup(PangoLayout *layout, const char *text, int text_len, gboolean markup);
 void draw_text(PangoLayout *layout, cairo_t *c, int posx, int posy, Color *color, PangoLayout *shadow_layout);
 
 // Draws a rounded rectangle
@@ -141,8 +175,6 @@ void draw_rect_on_sides(cairo_t *c, double x, double y, double w, double h, doub
 // Clears the pixmap (with transparent color)
 void clear_pixmap(Pixmap p, int x, int y, int w, int h);
 
-void close_all_fds();
-
 // Appends to the list locations all the directories contained in the environment variable var (split by ":").
 // Optional suffixes are added to each directory. The suffix arguments MUST end with NULL.
 // Returns the new value of the list.
@@ -0,0 +1,396 @@
+/**************************************************************************
+*
+* Copyright (C) 2017 tint2 authors
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+**************************************************************************/
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#define HAVE_EPOLL 1
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
+
+#include "reactor.h"
+#include "test.h"
+
+typedef struct ReactorHandler {
+    int fd;
+    ReactorCallback *callback;
+    void *arg;
+} ReactorHandler;
+
+// fd -> ReactorHandler *
+static GHashTable *handlers = NULL;
+
+#ifdef HAVE_EPOLL
+static int epoll_fd = -1;
+// Expires at the timeout of reactor_wait(), for a finer resolution than the milliseconds of epoll_wait
+static int timer_fd = -1;
+#endif
+
+static void (*wakeup_hook)() = NULL;
+
+// The poll() set, rebuilt only when the handlers change
+static struct pollfd *poll_fds = NULL;
+static int num_poll_fds = 0;
+static gboolean poll_fds_dirty = TRUE;
+
+void init_reactor()
+{
+    if (handlers)
+        return;
+    handlers = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, free);
+#ifdef HAVE_EPOLL
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        fprintf(stderr, "tint2: epoll_create1 failed: %s, falling back to poll()\n", strerror(errno));
+        return;
+    }
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd >= 0) {
+        struct epoll_event event = {.events = EPOLLIN, .data.fd = timer_fd};
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &event) != 0) {
+            close(timer_fd);
+            timer_fd = -1;
+        }
+    }
+#endif
+}
+
+void cleanup_reactor()
+{
+    if (handlers) {
+        g_hash_table_destroy(handlers);
+        handlers = NULL;
+    }
+#ifdef HAVE_EPOLL
+    if (timer_fd >= 0)
+        close(timer_fd);
+    timer_fd = -1;
+    if (epoll_fd >= 0)
+        close(epoll_fd);
+    epoll_fd = -1;
+#endif
+    free(poll_fds);
+    poll_fds = NULL;
+    num_poll_fds = 0;
+    poll_fds_dirty = TRUE;
+    wakeup_hook = NULL;
+}
+
+void reactor_add_fd(int fd, ReactorCallback *callback, void *arg)
+{
+    if (fd < 0)
+        return;
+    if (!handlers)
+        init_reactor();
+    ReactorHandler *handler = g_hash_table_lookup(handlers, GINT_TO_POINTER(fd));
+    if (!handler) {
+        handler = calloc(1, sizeof(ReactorHandler));
+        handler->fd = fd;
+        g_hash_table_insert(handlers, GINT_TO_POINTER(fd), handler);
+        poll_fds_dirty = TRUE;
+    }
+#ifdef HAVE_EPOLL
+    // Also when replacing: if the descriptor was closed and reused meanwhile, epoll has forgotten it
+    if (epoll_fd >= 0) {
+        struct epoll_event event = {.events = EPOLLIN, .data.fd = fd};
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0 && errno != EEXIST)
+            fprintf(stderr, "tint2: epoll_ctl failed for fd %d: %s\n", fd, strerror(errno));
+    }
+#endif
+    handler->callback = callback;
+    handler->arg = arg;
+}
+
+void reactor_remove_fd(int fd)
+{
+    if (!handlers || !g_hash_table_remove(handlers, GINT_TO_POINTER(fd)))
+        return;
+#ifdef HAVE_EPOLL
+    if (epoll_fd >= 0)
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+    poll_fds_dirty = TRUE;
+}
+
+void reactor_set_wakeup_hook(void (*hook)())
+{
+    wakeup_hook = hook;
+}
+
+// Looks up the handler at dispatch time, since an earlier callback of the same round may have removed it
+static gboolean dispatch(int fd)
+{
+    ReactorHandler *handler = g_hash_table_lookup(handlers, GINT_TO_POINTER(fd));
+    if (!handler)
+        return FALSE;
+    handler->callback(fd, handler->arg);
+    return TRUE;
+}
+
+static int timeout_to_ms(struct timeval *timeout)
+{
+    if (!timeout)
+        return -1;
+    // Round up, so that the timers have expired when we wake up
+    long long ms = (long long)timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000;
+    return ms > INT32_MAX ? INT32_MAX : (int)ms;
+}
+
+static int poll_wait(struct timeval *timeout)
+{
+    if (poll_fds_dirty) {
+        num_poll_fds = (int)g_hash_table_size(handlers);
+        poll_fds = realloc(poll_fds, MAX(1, num_poll_fds) * sizeof(struct pollfd));
+        GHashTableIter iter;
+        gpointer key;
+        int i = 0;
+        g_hash_table_iter_init(&iter, handlers);
+        while (g_hash_table_iter_next(&iter, &key, NULL)) {
+            poll_fds[i].fd = GPOINTER_TO_INT(key);
+            poll_fds[i].events = POLLIN;
+            i++;
+        }
+        poll_fds_dirty = FALSE;
+    }
+    int count = poll(poll_fds, (nfds_t)num_poll_fds, timeout_to_ms(timeout));
+    if (count <= 0)
+        return count;
+    // Callbacks may change the set, so collect the ready descriptors first
+    int *ready = malloc(count * sizeof(int));
+    int num_ready = 0;
+    for (int i = 0; i < num_poll_fds && num_ready < count; i++) {
+        if (poll_fds[i].revents)
+            ready[num_ready++] = poll_fds[i].fd;
+    }
+    if (wakeup_hook)
+        wakeup_hook();
+    int dispatched = 0;
+    for (int i = 0; i < num_ready; i++)
+        dispatched += dispatch(ready[i]);
+    free(ready);
+    return dispatched;
+}
+
+#ifdef HAVE_EPOLL
+static int epoll_wait_and_dispatch(struct timeval *timeout)
+{
+    int timeout_ms = timeout_to_ms(timeout);
+    if (timer_fd >= 0 && timeout && (timeout->tv_sec || timeout->tv_usec)) {
+        struct itimerspec spec = {};
+        spec.it_value.tv_sec = timeout->tv_sec;
+        spec.it_value.tv_nsec = timeout->tv_usec * 1000;
+        if (timerfd_settime(timer_fd, 0, &spec, NULL) == 0)
+            timeout_ms = -1;
+    }
+
+    struct epoll_event events[64];
+    int count = epoll_wait(epoll_fd, events, sizeof(events) / sizeof(events[0]), timeout_ms);
+    if (timer_fd >= 0 && timeout_ms < 0 && timeout) {
+        // Disarm, whether it fired or not
+        struct itimerspec spec = {};
+        timerfd_settime(timer_fd, 0, &spec, NULL);
+    }
+    if (count <= 0)
+        return count;
+
+    if (wakeup_hook)
+        wakeup_hook();
+    int dispatched = 0;
+    for (int i = 0; i < count; i++) {
+        int fd = events[i].data.fd;
+        if (fd == timer_fd) {
+            uint64_t expirations;
+            ssize_t unused = read(timer_fd, &expirations, sizeof(expirations));
+            (void)unused;
+            continue;
+        }
+        dispatched += dispatch(fd);
+    }
+    return dispatched;
+}
+#endif
+
+int reactor_wait(struct timeval *timeout)
+{
+    if (!handlers)
+        init_reactor();
+#ifdef HAVE_EPOLL
+    if (epoll_fd >= 0)
+        return epoll_wait_and_dispatch(timeout);
+#endif
+    return poll_wait(timeout);
+}
+
+// Tests
+
+static int test_calls[2];
+static int test_pipes[2][2];
+
+static void test_read_callback(int fd, void *arg)
+{
+    char buf[16];
+    ssize_t unused = read(fd, buf, sizeof(buf));
+    (void)unused;
+    test_calls[GPOINTER_TO_INT(arg)]++;
+}
+
+static void test_remove_other_callback(int fd, void *arg)
+{
+    test_read_callback(fd, arg);
+    int other = 1 - GPOINTER_TO_INT(arg);
+    reactor_remove_fd(test_pipes[other][0]);
+}
+
+// Registers the read ends of two pipes. With use_poll, disables epoll as if it were not available.
+static void setup_reactor_test(gboolean use_poll, ReactorCallback *callback)
+{
+    init_reactor();
+#ifdef HAVE_EPOLL
+    if (use_poll) {
+        if (timer_fd >= 0)
+            close(timer_fd);
+        timer_fd = -1;
+        if (epoll_fd >= 0)
+            close(epoll_fd);
+        epoll_fd = -1;
+    }
+#endif
+    for (int i = 0; i < 2; i++) {
+        test_calls[i] = 0;
+        if (pipe(test_pipes[i]) != 0)
+            test_pipes[i][0] = test_pipes[i][1] = -1;
+        reactor_add_fd(test_pipes[i][0], callback, GINT_TO_POINTER(i));
+    }
+}
+
+static void teardown_reactor_test()
+{
+    for (int i = 0; i < 2; i++) {
+        reactor_remove_fd(test_pipes[i][0]);
+        for (int end = 0; end < 2; end++) {
+            if (test_pipes[i][end] >= 0)
+                close(test_pipes[i][end]);
+            test_pipes[i][end] = -1;
+        }
+    }
+    cleanup_reactor();
+}
+
+typedef void ReactorTestBody(Status *test_result_, gboolean use_poll);
+
+// Runs the body between setup and teardown, so that the descriptors are released even if an assertion fails
+static void run_reactor_test(Status *test_result_, gboolean use_poll, ReactorCallback *callback, ReactorTestBody *body)
+{
+    setup_reactor_test(use_poll, callback);
+    body(test_result_, use_poll);
+    teardown_reactor_test();
+}
+
+static double test_elapsed_ms(struct timespec *start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1.0e3 + (end.tv_nsec - start->tv_nsec) * 1.0e-6;
+}
+
+static void test_dispatch(Status *test_result_, gboolean use_poll)
+{
+    ASSERT(test_pipes[1][1] >= 0);
+    struct timeval timeout = {1, 0};
+    ASSERT_EQUAL(write(test_pipes[1][1], "x", 1), 1);
+    ASSERT_EQUAL(reactor_wait(&timeout), 1);
+    ASSERT_EQUAL(test_calls[0], 0);
+    ASSERT_EQUAL(test_calls[1], 1);
+
+    // A removed descriptor is not waited for anymore
+    reactor_remove_fd(test_pipes[1][0]);
+    ASSERT_EQUAL(write(test_pipes[1][1], "x", 1), 1);
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 10000;
+    ASSERT_EQUAL(reactor_wait(&timeout), 0);
+    ASSERT_EQUAL(test_calls[1], 1);
+}
+
+static void test_remove_from_callback(Status *test_result_, gboolean use_poll)
+{
+    ASSERT(test_pipes[1][1] >= 0);
+    ASSERT_EQUAL(write(test_pipes[0][1], "x", 1), 1);
+    ASSERT_EQUAL(write(test_pipes[1][1], "x", 1), 1);
+    struct timeval timeout = {1, 0};
+    // Both are ready, but the first callback removes the other descriptor
+    ASSERT_EQUAL(reactor_wait(&timeout), 1);
+    ASSERT_EQUAL(test_calls[0] + test_calls[1], 1);
+}
+
+static void test_timeout(Status *test_result_, gboolean use_poll)
+{
+#ifdef HAVE_EPOLL
+    ASSERT(use_poll ? epoll_fd < 0 : timer_fd >= 0);
+#endif
+    struct timeval timeout = {0, 20500};
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ASSERT_EQUAL(reactor_wait(&timeout), 0);
+    double elapsed_ms = test_elapsed_ms(&start);
+    ASSERT(elapsed_ms >= 20.5);
+    ASSERT(elapsed_ms < 1000);
+    ASSERT_EQUAL(test_calls[0] + test_calls[1], 0);
+
+    // The timer is disarmed after the wait: a zero timeout does not block, even on an expired timer
+    timeout.tv_usec = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ASSERT_EQUAL(reactor_wait(&timeout), 0);
+    ASSERT(test_elapsed_ms(&start) < 10);
+}
+
+TEST(reactor_dispatch)
+{
+    run_reactor_test(test_result_, FALSE, test_read_callback, test_dispatch);
+}
+
+TEST(reactor_dispatch_poll)
+{
+    run_reactor_test(test_result_, TRUE, test_read_callback, test_dispatch);
+}
+
+TEST(reactor_remove_from_callback)
+{
+    run_reactor_test(test_result_, FALSE, test_remove_other_callback, test_remove_from_callback);
+}
+
+TEST(reactor_remove_from_callback_poll)
+{
+    run_reactor_test(test_result_, TRUE, test_remove_other_callback, test_remove_from_callback);
+}
+
+TEST(reactor_timeout)
+{
+    run_reactor_test(test_result_, FALSE, test_read_callback, test_timeout);
+}
+
+TEST(reactor_timeout_poll)
+{
+    run_reactor_test(test_result_, TRUE, test_read_callback, test_timeout);
+}
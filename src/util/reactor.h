@@ -0,0 +1,31 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <glib.h>
+#include <sys/time.h>
+
+// Waits for input on a set of file descriptors and dispatches it to the callbacks registered for them.
+// Only the callbacks of the descriptors that are ready are called.
+// Uses epoll on Linux, with a timerfd for the timeouts, and poll() elsewhere.
+
+typedef void ReactorCallback(int fd, void *arg);
+
+void init_reactor();
+void cleanup_reactor();
+
+// Calls callback(fd, arg) whenever fd is readable (or closed by the other end), until reactor_remove_fd().
+// Registering a descriptor again replaces its callback.
+void reactor_add_fd(int fd, ReactorCallback *callback, void *arg);
+
+// Must be called before closing the descriptor. Safe to call from a callback, even for another descriptor that is
+// ready in the same round.
+void reactor_remove_fd(int fd);
+
+// Sets a function called after each wait that returned ready descriptors, before their callbacks.
+void reactor_set_wakeup_hook(void (*hook)());
+
+// Waits until a descriptor is ready or the timeout expires (NULL waits indefinitely), then runs the callbacks.
+// Returns the number of callbacks called, or -1 on error (e.g. interrupted by a signal).
+int reactor_wait(struct timeval *timeout);
+
+#endif
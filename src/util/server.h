@@ -150,6 +150,8 @@ typedef struct Server {
     int xdamage_event_type;
     int xdamage_event_error_type;
     gboolean has_shm;
+    // Type of the MIT-SHM completion events, or 0 if the extension is missing
+    int shm_completion_event_type;
 #ifdef HAVE_SN
     SnDisplay *sn_display;
     GTree *pids;
@@ -0,0 +1,233 @@
+/**************************************************************************
+*
+* Copyright (C) 2017 tint2 authors
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+**************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#include <cairo-xlib.h>
+
+#include "shm_image.h"
+#include "server.h"
+#include "colors.h"
+
+static XImage *shm_ximage = NULL;
+static XShmSegmentInfo shm_info;
+// Set if the shared memory cannot be used, to avoid retrying on every frame
+static gboolean shm_disabled = FALSE;
+// Number of uploads whose completion event has not arrived yet. The server may still be reading the segment
+// while it is not zero.
+static int shm_pending_puts = 0;
+static gboolean shm_error = FALSE;
+
+cairo_surface_t *create_client_side_surface(int width, int height)
+{
+    return cairo_image_surface_create(server.real_transparency ? CAIRO_FORMAT_ARGB32 : CAIRO_FORMAT_RGB24,
+                                      width,
+                                      height);
+}
+
+static int shm_error_handler(Display *d, XErrorEvent *e)
+{
+    shm_error = TRUE;
+    return 0;
+}
+
+static void free_shm_ximage()
+{
+    if (!shm_ximage)
+        return;
+    XShmDetach(server.display, &shm_info);
+    XSync(server.display, False);
+    shmdt(shm_info.shmaddr);
+    shm_ximage->data = NULL;
+    XDestroyImage(shm_ximage);
+    shm_ximage = NULL;
+    shm_pending_puts = 0;
+}
+
+// The cairo image formats are native-endian 32 bit xRGB/ARGB
+static gboolean visual_matches_cairo()
+{
+    const int one = 1;
+    int native_byte_order = *(const char *)&one ? LSBFirst : MSBFirst;
+    return server.visual->red_mask == 0xff0000 && server.visual->green_mask == 0xff00 &&
+           server.visual->blue_mask == 0xff && shm_ximage->bits_per_pixel == 32 &&
+           shm_ximage->byte_order == native_byte_order;
+}
+
+// Makes sure the segment can hold an image of the given size
+static gboolean ensure_shm_ximage(int width, int height)
+{
+    if (shm_disabled)
+        return FALSE;
+    if (shm_ximage && shm_ximage->width >= width && shm_ximage->height >= height)
+        return TRUE;
+    if (!server.has_shm) {
+        shm_disabled = TRUE;
+        return FALSE;
+    }
+    if (shm_ximage) {
+        // Grow to the largest frame seen so far
+        width = MAX(width, shm_ximage->width);
+        height = MAX(height, shm_ximage->height);
+        free_shm_ximage();
+    }
+
+    shm_ximage = XShmCreateImage(server.display,
+                                 server.visual,
+                                 (unsigned)server.depth,
+                                 ZPixmap,
+                                 NULL,
+                                 &shm_info,
+                                 (unsigned)width,
+                                 (unsigned)height);
+    if (!shm_ximage)
+        goto err0;
+    if (!visual_matches_cairo())
+        goto err1;
+    shm_info.shmid = shmget(IPC_PRIVATE, (size_t)(shm_ximage->bytes_per_line * shm_ximage->height), IPC_CREAT | 0600);
+    if (shm_info.shmid < 0)
+        goto err1;
+    shm_info.shmaddr = shm_ximage->data = (char *)shmat(shm_info.shmid, 0, 0);
+    // The segment is destroyed once both processes have detached
+    shmctl(shm_info.shmid, IPC_RMID, NULL);
+    if (shm_info.shmaddr == (void *)-1)
+        goto err1;
+    shm_info.readOnly = True;
+
+    // Attaching fails asynchronously, e.g. for remote clients
+    XSync(server.display, False);
+    shm_error = FALSE;
+    XErrorHandler old = XSetErrorHandler(shm_error_handler);
+    XShmAttach(server.display, &shm_info);
+    XSync(server.display, False);
+    XSetErrorHandler(old);
+    if (shm_error)
+        goto err2;
+    return TRUE;
+
+err2:
+    shmdt(shm_info.shmaddr);
+err1:
+    shm_ximage->data = NULL;
+    XDestroyImage(shm_ximage);
+    shm_ximage = NULL;
+err0:
+    fprintf(stderr, YELLOW "tint2: MIT-SHM cannot be used, uploading frames with XPutImage" RESET "\n");
+    shm_disabled = TRUE;
+    return FALSE;
+}
+
+static void put_surface_with_cairo(cairo_surface_t *surface, Drawable d, const cairo_region_t *region)
+{
+    int width = cairo_image_surface_get_width(surface);
+    int height = cairo_image_surface_get_height(surface);
+    cairo_surface_t *cs = cairo_xlib_surface_create(server.display, d, server.visual, width, height);
+    cairo_t *c = cairo_create(cs);
+    if (region) {
+        for (int i = 0; i < cairo_region_num_rectangles(region); i++) {
+            cairo_rectangle_int_t r;
+            cairo_region_get_rectangle(region, i, &r);
+            cairo_rectangle(c, r.x, r.y, r.width, r.height);
+        }
+        cairo_clip(c);
+    }
+    cairo_set_operator(c, CAIRO_OPERATOR_SOURCE);
+    cairo_set_source_surface(c, surface, 0, 0);
+    cairo_paint(c);
+    cairo_destroy(c);
+    cairo_surface_destroy(cs);
+}
+
+static void put_rectangle_with_shm(cairo_surface_t *surface, Drawable d, GC gc, const cairo_rectangle_int_t *r)
+{
+    // The damage may still cover the previous, larger size of the surface
+    int x1 = MAX(r->x, 0);
+    int y1 = MAX(r->y, 0);
+    int x2 = MIN(r->x + r->width, cairo_image_surface_get_width(surface));
+    int y2 = MIN(r->y + r->height, cairo_image_surface_get_height(surface));
+    if (x1 >= x2 || y1 >= y2)
+        return;
+
+    const unsigned char *src = cairo_image_surface_get_data(surface);
+    int stride = cairo_image_surface_get_stride(surface);
+    for (int y = y1; y < y2; y++)
+        memcpy(shm_ximage->data + y * shm_ximage->bytes_per_line + x1 * 4, src + y * stride + x1 * 4, (size_t)(x2 - x1) * 4);
+    XShmPutImage(server.display, d, gc, shm_ximage, x1, y1, x1, y1, (unsigned)(x2 - x1), (unsigned)(y2 - y1), True);
+    shm_pending_puts++;
+}
+
+static Bool is_shm_completion(Display *display, XEvent *e, XPointer arg)
+{
+    return e->type == server.shm_completion_event_type &&
+           ((XShmCompletionEvent *)e)->shmseg == shm_info.shmseg;
+}
+
+void shm_image_handle_completion(XShmCompletionEvent *e)
+{
+    if (shm_ximage && e->shmseg == shm_info.shmseg && shm_pending_puts > 0)
+        shm_pending_puts--;
+}
+
+// Waits until the server is done reading the segment. Only blocks if the previous uploads have not completed yet.
+static void wait_for_shm_puts()
+{
+    XEvent e;
+    // Completion events that have already arrived have not necessarily been dispatched yet
+    while (shm_pending_puts > 0 && XCheckIfEvent(server.display, &e, is_shm_completion, NULL))
+        shm_pending_puts--;
+    if (shm_pending_puts == 0)
+        return;
+    // A failed upload has no completion event, so wait for all the requests to be processed instead of the events
+    XSync(server.display, False);
+    while (XCheckIfEvent(server.display, &e, is_shm_completion, NULL)) {
+    }
+    shm_pending_puts = 0;
+}
+
+void put_surface_to_drawable(cairo_surface_t *surface, Drawable d, GC gc, const cairo_region_t *region)
+{
+    cairo_surface_flush(surface);
+    int width = cairo_image_surface_get_width(surface);
+    int height = cairo_image_surface_get_height(surface);
+    if (!ensure_shm_ximage(width, height)) {
+        put_surface_with_cairo(surface, d, region);
+        return;
+    }
+
+    // Do not overwrite the segment while the previous upload may still be in progress
+    wait_for_shm_puts();
+    if (region) {
+        for (int i = 0; i < cairo_region_num_rectangles(region); i++) {
+            cairo_rectangle_int_t r;
+            cairo_region_get_rectangle(region, i, &r);
+            put_rectangle_with_shm(surface, d, gc, &r);
+        }
+    } else {
+        cairo_rectangle_int_t r = {0, 0, width, height};
+        put_rectangle_with_shm(surface, d, gc, &r);
+    }
+}
+
+void cleanup_shm_image()
+{
+    free_shm_ximage();
+    shm_disabled = FALSE;
+}
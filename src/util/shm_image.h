@@ -0,0 +1,26 @@
+#ifndef SHM_IMAGE_H
+#define SHM_IMAGE_H
+
+#include <X11/Xlib.h>
+#include <X11/extensions/XShm.h>
+#include <cairo.h>
+#include <glib.h>
+
+// Uploads client-side rendered frames to the X server through a MIT-SHM segment.
+// The segment is shared by all the panels and the tooltip; it grows to the size of the largest frame
+// and is reused across frames.
+// Falls back to XPutImage (through cairo) when the extension is missing or unusable for the visual.
+
+// Creates an image surface in the format matching the visual of the panel windows.
+cairo_surface_t *create_client_side_surface(int width, int height);
+
+// Copies the region of an image surface created with create_client_side_surface()
+// to the drawable at the same position. If region is NULL, the whole surface is copied.
+void put_surface_to_drawable(cairo_surface_t *surface, Drawable d, GC gc, const cairo_region_t *region);
+
+// Must be called for every MIT-SHM completion event, which tells that the server is done reading the segment.
+void shm_image_handle_completion(XShmCompletionEvent *e);
+
+void cleanup_shm_image();
+
+#endif
@@ -0,0 +1,192 @@
+#define _GNU_SOURCE
+/**************************************************************************
+*
+* Copyright (C) 2017 tint2 authors
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+**************************************************************************/
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "subprocess.h"
+#include "signals.h"
+#include "test.h"
+
+extern char **environ;
+
+#if defined(__GLIBC__) && defined(__GLIBC_PREREQ)
+#if __GLIBC_PREREQ(2, 34)
+#define HAVE_SPAWN_CLOSEFROM 1
+#endif
+#if __GLIBC_PREREQ(2, 29)
+#define HAVE_SPAWN_CHDIR 1
+#endif
+#endif
+
+// Used when the closefrom file action is not available (glibc before 2.34), and in the fork() fallback.
+// None of the descriptors of tint2 has to survive an exec: on re-execution tint2 opens everything again.
+// With posix_spawn this runs in tint2 itself, on every spawn: the scan of /proc/self/fd costs a few system calls
+// per open descriptor.
+static void set_cloexec_on_all_fds()
+{
+    DIR *dir = opendir("/proc/self/fd");
+    if (dir) {
+        int dir_fd = dirfd(dir);
+        struct dirent *entry;
+        while ((entry = readdir(dir))) {
+            int fd = atoi(entry->d_name);
+            if (fd > 2 && fd != dir_fd)
+                fcntl(fd, F_SETFD, FD_CLOEXEC | fcntl(fd, F_GETFD));
+        }
+        closedir(dir);
+        return;
+    }
+    long maxfd = sysconf(_SC_OPEN_MAX);
+    for (int fd = 3; fd < maxfd; fd++)
+        fcntl(fd, F_SETFD, FD_CLOEXEC | fcntl(fd, F_GETFD));
+}
+
+static pid_t fork_process(char *const argv[], const SpawnOptions *options)
+{
+    pid_t pid = fork();
+    if (pid != 0)
+        return pid < 0 ? -1 : pid;
+    // We are in the child
+    if (options->stdout_fd >= 0)
+        dup2(options->stdout_fd, 1);
+    if (options->stderr_fd >= 0)
+        dup2(options->stderr_fd, 2);
+    if (options->new_session)
+        setsid();
+    else
+        setpgid(0, 0);
+    if (options->dir && chdir(options->dir) != 0)
+        fprintf(stderr, "tint2: failed to chdir to %s\n", options->dir);
+    set_cloexec_on_all_fds();
+    reset_signals();
+    execvp(argv[0], argv);
+    _exit(127);
+}
+
+pid_t spawn_process(char *const argv[], const SpawnOptions *options)
+{
+    SpawnOptions defaults = SPAWN_OPTIONS_DEFAULT;
+    if (!options)
+        options = &defaults;
+#ifndef HAVE_SPAWN_CHDIR
+    if (options->dir)
+        return fork_process(argv, options);
+#endif
+#if !defined(POSIX_SPAWN_SETSID)
+    if (options->new_session)
+        return fork_process(argv, options);
+#endif
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (options->stdout_fd >= 0)
+        posix_spawn_file_actions_adddup2(&actions, options->stdout_fd, 1);
+    if (options->stderr_fd >= 0)
+        posix_spawn_file_actions_adddup2(&actions, options->stderr_fd, 2);
+#ifdef HAVE_SPAWN_CHDIR
+    if (options->dir)
+        posix_spawn_file_actions_addchdir_np(&actions, options->dir);
+#endif
+#ifdef HAVE_SPAWN_CLOSEFROM
+    posix_spawn_file_actions_addclosefrom_np(&actions, 3);
+#else
+    set_cloexec_on_all_fds();
+#endif
+
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t signals;
+    sigfillset(&signals);
+    posix_spawnattr_setsigdefault(&attr, &signals);
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attr, &signals);
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+#ifdef POSIX_SPAWN_SETSID
+    if (options->new_session)
+        flags |= POSIX_SPAWN_SETSID;
+    else
+#endif
+    {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, 0);
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    pid_t pid;
+    int result = posix_spawnp(&pid, argv[0], &actions, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    if (result != 0) {
+        fprintf(stderr, "tint2: could not start %s: %s\n", argv[0], strerror(result));
+        return -1;
+    }
+    return pid;
+}
+
+pid_t spawn_shell_command(const char *command, const SpawnOptions *options)
+{
+    char *argv[] = {(char *)"sh", (char *)"-c", (char *)command, NULL};
+    return spawn_process(argv, options);
+}
+
+static double spawn_benchmark_ms(gboolean use_fork, int count)
+{
+    char *argv[] = {(char *)"true", NULL};
+    SpawnOptions options = SPAWN_OPTIONS_DEFAULT;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < count; i++) {
+        pid_t pid = use_fork ? fork_process(argv, &options) : spawn_process(argv, &options);
+        if (pid < 0)
+            return -1;
+        int status;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+            ;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return ((end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1.0e6) / count;
+}
+
+BENCHMARK(spawn)
+{
+    // Make the process large, like tint2 with its image caches
+    const size_t size = 256 * 1024 * 1024;
+    char *memory = malloc(size);
+    ASSERT_NON_NULL(memory);
+    memset(memory, 1, size);
+
+    const int count = 50;
+    double fork_ms = spawn_benchmark_ms(TRUE, count);
+    double spawn_ms = spawn_benchmark_ms(FALSE, count);
+    free(memory);
+    ASSERT(fork_ms > 0);
+    ASSERT(spawn_ms > 0);
+    printf("spawn latency with 256 MB resident: fork %.3f ms, posix_spawn %.3f ms\n", fork_ms, spawn_ms);
+}
@@ -0,0 +1,30 @@
+#ifndef SUBPROCESS_H
+#define SUBPROCESS_H
+
+#include <glib.h>
+#include <sys/types.h>
+
+// Starts programs without duplicating the address space of tint2, which can be large (image caches, font maps).
+// Uses posix_spawn, which glibc implements with a vfork-like clone(CLONE_VM | CLONE_VFORK), so the cost does not
+// grow with the memory of tint2. Falls back to fork() where posix_spawn lacks a needed feature.
+// The child gets the default signal dispositions, an empty signal mask, and no descriptors besides 0, 1 and 2.
+
+typedef struct SpawnOptions {
+    // The working directory of the child, or NULL to keep the current one
+    const char *dir;
+    // Descriptors to use as stdout and stderr of the child, or -1 to keep the current ones
+    int stdout_fd;
+    int stderr_fd;
+    // Start a new session (setsid), otherwise only a new process group
+    gboolean new_session;
+} SpawnOptions;
+
+#define SPAWN_OPTIONS_DEFAULT {NULL, -1, -1, FALSE}
+
+// Starts argv[0], searched in PATH. Returns the pid of the child, or -1 if it could not be started.
+pid_t spawn_process(char *const argv[], const SpawnOptions *options);
+
+// Runs a command with sh -c. Returns the pid of the child, or -1.
+pid_t spawn_shell_command(const char *command, const SpawnOptions *options);
+
+#endif
@@ -22,6 +22,7 @@ typedef struct TestListItem {
 } TestListItem;
 
 static GList *all_tests = NULL;
+static GList *all_benchmarks = NULL;
 
 void register_test_(Test *test, const char *name)
 {
@@ -31,6 +32,14 @@ void register_test_(Test *test, const char *name)
     all_tests = g_list_append(all_tests, item);
 }
 
+void register_benchmark_(Test *test, const char *name)
+{
+    TestListItem *item = (TestListItem *)calloc(sizeof(TestListItem), 1);
+    item->test = test;
+    item->name = name;
+    all_benchmarks = g_list_append(all_benchmarks, item);
+}
+
 static char *test_log_name_from_test_name(const char *test_name)
 {
     char *output_name = g_strdup_printf("test_%s.log", test_name);
@@ -134,11 +143,11 @@ static Status run_test(TestListItem *item)
     return run_test_parent(item, pid);
 }
 
-void run_all_tests(bool verbose)
+static void run_test_list(GList *tests, bool verbose)
 {
-    fprintf(stdout, BLUE "tint2: Running %d tests..." RESET "\n", g_list_length(all_tests));
+    fprintf(stdout, BLUE "tint2: Running %d tests..." RESET "\n", g_list_length(tests));
     size_t count = 0, succeeded = 0, failed = 0;
-    for (GList *l = all_tests; l; l = l->next) {
+    for (GList *l = tests; l; l = l->next) {
         TestListItem *item = (TestListItem *)l->data;
         Status status = run_test(item);
         count++;
@@ -170,6 +179,16 @@ void run_all_tests(bool verbose)
         fprintf(stdout, BLUE "tint2: " RED "%lu" BLUE " out of %lu tests " RED "failed." RESET "\n", failed, count);
 }
 
+void run_all_tests(bool verbose)
+{
+    run_test_list(all_tests, verbose);
+}
+
+void run_all_benchmarks(bool verbose)
+{
+    run_test_list(all_benchmarks, verbose);
+}
+
 #if 0
 TEST(dummy) {
     int x = 2;
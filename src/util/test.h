@@ -7,6 +7,7 @@
 typedef void Test(Status *test_result_);
 
 void register_test_(Test *test, const char *name);
+void register_benchmark_(Test *test, const char *name);
 
 #define TEST(name)                                           \
     void test_##name(Status *test_result_);                  \
@@ -16,7 +17,17 @@ void register_test_(Test *test, const char *name);
     }                                                        \
     void test_##name(Status *test_result_)
 
+// Same as TEST, but only run on request with --benchmark, since benchmarks are slow.
+#define BENCHMARK(name)                                           \
+    void benchmark_##name(Status *test_result_);                  \
+    __attribute__((constructor)) void benchmark_register_##name() \
+    {                                                             \
+        register_benchmark_(benchmark_##name, #name);             \
+    }                                                             \
+    void benchmark_##name(Status *test_result_)
+
 void run_all_tests(bool verbose);
+void run_all_benchmarks(bool verbose);
 
 #define FAIL_TEST_           \
     *test_result_ = FAILURE; \
@@ -17,6 +17,7 @@
 
 #include <time.h>
 #include <sys/time.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -30,49 +31,157 @@ bool warnings_for_timers = true;
 bool debug_timers = false;
 #define MOCK_ORIGIN 1000000
 
-// All active timers
-static GList *timers = NULL;
+// All registered timers, stored as a binary min-heap ordered by (expiration time, registration order).
+// Disabled timers stay in the heap with an infinite key, so that lookups and removals are O(log n)
+// regardless of state. Each timer knows its own slot (heap_index_).
+static Timer **timer_heap = NULL;
+static int timer_heap_size = 0;
+static int timer_heap_capacity = 0;
+// Registration counter, used to keep the ordering stable and to skip timers created from callbacks.
+static unsigned long long timer_seq = 0;
+// Incremented on every call to handle_expired_timers(), used to mark timers as handled.
+static unsigned long long timer_round = 0;
 
 long long get_time_ms();
 
+static long long timer_key(const Timer *timer)
+{
+    return timer->enabled_ ? timer->expiration_time_ms_ : LLONG_MAX;
+}
+
+static bool timer_less(const Timer *a, const Timer *b)
+{
+    long long ka = timer_key(a);
+    long long kb = timer_key(b);
+    if (ka != kb)
+        return ka < kb;
+    return a->seq_ < b->seq_;
+}
+
+static bool timer_registered(const Timer *timer)
+{
+    return timer->heap_index_ >= 0 && timer->heap_index_ < timer_heap_size &&
+           timer_heap[timer->heap_index_] == timer;
+}
+
+static void timer_heap_set(int index, Timer *timer)
+{
+    timer_heap[index] = timer;
+    timer->heap_index_ = index;
+}
+
+static void timer_heap_sift_up(int index)
+{
+    Timer *timer = timer_heap[index];
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (!timer_less(timer, timer_heap[parent]))
+            break;
+        timer_heap_set(index, timer_heap[parent]);
+        index = parent;
+    }
+    timer_heap_set(index, timer);
+}
+
+static void timer_heap_sift_down(int index)
+{
+    Timer *timer = timer_heap[index];
+    while (true) {
+        int child = 2 * index + 1;
+        if (child >= timer_heap_size)
+            break;
+        if (child + 1 < timer_heap_size && timer_less(timer_heap[child + 1], timer_heap[child]))
+            child++;
+        if (!timer_less(timer_heap[child], timer))
+            break;
+        timer_heap_set(index, timer_heap[child]);
+        index = child;
+    }
+    timer_heap_set(index, timer);
+}
+
+// Restores the heap property after the key of a registered timer has changed.
+static void timer_heap_update(Timer *timer)
+{
+    int index = timer->heap_index_;
+    if (index > 0 && timer_less(timer, timer_heap[(index - 1) / 2]))
+        timer_heap_sift_up(index);
+    else
+        timer_heap_sift_down(index);
+}
+
+static void timer_heap_insert(Timer *timer)
+{
+    if (timer_heap_size == timer_heap_capacity) {
+        timer_heap_capacity = timer_heap_capacity ? 2 * timer_heap_capacity : 32;
+        timer_heap = g_renew(Timer *, timer_heap, timer_heap_capacity);
+    }
+    timer_heap_set(timer_heap_size++, timer);
+    timer_heap_sift_up(timer->heap_index_);
+}
+
+static void timer_heap_remove(Timer *timer)
+{
+    int index = timer->heap_index_;
+    Timer *last = timer_heap[--timer_heap_size];
+    timer->heap_index_ = -1;
+    if (last == timer)
+        return;
+    timer_heap_set(index, last);
+    timer_heap_update(last);
+}
+
 void default_timers()
 {
-    timers = NULL;
+    timer_heap = NULL;
+    timer_heap_size = 0;
+    timer_heap_capacity = 0;
+    timer_seq = 0;
+    timer_round = 0;
 }
 
 void cleanup_timers()
 {
     if (debug_timers)
         fprintf(stderr, "tint2: timers: %s\n", __FUNCTION__);
-    g_list_free(timers);
-    timers = NULL;
+    g_free(timer_heap);
+    default_timers();
 }
 
 void init_timer(Timer *timer, const char *name)
 {
     if (debug_timers)
         fprintf(stderr, "tint2: timers: %s: %s, %p\n", __FUNCTION__, name, (void *)timer);
+    bool registered = timer_registered(timer);
+    int heap_index = timer->heap_index_;
+    unsigned long long seq = timer->seq_;
     bzero(timer, sizeof(*timer));
     strncpy(timer->name_, name, sizeof(timer->name_));
-    if (!g_list_find(timers, timer)) {
-        timers = g_list_append(timers, timer);
+    if (registered) {
+        timer->heap_index_ = heap_index;
+        timer->seq_ = seq;
+        timer_heap_update(timer);
+    } else {
+        timer->seq_ = timer_seq++;
+        timer_heap_insert(timer);
     }
 }
 
 void destroy_timer(Timer *timer)
 {
-    if (warnings_for_timers && !g_list_find(timers, timer)) {
-        fprintf(stderr, RED "tint2: Attempt to destroy nonexisting timer: %s" RESET "\n", timer->name_);
+    if (!timer_registered(timer)) {
+        if (warnings_for_timers)
+            fprintf(stderr, RED "tint2: Attempt to destroy nonexisting timer: %s" RESET "\n", timer->name_);
         return;
     }
     if (debug_timers)
         fprintf(stderr, "tint2: timers: %s: %s, %p\n", __FUNCTION__, timer->name_, (void *)timer);
-    timers = g_list_remove(timers, timer);
+    timer_heap_remove(timer);
 }
 
 void change_timer(Timer *timer, bool enabled, int delay_ms, int period_ms, TimerCallback *callback, void *arg)
 {
-    if (!g_list_find(timers, timer)) {
+    if (!timer_registered(timer)) {
         fprintf(stderr, RED "tint2: Attempt to change unknown timer" RESET "\n");
         init_timer(timer, "unknown");
     }
@@ -81,6 +190,7 @@ void change_timer(Timer *timer, bool enabled, int delay_ms, int period_ms, Timer
     timer->period_ms_ = period_ms;
     timer->callback_ = callback;
     timer->arg_ = arg;
+    timer_heap_update(timer);
     if (debug_timers)
         fprintf(stderr,
                 "tint2: timers: %s: %s, %p: %s, expires %lld, period %d\n",
@@ -97,21 +207,41 @@ void stop_timer(Timer *timer)
     change_timer(timer, false, 0, 0, NULL, NULL);
 }
 
+void set_timer_slack(Timer *timer, int slack_ms)
+{
+    timer->slack_ms_ = MAX(slack_ms, 0);
+}
+
+void set_timer_anchored(Timer *timer, bool anchored)
+{
+    timer->anchored_ = anchored;
+}
+
+// Finds the latest wakeup time that does not delay any timer by more than its slack.
+// Only visits timers expiring before the current candidate, i.e. those within the slack window of the earliest one.
+static void find_wakeup_time(int index, long long *wakeup_time, Timer **next_timer)
+{
+    if (index >= timer_heap_size)
+        return;
+    Timer *timer = timer_heap[index];
+    if (timer_key(timer) >= *wakeup_time)
+        return;
+    long long deadline = timer->expiration_time_ms_ + timer->slack_ms_;
+    if (deadline < *wakeup_time) {
+        *wakeup_time = deadline;
+        *next_timer = timer;
+    }
+    find_wakeup_time(2 * index + 1, wakeup_time, next_timer);
+    find_wakeup_time(2 * index + 2, wakeup_time, next_timer);
+}
+
 struct timeval *get_duration_to_next_timer_expiration()
 {
     static struct timeval result = {0, 0};
-    long long min_expiration_time = -1;
+    long long wakeup_time = LLONG_MAX;
     Timer *next_timer = NULL;
-    for (GList *it = timers; it; it = it->next) {
-        Timer *timer = (Timer *)it->data;
-        if (!timer->enabled_)
-            continue;
-        if (min_expiration_time < 0 || timer->expiration_time_ms_ < min_expiration_time) {
-            min_expiration_time = timer->expiration_time_ms_;
-            next_timer = timer;
-        }
-    }
-    if (min_expiration_time < 0) {
+    find_wakeup_time(0, &wakeup_time, &next_timer);
+    if (!next_timer) {
         if (debug_timers)
             fprintf(stderr,
                     "tint2: timers: %s: no active timer\n",
@@ -119,10 +249,10 @@ struct timeval *get_duration_to_next_timer_expiration()
         return NULL;
     }
     long long now = get_time_ms();
-    long long duration = min_expiration_time - now;
+    long long duration = wakeup_time - now;
     if (debug_timers)
         fprintf(stderr,
-                "tint2: timers: %s: t=%lld, %lld to next timer: %s, %p: %s, expires %lld, period %d\n",
+                "tint2: timers: %s: t=%lld, %lld to next timer: %s, %p: %s, expires %lld, slack %d, period %d\n",
                 __FUNCTION__,
                 now,
                 duration,
@@ -130,6 +260,7 @@ struct timeval *get_duration_to_next_timer_expiration()
                 (void *)next_timer,
                 next_timer->enabled_ ? "on" : "off",
                 next_timer->expiration_time_ms_,
+                next_timer->slack_ms_,
                 next_timer->period_ms_);
     result.tv_sec = duration / 1000;
     duration -= result.tv_sec * 1000;
@@ -137,67 +268,108 @@ struct timeval *get_duration_to_next_timer_expiration()
     return &result;
 }
 
+// A timer may fire if it has expired, it was registered before this round started (timers created
+// from callbacks wait for the next event loop iteration, to prevent infinite loops), and it has not
+// fired yet in this round (in case it is rearmed from a callback).
+static bool timer_can_fire(const Timer *timer, long long now, unsigned long long seq_limit)
+{
+    return timer->enabled_ && timer->callback_ && timer->expiration_time_ms_ <= now &&
+           timer->seq_ < seq_limit && timer->handled_round_ != timer_round;
+}
+
+// Finds the earliest timer that can fire in the subtree rooted at index.
+// Only visits expired timers, since the subtree of a non-expired timer has no expired timers either.
+static Timer *find_timer_to_fire(int index, long long now, unsigned long long seq_limit)
+{
+    if (index >= timer_heap_size)
+        return NULL;
+    Timer *timer = timer_heap[index];
+    if (timer_key(timer) > now)
+        return NULL;
+    if (timer_can_fire(timer, now, seq_limit))
+        return timer;
+    Timer *left = find_timer_to_fire(2 * index + 1, now, seq_limit);
+    Timer *right = find_timer_to_fire(2 * index + 2, now, seq_limit);
+    if (!left)
+        return right;
+    if (!right)
+        return left;
+    return timer_less(left, right) ? left : right;
+}
+
+// Wakeup statistics, printed once per minute (debug_timers)
+static long long wakeup_stats_start_ms = 0;
+static int wakeup_stats_wakeups = 0;
+static int wakeup_stats_triggered = 0;
+
+static void update_wakeup_stats(long long now, int triggered)
+{
+    if (!debug_timers)
+        return;
+    if (wakeup_stats_start_ms == 0)
+        wakeup_stats_start_ms = now;
+    if (triggered > 0) {
+        wakeup_stats_wakeups++;
+        wakeup_stats_triggered += triggered;
+    }
+    long long elapsed = now - wakeup_stats_start_ms;
+    if (elapsed >= 60 * 1000) {
+        fprintf(stderr,
+                "tint2: timers: %.1f wakeups/min, %d timers triggered in %d wakeups\n",
+                wakeup_stats_wakeups * 60000.0 / elapsed,
+                wakeup_stats_triggered,
+                wakeup_stats_wakeups);
+        wakeup_stats_start_ms = now;
+        wakeup_stats_wakeups = 0;
+        wakeup_stats_triggered = 0;
+    }
+}
+
 void handle_expired_timers()
 {
     long long now = get_time_ms();
-    bool expired_timers = false;
-    for (GList *it = timers; it; it = it->next) {
-        Timer *timer = (Timer *)it->data;
-        if (timer->enabled_ && timer->callback_ && timer->expiration_time_ms_ <= now)
-            expired_timers = true;
-    }
-    if (!expired_timers)
+    if (timer_heap_size == 0 || timer_key(timer_heap[0]) > now) {
+        update_wakeup_stats(now, 0);
         return;
-
-    // We make a copy of the timer list, as the callbacks may create new timers,
-    // which we don't want to trigger in this event loop iteration,
-    // to prevent infinite loops.
-    GList *current_timers = g_list_copy(timers);
-
-    // Mark all timers as not handled.
-    // This is to ensure not triggering a timer more than once per event loop iteration,
-    // in case it is modified from a callback.
-    for (GList *it = current_timers; it; it = it->next) {
-        Timer *timer = (Timer *)it->data;
-        timer->handled_ = false;
     }
 
-    bool triggered;
-    do {
-        triggered = false;
-        for (GList *it = current_timers; it; it = it->next) {
-            Timer *timer = (Timer *)it->data;
-            // Check that it is still registered.
-            if (!g_list_find(timers, timer))
-                continue;
-            if (!timer->enabled_ || timer->handled_ || !timer->callback_ || timer->expiration_time_ms_ > now)
-                continue;
-            timer->handled_ = true;
-            if (timer->period_ms_ == 0) {
-                // One shot timer, turn it off.
-                timer->enabled_ = false;
-            } else {
-                // Periodic timer, reschedule.
-                timer->expiration_time_ms_ = now + timer->period_ms_;
-            }
-            if (debug_timers)
-                fprintf(stderr,
-                        "tint2: timers: %s: t=%lld, triggering %s, %p: %s, expires %lld, period %d\n",
-                        __FUNCTION__,
-                        now,
-                        timer->name_,
-                        (void *)timer,
-                        timer->enabled_ ? "on" : "off",
-                        timer->expiration_time_ms_,
-                        timer->period_ms_);
-            timer->callback_(timer->arg_);
-            // The callback may have modified timers, so start from scratch
-            triggered = true;
-            break;
-        }
-    } while (triggered);
+    unsigned long long seq_limit = timer_seq;
+    timer_round++;
 
-    g_list_free(current_timers);
+    // The callbacks may modify, create or destroy any timer, so we look up the next one
+    // to fire from the heap every time. In the common case this is the root.
+    int triggered = 0;
+    Timer *timer;
+    while ((timer = find_timer_to_fire(0, now, seq_limit))) {
+        timer->handled_round_ = timer_round;
+        if (timer->period_ms_ == 0) {
+            // One shot timer, turn it off.
+            timer->enabled_ = false;
+        } else if (timer->anchored_) {
+            // Periodic timer, reschedule keeping the phase, skipping the missed periods.
+            timer->expiration_time_ms_ += timer->period_ms_;
+            if (timer->expiration_time_ms_ <= now)
+                timer->expiration_time_ms_ +=
+                    ((now - timer->expiration_time_ms_) / timer->period_ms_ + 1) * timer->period_ms_;
+        } else {
+            // Periodic timer, reschedule.
+            timer->expiration_time_ms_ = now + timer->period_ms_;
+        }
+        timer_heap_update(timer);
+        if (debug_timers)
+            fprintf(stderr,
+                    "tint2: timers: %s: t=%lld, triggering %s, %p: %s, expires %lld, period %d\n",
+                    __FUNCTION__,
+                    now,
+                    timer->name_,
+                    (void *)timer,
+                    timer->enabled_ ? "on" : "off",
+                    timer->expiration_time_ms_,
+                    timer->period_ms_);
+        triggered++;
+        timer->callback_(timer->arg_);
+    }
+    update_wakeup_stats(now, triggered);
 }
 
 // Time helper functions
@@ -1699,3 +1871,140 @@ TEST(cleanup_timers_simple)
     handle_expired_timers();
     ASSERT_EQUAL(triggered, 1);
 }
+
+TEST(anchored_timer_no_drift)
+{
+    u_int64_t origin = MOCK_ORIGIN;
+    int triggered = 0;
+    Timer t1;
+    init_timer(&t1, "t1");
+    set_timer_anchored(&t1, true);
+
+    set_mock_time_ms(origin + 0);
+    change_timer(&t1, true, 100, 100, trigger_callback, &triggered);
+
+    set_mock_time_ms(origin + 130);
+    handle_expired_timers();
+    ASSERT_EQUAL(triggered, 1);
+    ASSERT_EQUAL(timeval_to_ms(get_duration_to_next_timer_expiration()), 70);
+
+    set_mock_time_ms(origin + 200);
+    handle_expired_timers();
+    ASSERT_EQUAL(triggered, 2);
+    ASSERT_EQUAL(timeval_to_ms(get_duration_to_next_timer_expiration()), 100);
+
+    // Missed periods are skipped, not replayed
+    set_mock_time_ms(origin + 550);
+    handle_expired_timers();
+    ASSERT_EQUAL(triggered, 3);
+    ASSERT_EQUAL(timeval_to_ms(get_duration_to_next_timer_expiration()), 50);
+
+    set_mock_time_ms(origin + 600);
+    handle_expired_timers();
+    ASSERT_EQUAL(triggered, 4);
+}
+
+TEST(slack_coalesces_wakeups)
+{
+    u_int64_t origin = MOCK_ORIGIN;
+    int triggered = 0;
+    Timer t1;
+    init_timer(&t1, "t1");
+    Timer t2;
+    init_timer(&t2, "t2");
+    Timer t3;
+    init_timer(&t3, "t3");
+    set_timer_slack(&t1, 50);
+    set_timer_slack(&t2, 50);
+
+    set_mock_time_ms(origin + 0);
+    change_timer(&t1, true, 100, 0, trigger_callback, &triggered);
+    change_timer(&t2, true, 120, 0, trigger_callback, &triggered);
+    change_timer(&t3, true, 140, 0, trigger_callback, &triggered);
+    // t1 can wait for t3, which has no slack
+    ASSERT_EQUAL(timeval_to_ms(get_duration_to_next_timer_expiration()), 140);
+
+    set_mock_time_ms(origin + 140);
+    handle_expired_timers();
+    ASSERT_EQUAL(triggered, 3);
+    ASSERT_EQUAL(timeval_to_ms(get_duration_to_next_timer_expiration()), -1);
+
+    change_timer(&t1, true, 100, 0, trigger_callback, &triggered);
+    change_timer(&t2, true, 200, 0, trigger_callback, &triggered);
+    // t2 is too far away to be merged
+    ASSERT_EQUAL(timeval_to_ms(get_duration_to_next_timer_expiration()), 150);
+}
+
+typedef struct ManyTimersResult {
+    int triggered;
+    int expected;
+    bool next_expiration_always_set;
+    int next_ms_after_stop;
+    int next_ms_after_rearm;
+    int next_ms_after_destroy;
+} ManyTimersResult;
+
+// Runs num_timers periodic timers for one second of mock time, then cancels, rearms and destroys them.
+// All the timers are destroyed before returning, so that the caller can assert on the result.
+static ManyTimersResult run_many_timers(int num_timers)
+{
+    u_int64_t origin = MOCK_ORIGIN;
+    const int duration_ms = 1000;
+    const int tick_ms = 10;
+    ManyTimersResult result;
+    bzero(&result, sizeof(result));
+    result.next_expiration_always_set = true;
+    Timer *timers = calloc(num_timers, sizeof(Timer));
+
+    set_mock_time_ms(origin + 0);
+    for (int i = 0; i < num_timers; i++) {
+        int period_ms = 100 + (i % 10) * tick_ms;
+        init_timer(&timers[i], "many");
+        change_timer(&timers[i], true, period_ms, period_ms, trigger_callback, &result.triggered);
+        result.expected += duration_ms / period_ms;
+    }
+    for (int t = 0; t <= duration_ms; t += tick_ms) {
+        set_mock_time_ms(origin + t);
+        handle_expired_timers();
+        if (!get_duration_to_next_timer_expiration())
+            result.next_expiration_always_set = false;
+    }
+
+    // Cancel all timers, rearm every other one, then destroy all of them
+    for (int i = 0; i < num_timers; i++)
+        stop_timer(&timers[i]);
+    result.next_ms_after_stop = timeval_to_ms(get_duration_to_next_timer_expiration());
+    for (int i = 0; i < num_timers; i += 2)
+        change_timer(&timers[i], true, 50, 0, trigger_callback, &result.triggered);
+    result.next_ms_after_rearm = timeval_to_ms(get_duration_to_next_timer_expiration());
+    for (int i = 0; i < num_timers; i++)
+        destroy_timer(&timers[i]);
+    result.next_ms_after_destroy = timeval_to_ms(get_duration_to_next_timer_expiration());
+
+    free(timers);
+    return result;
+}
+
+TEST(many_timers)
+{
+    ManyTimersResult result = run_many_timers(100);
+    ASSERT(result.next_expiration_always_set);
+    ASSERT_EQUAL(result.triggered, result.expected);
+    ASSERT_EQUAL(result.next_ms_after_stop, -1);
+    ASSERT_EQUAL(result.next_ms_after_rearm, 50);
+    ASSERT_EQUAL(result.next_ms_after_destroy, -1);
+}
+
+BENCHMARK(many_timers)
+{
+    const int num_timers = 10000;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ManyTimersResult result = run_many_timers(num_timers);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ASSERT_EQUAL(result.triggered, result.expected);
+    printf("%d timers, %d callbacks: %.3f ms\n",
+           num_timers,
+           result.triggered,
+           (end.tv_sec - start.tv_sec) * 1.0e3 + (end.tv_nsec - start.tv_nsec) * 1.0e-6);
+}
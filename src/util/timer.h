@@ -35,10 +35,15 @@ typedef struct {
     int period_ms_;
     TimerCallback *callback_;
     void *arg_;
-    bool handled_;
+    int slack_ms_;
+    bool anchored_;
+    // Private, managed by the timer engine.
+    int heap_index_;
+    unsigned long long seq_;
+    unsigned long long handled_round_;
 } Timer;
 
-#define DEFAULT_TIMER {"", 0, 0, 0, 0, 0, 0}
+#define DEFAULT_TIMER {"", 0, 0, 0, 0, 0, 0, 0, -1, 0, 0}
 
 #define INIT_TIMER(t) init_timer(&t, #t)
 
@@ -59,7 +64,16 @@ void change_timer(Timer *timer, bool enabled, int delay_ms, int period_ms, Timer
 
 void stop_timer(Timer *timer);
 
-// Get the time duration to the next expiration time, or NULL if there is no active timer.
+// Allow the timer to fire up to slack_ms after its expiration time, so that it can share a wakeup with other timers.
+// Kept across change_timer() calls.
+void set_timer_slack(Timer *timer, int slack_ms);
+
+// Reschedule a periodic timer relative to its previous expiration time instead of the time it was triggered,
+// so that it does not drift. Missed periods are skipped. Kept across change_timer() calls.
+void set_timer_anchored(Timer *timer, bool anchored);
+
+// Get the time duration to the next wakeup, or NULL if there is no active timer.
+// The wakeup is delayed as much as the slack of the pending timers allows.
 // Do not free the pointer; it is harmless to change its contents.
 struct timeval *get_duration_to_next_timer_expiration();
 
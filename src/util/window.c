@@ -40,6 +40,7 @@
 #include "server.h"
 #include "panel.h"
 #include "taskbar.h"
+#include "window_prefetch.h"
 
 void activate_window(Window win)
 {
@@ -67,12 +68,20 @@ void toggle_window_maximized(Window win)
     send_event32(win, server.atom._NET_WM_STATE, 2, server.atom._NET_WM_STATE_MAXIMIZED_HORZ, 0);
 }
 
+static Window get_transient_for(Window win)
+{
+    Window *transient_for = get_window_property(win, XA_WM_TRANSIENT_FOR, XA_WINDOW, NULL);
+    Window result = transient_for ? transient_for[0] : None;
+    XFree(transient_for);
+    return result;
+}
+
 gboolean window_is_hidden(Window win)
 {
     Window window;
     int count;
 
-    Atom *at = server_get_property(win, server.atom._NET_WM_STATE, XA_ATOM, &count);
+    Atom *at = get_window_property(win, server.atom._NET_WM_STATE, XA_ATOM, &count);
     for (int i = 0; i < count; i++) {
         if (at[i] == server.atom._NET_WM_STATE_SKIP_TASKBAR) {
             XFree(at);
@@ -80,7 +89,7 @@ gboolean window_is_hidden(Window win)
         }
         // do not add transient_for windows if the transient window is already in the taskbar
         window = win;
-        while (XGetTransientForHint(server.display, window, &window)) {
+        while ((window = get_transient_for(window))) {
             if (get_task_buttons(window)) {
                 XFree(at);
                 return TRUE;
@@ -89,7 +98,7 @@ gboolean window_is_hidden(Window win)
     }
     XFree(at);
 
-    at = server_get_property(win, server.atom._NET_WM_WINDOW_TYPE, XA_ATOM, &count);
+    at = get_window_property(win, server.atom._NET_WM_WINDOW_TYPE, XA_ATOM, &count);
     for (int i = 0; i < count; i++) {
         if (at[i] == server.atom._NET_WM_WINDOW_TYPE_DOCK || at[i] == server.atom._NET_WM_WINDOW_TYPE_DESKTOP ||
             at[i] == server.atom._NET_WM_WINDOW_TYPE_TOOLBAR || at[i] == server.atom._NET_WM_WINDOW_TYPE_MENU ||
@@ -114,7 +123,7 @@ gboolean window_is_hidden(Window win)
 
 int get_window_desktop(Window win)
 {
-    int desktop = get_property32(win, server.atom._NET_WM_DESKTOP, XA_CARDINAL);
+    int desktop = get_window_property32(win, server.atom._NET_WM_DESKTOP, XA_CARDINAL);
     if (desktop == ALL_DESKTOPS)
         return desktop;
     if (!server.viewports)
@@ -186,7 +195,11 @@ int get_window_monitor(Window win)
 {
     int x, y, w, h;
     get_window_coordinates(win, &x, &y, &w, &h);
+    return get_monitor_for_geometry(x, y, w, h);
+}
 
+int get_monitor_for_geometry(int x, int y, int w, int h)
+{
     int best_match = 0;
     int best_area = -1;
     for (int i = 0; i < server.num_monitors; i++) {
@@ -208,6 +221,11 @@ int get_window_monitor(Window win)
 
 gboolean get_window_coordinates(Window win, int *x, int *y, int *w, int *h)
 {
+    gboolean found;
+    gboolean result = get_prefetched_coordinates(win, &found, x, y, w, h);
+    if (found)
+        return result;
+
     int dummy_int;
     unsigned ww, wh, bw, bh;
     Window src;
@@ -225,7 +243,7 @@ gboolean window_is_iconified(Window win)
     // EWMH specification : minimization of windows use _NET_WM_STATE_HIDDEN.
     // WM_STATE is not accurate for shaded window and in multi_desktop mode.
     int count;
-    Atom *at = server_get_property(win, server.atom._NET_WM_STATE, XA_ATOM, &count);
+    Atom *at = get_window_property(win, server.atom._NET_WM_STATE, XA_ATOM, &count);
     for (int i = 0; i < count; i++) {
         if (at[i] == server.atom._NET_WM_STATE_HIDDEN) {
             XFree(at);
@@ -240,7 +258,7 @@ gboolean window_is_urgent(Window win)
 {
     int count;
 
-    Atom *at = server_get_property(win, server.atom._NET_WM_STATE, XA_ATOM, &count);
+    Atom *at = get_window_property(win, server.atom._NET_WM_STATE, XA_ATOM, &count);
     for (int i = 0; i < count; i++) {
         if (at[i] == server.atom._NET_WM_STATE_DEMANDS_ATTENTION) {
             XFree(at);
@@ -255,7 +273,7 @@ gboolean window_is_skip_taskbar(Window win)
 {
     int count;
 
-    Atom *at = server_get_property(win, server.atom._NET_WM_STATE, XA_ATOM, &count);
+    Atom *at = get_window_property(win, server.atom._NET_WM_STATE, XA_ATOM, &count);
     for (int i = 0; i < count; i++) {
         if (at[i] == server.atom._NET_WM_STATE_SKIP_TASKBAR) {
             XFree(at);
@@ -276,71 +294,116 @@ gboolean window_is_active(Window win)
     return (win == get_property32(server.root_win, server.atom._NET_ACTIVE_WINDOW, XA_WINDOW));
 }
 
-int get_icon_count(gulong *data, int num)
+// Reads part of the _NET_WM_ICON property of a window: count 32-bit values starting at offset (in 32-bit units).
+// Returns the values (as longs, like all format 32 properties), to be freed with XFree, or NULL.
+// Sets remaining to the number of values after the ones returned.
+static gulong *get_icon_property_range(Window win, unsigned long offset, unsigned long count, unsigned long *remaining)
 {
-    int count, pos, w, h;
-
-    count = 0;
-    pos = 0;
-    while (pos + 2 < num) {
-        w = data[pos++];
-        h = data[pos++];
-        pos += w * h;
-        if (pos > num || w <= 0 || h <= 0)
-            break;
-        count++;
+    Atom type_ret;
+    int format_ret = 0;
+    unsigned long nitems_ret = 0;
+    unsigned long bytes_after_ret = 0;
+    unsigned char *prop_value = NULL;
+    int result = XGetWindowProperty(server.display,
+                                    win,
+                                    server.atom._NET_WM_ICON,
+                                    (long)offset,
+                                    (long)count,
+                                    False,
+                                    XA_CARDINAL,
+                                    &type_ret,
+                                    &format_ret,
+                                    &nitems_ret,
+                                    &bytes_after_ret,
+                                    &prop_value);
+    if (result != Success || !prop_value)
+        return NULL;
+    if (type_ret != XA_CARDINAL || format_ret != 32 || nitems_ret != count) {
+        XFree(prop_value);
+        return NULL;
     }
-
-    return count;
+    *remaining = bytes_after_ret / 4;
+    return (gulong *)prop_value;
 }
 
-gulong *get_best_icon(gulong *data, int icon_count, int num, int *iw, int *ih, int best_icon_size)
+gboolean choose_icon(IconChoice *choice, unsigned long w, unsigned long h, unsigned long remaining)
 {
-    if (icon_count < 1 || num < 1)
-        return NULL;
-
-    int width[icon_count], height[icon_count], pos, i, w, h;
-    gulong *icon_data[icon_count];
+    if (w == 0 || h == 0 || w > 0x7fff || h > 0x7fff || w * h > remaining)
+        return FALSE;
+    // Prefer the exact size, otherwise the biggest; on ties, the last one in the property
+    if ((int)w == choice->best_icon_size) {
+        choice->exact = TRUE;
+        choice->offset = choice->next_offset;
+        choice->width = (int)w;
+        choice->height = (int)h;
+    } else if (!choice->exact && (int)w >= choice->width) {
+        choice->offset = choice->next_offset;
+        choice->width = (int)w;
+        choice->height = (int)h;
+    }
+    choice->next_offset += 2 + w * h;
+    return w * h < remaining;
+}
 
-    /* List up icons */
-    pos = 0;
-    i = icon_count;
-    while (i--) {
-        w = data[pos++];
-        h = data[pos++];
-        if (pos + w * h > num)
+guint32 *get_window_icon(Window win, int best_icon_size, int *iw, int *ih)
+{
+    gboolean found;
+    guint32 *icon = get_prefetched_icon(win, best_icon_size, &found, iw, ih);
+    if (found)
+        return icon;
+
+    // Walk the width/height headers of the icons in the property
+    IconChoice choice = {.best_icon_size = best_icon_size};
+    while (TRUE) {
+        unsigned long remaining;
+        gulong *header = get_icon_property_range(win, choice.next_offset, 2, &remaining);
+        if (!header)
             break;
-
-        width[i] = w;
-        height[i] = h;
-        icon_data[i] = &data[pos];
-
-        pos += w * h;
-    }
-
-    /* Try to find exact size */
-    int icon_num = -1;
-    for (i = 0; i < icon_count; i++) {
-        if (width[i] == best_icon_size) {
-            icon_num = i;
+        unsigned long w = header[0];
+        unsigned long h = header[1];
+        XFree(header);
+        if (!choose_icon(&choice, w, h, remaining))
             break;
-        }
     }
+    if (choice.width == 0)
+        return NULL;
 
-    /* Take the biggest or whatever */
-    if (icon_num < 0) {
-        int highest = 0;
-        for (i = 0; i < icon_count; i++) {
-            if (width[i] > highest) {
-                icon_num = i;
-                highest = width[i];
-            }
-        }
-    }
+    // Fetch only the pixels of that icon
+    unsigned long remaining;
+    unsigned long count = (unsigned long)choice.width * (unsigned long)choice.height;
+    gulong *pixels = get_icon_property_range(win, choice.offset + 2, count, &remaining);
+    if (!pixels)
+        return NULL;
+
+    // Convert the longs to 32 bit values in place. Each value is written at or before the start of the long it
+    // comes from, so nothing is overwritten before being read.
+    unsigned char *bytes = (unsigned char *)pixels;
+    for (unsigned long i = 0; i < count; i++) {
+        gulong value;
+        memcpy(&value, bytes + i * sizeof(gulong), sizeof(value));
+        guint32 argb = (guint32)value;
+        memcpy(bytes + i * sizeof(guint32), &argb, sizeof(argb));
+    }
+    *iw = choice.width;
+    *ih = choice.height;
+    return (guint32 *)pixels;
+}
 
-    *iw = width[icon_num];
-    *ih = height[icon_num];
-    return icon_data[icon_num];
+char *get_window_class(Window win)
+{
+    // WM_CLASS holds the instance name and the class name, each followed by a zero byte
+    int count;
+    char *wm_class = get_window_property(win, XA_WM_CLASS, XA_STRING, &count);
+    if (!wm_class || count <= 0) {
+        XFree(wm_class);
+        return NULL;
+    }
+    // Like XGetClassHint, a missing class name is empty
+    int name_length = (int)strnlen(wm_class, (size_t)count);
+    char *result = name_length + 1 < count ? strndup(wm_class + name_length + 1, (size_t)(count - name_length - 1))
+                                           : strdup("");
+    XFree(wm_class);
+    return result;
 }
 
 // Thanks zcodes!
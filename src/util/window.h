@@ -22,6 +22,8 @@ gboolean window_is_active(Window win);
 gboolean window_is_skip_taskbar(Window win);
 int get_window_desktop(Window win);
 int get_window_monitor(Window win);
+// Returns the monitor that contains most of the given root window rectangle.
+int get_monitor_for_geometry(int x, int y, int w, int h);
 
 void activate_window(Window win);
 void close_window(Window win);
@@ -30,10 +32,30 @@ void toggle_window_maximized(Window win);
 void toggle_window_shade(Window win);
 void change_window_desktop(Window win, int desktop);
 
-int get_icon_count(gulong *data, int num);
-gulong *get_best_icon(gulong *data, int icon_count, int num, int *iw, int *ih, int best_icon_size);
+// Tracks the icon of _NET_WM_ICON closest to a size, while walking the icon headers in the property.
+typedef struct IconChoice {
+    int best_icon_size;
+    // Offset of the next header to read, in 32-bit units
+    unsigned long next_offset;
+    // The chosen icon so far (the offset of its header), if width is not zero
+    unsigned long offset;
+    int width;
+    int height;
+    gboolean exact;
+} IconChoice;
+
+// Considers the icon whose header was read at choice->next_offset; remaining is the number of values after the
+// header. Returns TRUE if there may be more icons after this one.
+gboolean choose_icon(IconChoice *choice, unsigned long w, unsigned long h, unsigned long remaining);
+
+// Reads the icon from _NET_WM_ICON that is closest to best_icon_size: the one with that width, otherwise the largest.
+// Only the headers of the icons and the pixels of the chosen one are transferred.
+// Returns the pixels as ARGB values (one guint32 each, like DATA32 in Imlib2), to be freed with XFree, or NULL.
+guint32 *get_window_icon(Window win, int best_icon_size, int *iw, int *ih);
 
 char *get_window_name(Window win);
+// Returns the class name from WM_CLASS, to be freed with free, or NULL if the property is missing.
+char *get_window_class(Window win);
 cairo_surface_t *get_window_thumbnail(Window win, int size);
 
 #endif
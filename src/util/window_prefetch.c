@@ -0,0 +1,338 @@
+/**************************************************************************
+*
+* Copyright (C) 2017 tint2 authors
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+**************************************************************************/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <X11/Xatom.h>
+#include <X11/Xlib-xcb.h>
+// For Xmalloc and Xcalloc: the data returned to the callers is allocated like Xlib's own, so that it is freed with XFree
+// whether or not it was prefetched
+#include <X11/Xlibint.h>
+#include <xcb/xcb.h>
+
+#include "window_prefetch.h"
+#include "server.h"
+#include "window.h"
+
+// The properties read when creating a task
+typedef enum PrefetchedProperty {
+    PREFETCH_NET_WM_STATE = 0,
+    PREFETCH_NET_WM_WINDOW_TYPE,
+    PREFETCH_WM_TRANSIENT_FOR,
+    PREFETCH_NET_WM_DESKTOP,
+    PREFETCH_NET_WM_VISIBLE_NAME,
+    PREFETCH_NET_WM_NAME,
+    PREFETCH_WM_NAME,
+    PREFETCH_WM_CLASS,
+    PREFETCH_PROPERTY_COUNT
+} PrefetchedProperty;
+
+typedef struct PrefetchedWindow {
+    Window win;
+    // NULL if the request failed, e.g. the window is gone
+    xcb_get_property_reply_t *properties[PREFETCH_PROPERTY_COUNT];
+    gboolean has_coordinates;
+    int x, y, w, h;
+    int icon_size;
+    // Walk of the icon headers, then the pixels of the chosen icon
+    IconChoice icon_choice;
+    gboolean icon_walk_done;
+    guint32 *icon;
+    int icon_width;
+    int icon_height;
+} PrefetchedWindow;
+
+// Window -> PrefetchedWindow *
+static GHashTable *prefetched_windows = NULL;
+
+static void get_prefetched_property_ids(Atom *atoms, Atom *types)
+{
+    atoms[PREFETCH_NET_WM_STATE] = server.atom._NET_WM_STATE;
+    types[PREFETCH_NET_WM_STATE] = XA_ATOM;
+    atoms[PREFETCH_NET_WM_WINDOW_TYPE] = server.atom._NET_WM_WINDOW_TYPE;
+    types[PREFETCH_NET_WM_WINDOW_TYPE] = XA_ATOM;
+    atoms[PREFETCH_WM_TRANSIENT_FOR] = XA_WM_TRANSIENT_FOR;
+    types[PREFETCH_WM_TRANSIENT_FOR] = XA_WINDOW;
+    atoms[PREFETCH_NET_WM_DESKTOP] = server.atom._NET_WM_DESKTOP;
+    types[PREFETCH_NET_WM_DESKTOP] = XA_CARDINAL;
+    atoms[PREFETCH_NET_WM_VISIBLE_NAME] = server.atom._NET_WM_VISIBLE_NAME;
+    types[PREFETCH_NET_WM_VISIBLE_NAME] = server.atom.UTF8_STRING;
+    atoms[PREFETCH_NET_WM_NAME] = server.atom._NET_WM_NAME;
+    types[PREFETCH_NET_WM_NAME] = server.atom.UTF8_STRING;
+    atoms[PREFETCH_WM_NAME] = server.atom.WM_NAME;
+    types[PREFETCH_WM_NAME] = XA_STRING;
+    atoms[PREFETCH_WM_CLASS] = XA_WM_CLASS;
+    types[PREFETCH_WM_CLASS] = XA_STRING;
+}
+
+static void free_prefetched_window(gpointer data)
+{
+    PrefetchedWindow *pw = (PrefetchedWindow *)data;
+    for (int p = 0; p < PREFETCH_PROPERTY_COUNT; p++)
+        free(pw->properties[p]);
+    XFree(pw->icon);
+    free(pw);
+}
+
+void clear_window_prefetch()
+{
+    if (prefetched_windows) {
+        g_hash_table_destroy(prefetched_windows);
+        prefetched_windows = NULL;
+    }
+}
+
+static guint window_hash(gconstpointer key)
+{
+    return (guint)*(const Window *)key;
+}
+
+static gboolean window_equal(gconstpointer a, gconstpointer b)
+{
+    return *(const Window *)a == *(const Window *)b;
+}
+
+// Walks the icon headers of all the windows in lockstep: each round trip reads the next header of every window,
+// so the walk costs as many round trips as the largest number of icons in a window.
+static void prefetch_icons(xcb_connection_t *c, PrefetchedWindow **windows, int count)
+{
+    xcb_get_property_cookie_t *cookies = calloc((size_t)count, sizeof(*cookies));
+    gboolean pending = TRUE;
+    while (pending) {
+        pending = FALSE;
+        for (int i = 0; i < count; i++) {
+            PrefetchedWindow *pw = windows[i];
+            if (pw->icon_walk_done)
+                continue;
+            cookies[i] = xcb_get_property(c,
+                                          0,
+                                          (xcb_window_t)pw->win,
+                                          (xcb_atom_t)server.atom._NET_WM_ICON,
+                                          XA_CARDINAL,
+                                          (uint32_t)pw->icon_choice.next_offset,
+                                          2);
+        }
+        for (int i = 0; i < count; i++) {
+            PrefetchedWindow *pw = windows[i];
+            if (pw->icon_walk_done)
+                continue;
+            xcb_get_property_reply_t *reply = xcb_get_property_reply(c, cookies[i], NULL);
+            gboolean more = FALSE;
+            if (reply && reply->type == XA_CARDINAL && reply->format == 32 && reply->value_len == 2) {
+                const uint32_t *header = (const uint32_t *)xcb_get_property_value(reply);
+                more = choose_icon(&pw->icon_choice, header[0], header[1], reply->bytes_after / 4);
+            }
+            free(reply);
+            pw->icon_walk_done = !more;
+            pending = pending || more;
+        }
+    }
+
+    // Fetch the pixels of the chosen icons
+    for (int i = 0; i < count; i++) {
+        PrefetchedWindow *pw = windows[i];
+        if (!pw->icon_choice.width)
+            continue;
+        cookies[i] = xcb_get_property(c,
+                                      0,
+                                      (xcb_window_t)pw->win,
+                                      (xcb_atom_t)server.atom._NET_WM_ICON,
+                                      XA_CARDINAL,
+                                      (uint32_t)(pw->icon_choice.offset + 2),
+                                      (uint32_t)(pw->icon_choice.width * pw->icon_choice.height));
+    }
+    for (int i = 0; i < count; i++) {
+        PrefetchedWindow *pw = windows[i];
+        if (!pw->icon_choice.width)
+            continue;
+        xcb_get_property_reply_t *reply = xcb_get_property_reply(c, cookies[i], NULL);
+        uint32_t num_pixels = (uint32_t)(pw->icon_choice.width * pw->icon_choice.height);
+        if (reply && reply->type == XA_CARDINAL && reply->format == 32 && reply->value_len == num_pixels) {
+            // The values are already 32 bit ARGB
+            pw->icon = Xmalloc(num_pixels * sizeof(guint32));
+            memcpy(pw->icon, xcb_get_property_value(reply), num_pixels * sizeof(guint32));
+            pw->icon_width = pw->icon_choice.width;
+            pw->icon_height = pw->icon_choice.height;
+        }
+        free(reply);
+    }
+    free(cookies);
+}
+
+void prefetch_windows(const Window *windows, int count, int icon_size)
+{
+    clear_window_prefetch();
+    if (count <= 0)
+        return;
+
+    xcb_connection_t *c = XGetXCBConnection(server.display);
+    Atom atoms[PREFETCH_PROPERTY_COUNT];
+    Atom types[PREFETCH_PROPERTY_COUNT];
+    get_prefetched_property_ids(atoms, types);
+
+    // Issue all the requests, then collect the replies.
+    // The replies of the checked XCB requests carry their own errors, so missing windows do not reach the Xlib
+    // error handler.
+    xcb_get_property_cookie_t *property_cookies = calloc((size_t)count * PREFETCH_PROPERTY_COUNT,
+                                                         sizeof(*property_cookies));
+    xcb_get_geometry_cookie_t *geometry_cookies = calloc((size_t)count, sizeof(*geometry_cookies));
+    xcb_translate_coordinates_cookie_t *position_cookies = calloc((size_t)count, sizeof(*position_cookies));
+    for (int i = 0; i < count; i++) {
+        for (int p = 0; p < PREFETCH_PROPERTY_COUNT; p++)
+            property_cookies[i * PREFETCH_PROPERTY_COUNT + p] =
+                xcb_get_property(c, 0, (xcb_window_t)windows[i], (xcb_atom_t)atoms[p], (xcb_atom_t)types[p], 0, 0x7fffffff);
+        geometry_cookies[i] = xcb_get_geometry(c, (xcb_drawable_t)windows[i]);
+        position_cookies[i] = xcb_translate_coordinates(c, (xcb_window_t)windows[i], (xcb_window_t)server.root_win, 0, 0);
+    }
+
+    prefetched_windows = g_hash_table_new_full(window_hash, window_equal, NULL, free_prefetched_window);
+    PrefetchedWindow **prefetched = calloc((size_t)count, sizeof(*prefetched));
+    int num_prefetched = 0;
+    for (int i = 0; i < count; i++) {
+        PrefetchedWindow *pw = calloc(1, sizeof(PrefetchedWindow));
+        pw->win = windows[i];
+        for (int p = 0; p < PREFETCH_PROPERTY_COUNT; p++)
+            pw->properties[p] = xcb_get_property_reply(c, property_cookies[i * PREFETCH_PROPERTY_COUNT + p], NULL);
+        xcb_get_geometry_reply_t *geometry = xcb_get_geometry_reply(c, geometry_cookies[i], NULL);
+        xcb_translate_coordinates_reply_t *position = xcb_translate_coordinates_reply(c, position_cookies[i], NULL);
+        if (geometry && position) {
+            pw->has_coordinates = TRUE;
+            pw->x = position->dst_x;
+            pw->y = position->dst_y;
+            pw->w = geometry->width + geometry->border_width;
+            pw->h = geometry->height + geometry->border_width;
+        }
+        free(geometry);
+        free(position);
+        pw->icon_size = icon_size;
+        pw->icon_choice.best_icon_size = icon_size;
+        // Duplicates are possible in a broken _NET_CLIENT_LIST
+        if (g_hash_table_lookup(prefetched_windows, &pw->win)) {
+            free_prefetched_window(pw);
+            continue;
+        }
+        g_hash_table_insert(prefetched_windows, &pw->win, pw);
+        prefetched[num_prefetched++] = pw;
+    }
+    free(property_cookies);
+    free(geometry_cookies);
+    free(position_cookies);
+
+    if (icon_size > 0)
+        prefetch_icons(c, prefetched, num_prefetched);
+    free(prefetched);
+}
+
+static PrefetchedWindow *get_prefetched_window(Window win)
+{
+    return prefetched_windows ? (PrefetchedWindow *)g_hash_table_lookup(prefetched_windows, &win) : NULL;
+}
+
+static gboolean find_prefetched_property(Window win, Atom at, Atom type, xcb_get_property_reply_t **reply)
+{
+    PrefetchedWindow *pw = get_prefetched_window(win);
+    if (!pw)
+        return FALSE;
+    Atom atoms[PREFETCH_PROPERTY_COUNT];
+    Atom types[PREFETCH_PROPERTY_COUNT];
+    get_prefetched_property_ids(atoms, types);
+    for (int p = 0; p < PREFETCH_PROPERTY_COUNT; p++) {
+        if (atoms[p] == at && types[p] == type) {
+            *reply = pw->properties[p];
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+// Converts a reply to the format returned by XGetWindowProperty: format 32 values as longs, followed by a zero byte.
+// The result is allocated with Xlib's allocator, to be freed with XFree like the result of XGetWindowProperty.
+static void *convert_property_reply(xcb_get_property_reply_t *reply, int *num_results)
+{
+    if (num_results)
+        *num_results = 0;
+    if (!reply || reply->type == XCB_NONE)
+        return NULL;
+    uint32_t n = reply->value_len;
+    size_t item_size = reply->format == 8 ? 1 : reply->format == 16 ? sizeof(short) : sizeof(long);
+    size_t size = n * item_size;
+    unsigned char *data = Xcalloc(MAX(size, sizeof(long)) + 1, 1);
+    const void *value = xcb_get_property_value(reply);
+    if (reply->format == 8) {
+        memcpy(data, value, size);
+    } else if (reply->format == 16) {
+        for (uint32_t i = 0; i < n; i++)
+            ((short *)data)[i] = (short)((const uint16_t *)value)[i];
+    } else {
+        for (uint32_t i = 0; i < n; i++)
+            ((unsigned long *)data)[i] = ((const uint32_t *)value)[i];
+    }
+    if (num_results)
+        *num_results = (int)n;
+    return data;
+}
+
+void *get_window_property(Window win, Atom at, Atom type, int *num_results)
+{
+    xcb_get_property_reply_t *reply;
+    if (find_prefetched_property(win, at, type, &reply))
+        return convert_property_reply(reply, num_results);
+    return server_get_property(win, at, type, num_results);
+}
+
+int get_window_property32(Window win, Atom at, Atom type)
+{
+    xcb_get_property_reply_t *reply;
+    if (!find_prefetched_property(win, at, type, &reply))
+        return get_property32(win, at, type);
+    int data = 0;
+    unsigned long *value = convert_property_reply(reply, NULL);
+    if (value) {
+        data = (int)value[0];
+        XFree(value);
+    }
+    return data;
+}
+
+gboolean get_prefetched_coordinates(Window win, gboolean *found, int *x, int *y, int *w, int *h)
+{
+    PrefetchedWindow *pw = get_prefetched_window(win);
+    *found = pw != NULL;
+    if (!pw || !pw->has_coordinates)
+        return FALSE;
+    *x = pw->x;
+    *y = pw->y;
+    *w = pw->w;
+    *h = pw->h;
+    return TRUE;
+}
+
+guint32 *get_prefetched_icon(Window win, int icon_size, gboolean *found, int *iw, int *ih)
+{
+    PrefetchedWindow *pw = get_prefetched_window(win);
+    *found = pw && pw->icon_size > 0 && pw->icon_size == icon_size;
+    if (!*found || !pw->icon)
+        return NULL;
+    // Hand over the pixels, they are requested only once
+    guint32 *icon = pw->icon;
+    pw->icon = NULL;
+    pw->icon_size = 0;
+    *iw = pw->icon_width;
+    *ih = pw->icon_height;
+    return icon;
+}
@@ -0,0 +1,47 @@
+/**************************************************************************
+*
+* Copyright (C) 2017 tint2 authors
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+**************************************************************************/
+
+#ifndef WINDOW_PREFETCH_H
+#define WINDOW_PREFETCH_H
+
+#include <X11/Xlib.h>
+#include <glib.h>
+
+// Creating a task reads about a dozen properties of the window and its geometry, each a blocking round trip.
+// prefetch_windows() issues all these requests for a batch of windows at once through XCB, then collects the
+// replies, so that the whole batch costs a few round trips.
+// Until clear_window_prefetch() is called, the functions below answer from the prefetched replies. These become
+// stale as soon as events are processed, so the prefetch must only be kept while handling the batch.
+
+// If icon_size is not zero, the _NET_WM_ICON image closest to that size is prefetched as well.
+void prefetch_windows(const Window *windows, int count, int icon_size);
+void clear_window_prefetch();
+
+// Same as server_get_property, answered from the prefetched replies when possible. The result is freed with XFree
+// in both cases.
+void *get_window_property(Window win, Atom at, Atom type, int *num_results);
+// Same as get_property32, answered from the prefetched replies when possible.
+int get_window_property32(Window win, Atom at, Atom type);
+
+// If the coordinates of the window were prefetched, sets *found and returns them as get_window_coordinates does.
+gboolean get_prefetched_coordinates(Window win, gboolean *found, int *x, int *y, int *w, int *h);
+
+// If the icon of the window was prefetched for that size, sets *found and returns it as get_window_icon does.
+// The pixels are handed over to the caller, who frees them with XFree, like those returned by get_window_icon.
+guint32 *get_prefetched_icon(Window win, int icon_size, gboolean *found, int *iw, int *ih);
+
+#endif
@@ -0,0 +1,86 @@
+/**************************************************************************
+*
+* Copyright (C) 2017 tint2 authors
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+**************************************************************************/
+
+#include <stdlib.h>
+
+#include "window_registry.h"
+
+typedef struct RegisteredWindow {
+    Window win;
+    WindowTarget target;
+} RegisteredWindow;
+
+// Window -> RegisteredWindow *, keyed by the win field of the value
+static GHashTable *window_registry = NULL;
+
+static guint registered_window_hash(gconstpointer key)
+{
+    return (guint)*(const Window *)key;
+}
+
+static gboolean registered_window_equal(gconstpointer a, gconstpointer b)
+{
+    return *(const Window *)a == *(const Window *)b;
+}
+
+void register_window(Window win, WindowRole role, void *object)
+{
+    if (!win)
+        return;
+    if (!window_registry)
+        window_registry = g_hash_table_new_full(registered_window_hash, registered_window_equal, NULL, free);
+    RegisteredWindow *entry = g_hash_table_lookup(window_registry, &win);
+    if (!entry) {
+        entry = calloc(1, sizeof(RegisteredWindow));
+        entry->win = win;
+        g_hash_table_insert(window_registry, &entry->win, entry);
+    }
+    entry->target.role = role;
+    entry->target.object = object;
+}
+
+void unregister_window(Window win, void *object)
+{
+    if (!window_registry || !win)
+        return;
+    RegisteredWindow *entry = g_hash_table_lookup(window_registry, &win);
+    if (entry && entry->target.object == object)
+        g_hash_table_remove(window_registry, &win);
+}
+
+WindowTarget lookup_window(Window win)
+{
+    RegisteredWindow *entry = window_registry && win ? g_hash_table_lookup(window_registry, &win) : NULL;
+    if (entry)
+        return entry->target;
+    WindowTarget unknown = {WINDOW_UNKNOWN, NULL};
+    return unknown;
+}
+
+void *lookup_window_object(Window win, WindowRole role)
+{
+    WindowTarget target = lookup_window(win);
+    return target.role == role ? target.object : NULL;
+}
+
+void cleanup_window_registry()
+{
+    if (window_registry) {
+        g_hash_table_destroy(window_registry);
+        window_registry = NULL;
+    }
+}
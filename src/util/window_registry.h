@@ -0,0 +1,43 @@
+#ifndef WINDOW_REGISTRY_H
+#define WINDOW_REGISTRY_H
+
+#include <X11/Xlib.h>
+#include <glib.h>
+
+// Maps the windows created or tracked by tint2 to the objects that own them, so that the event dispatcher can
+// find the target of an event with a single hash lookup.
+
+typedef enum WindowRole {
+    WINDOW_UNKNOWN = 0,
+    // object: Panel *
+    WINDOW_PANEL,
+    // object: TrayWindow *, for the icon window
+    WINDOW_TRAY_ICON,
+    // object: TrayWindow *, for the window that embeds the icon
+    WINDOW_TRAY_PARENT,
+    // object: GPtrArray * of Task *, as in win_to_task
+    WINDOW_TASK,
+    // object: Tooltip *
+    WINDOW_TOOLTIP
+} WindowRole;
+
+typedef struct WindowTarget {
+    WindowRole role;
+    void *object;
+} WindowTarget;
+
+// Registers (or replaces) the target of a window.
+void register_window(Window win, WindowRole role, void *object);
+
+// Unregisters a window, only if it is still registered for that object.
+void unregister_window(Window win, void *object);
+
+// Returns the target of a window, or {WINDOW_UNKNOWN, NULL}.
+WindowTarget lookup_window(Window win);
+
+// Returns the object registered for the window with that role, or NULL.
+void *lookup_window_object(Window win, WindowRole role);
+
+void cleanup_window_registry();
+
+#endif